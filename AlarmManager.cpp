@@ -1,5 +1,61 @@
 #include "AlarmManager.h"
 #include "Display.h"
+#include "Telemetry.h"
+#include "Recorder.h"
+
+// text for display screen; AVR keeps string literals in SRAM, so each is its
+// own PROGMEM array and the table of pointers is in flash too
+static const char textShutdown[]     PROGMEM = "Ventilation Shutdown";
+static const char textApnea[]        PROGMEM = "Apnea Detected";
+static const char textPowerFail[]    PROGMEM = "Power Failure";
+static const char textInletGas[]     PROGMEM = "Air Supply Disconnected";
+static const char textInletO2[]      PROGMEM = "Oxygen Supply Disconnected";
+static const char textBatteryLow[]   PROGMEM = "Low Battery";
+static const char textP1SensorFail[] PROGMEM = "Pressure Sensor Failure (Reservoir)";
+static const char textP2SensorFail[] PROGMEM = "Pressure Sensor Failure (Inspiration)";
+static const char textP3SensorFail[] PROGMEM = "Pressure Sensor Failure (Expiration)";
+static const char textF1SensorFail[] PROGMEM = "Flow Sensor Failure (Inspiration)";
+static const char textF2SensorFail[] PROGMEM = "Flow Sensor Failure (Expiration)";
+static const char textSelfTestFail[] PROGMEM = "Startup Self-Test Failed";
+static const char textWdtReset[]     PROGMEM = "Controller Reset";
+static const char textDisconnect[]   PROGMEM = "Circuit Disconnected";
+static const char textInspHigh[]     PROGMEM = "Excess Inspiratory Pressure";
+static const char textPeepHigh[]     PROGMEM = "High PEEP";
+static const char textPeepLow[]      PROGMEM = "Low PEEP";
+static const char textInspLow[]      PROGMEM = "Low Inspiratory Pressure";
+static const char textLeak[]         PROGMEM = "Circuit Leak";
+static const char textTidalHigh[]    PROGMEM = "Tidal Volume High";
+static const char textPplatHigh[]    PROGMEM = "Plateau Pressure High";
+static const char textTidalLow[]     PROGMEM = "Tidal Volume Low";
+static const char textO2SensorFail[] PROGMEM = "Oxygen Sensor Failure";
+static const char textLowMemory[]    PROGMEM = "Low Memory";
+
+const char *const alarmText[N_ALARMS] PROGMEM = {
+  textShutdown,
+  textApnea,
+  textPowerFail,
+  textInletGas,
+  textInletO2,
+  textBatteryLow,
+  textP1SensorFail,
+  textP2SensorFail,
+  textP3SensorFail,
+  textF1SensorFail,
+  textF2SensorFail,
+  textSelfTestFail,
+  textWdtReset,
+  textDisconnect,
+  textInspHigh,
+  textPeepHigh,
+  textPeepLow,
+  textInspLow,
+  textLeak,
+  textTidalHigh,
+  textPplatHigh,
+  textTidalLow,
+  textO2SensorFail,
+  textLowMemory
+};
 
 static const alarmCode firstCodeAtPriority[] = {
   FIRST_ALARM,                              // First HIGH_PRIORITY code
@@ -93,8 +149,9 @@ void AlarmManager::activateAlarm(alarmCode code) {
       // @TODO: Shouldn't turning on any alarm at same or higher priority unsilence alarms?
       alarmSounding = true;
       beginAlarm();
-      display.showAlarm(alarmText[code],getAlarmPriority(code));
+      display.showAlarm(alarmName(code),getAlarmPriority(code));
     }
+    sendState();
   }
 }
 
@@ -122,10 +179,28 @@ void AlarmManager::deactivateAlarm(alarmCode code) {
       alarmRearm = ULONG_MAX;
     } else if (top > code) {   // recall that lowest code is highest priority!
       // lower priority alarm remains
-      display.showAlarm(alarmText[top],getAlarmPriority(top));
+      display.showAlarm(alarmName(top),getAlarmPriority(top));
       beginAlarm();
     }  // else allow higher-priority alarm to continue
+    sendState();
+  }
+}
+
+/*
+ * Sends the set of active alarms, one bit per code, so monitoring hosts and
+ * recordings can follow them
+ */
+void AlarmManager::sendState() {
+  AlarmState state;
+  state.time = millis();
+  state.active = 0;
+  for (alarmCode i = FIRST_ALARM; i < N_ALARMS; ++i) {
+    if (alarms[i]) {
+      state.active |= 1UL << i;
+    }
   }
+  telemetry.sendAlarms(state);
+  recorder.record(TELEMETRY_ALARM, &state, sizeof(state));
 }
 
 /*
@@ -289,7 +364,7 @@ void AlarmManager::maintainAlarms() {
     } else {
       // no alarm detected -- reaching this point is probably a bug
       // because alarmSounding should only be true when there is an alarm set
-      Serial.println("ERROR:  alarmSounding set but no alarm active.");
+      Serial.println(F("ERROR:  alarmSounding set but no alarm active."));
       alarmSounding = false;
     }
     if (alarmLED == true) {
@@ -316,7 +391,7 @@ void AlarmManager::maintainAlarms() {
     } else {
       // no alarm detected -- reaching this point is probably a bug
       // because alarmLED should only be true when there is an alarm set
-      Serial.println("ERROR:  alarmLED set but no alarm active.");
+      Serial.println(F("ERROR:  alarmLED set but no alarm active."));
       alarmLED = false;
     }
   }
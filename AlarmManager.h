@@ -14,26 +14,33 @@ enum alarmCode {
   ALARM_INLET_GAS,     // 3 - HIGH
   ALARM_INLET_O2,      // 4 - HIGH
   ALARM_BATTERY_LOW,   // 5 - HIGH
-  ALARM_P1SENSOR_FAIL, // 6 - HIGH
-  ALARM_P2SENSOR_FAIL, // 7 - HIGH
-  ALARM_P3SENSOR_FAIL, // 8 - HIGH
-  ALARM_INSP_HIGH,     // 9 - HIGH    insp pressure implemented
-  ALARM_PEEP_HIGH,     // 10 - MEDIUM               implemented
-  ALARM_PEEP_LOW,      // 11 - MEDIUM               implemented
-  ALARM_INSP_LOW,      // 12 - MEDIUM insp pressure implemented
-  ALARM_TIDAL_HIGH,    // 13 - MEDIUM               implemented
-  ALARM_PPLAT_HIGH,    // 14 - MEDIUM
-  ALARM_TIDAL_LOW,     // 15 - LOW                  implemented 
-  ALARM_O2SENSOR_FAIL, // 16 - LOW    
-  N_ALARMS,            // 17 Number of alarms
-  ALARM_NONE,          // 18
+  ALARM_P1SENSOR_FAIL, // 6 - HIGH                  implemented
+  ALARM_P2SENSOR_FAIL, // 7 - HIGH                  implemented
+  ALARM_P3SENSOR_FAIL, // 8 - HIGH                  implemented
+  ALARM_F1SENSOR_FAIL, // 9 - HIGH                  implemented
+  ALARM_F2SENSOR_FAIL, // 10 - HIGH                 implemented
+  ALARM_SELFTEST_FAIL, // 11 - HIGH                 implemented
+  ALARM_WATCHDOG_RESET,// 12 - HIGH                 implemented
+  ALARM_DISCONNECT,    // 13 - HIGH                 implemented
+  ALARM_INSP_HIGH,     // 14 - HIGH   insp pressure implemented
+  ALARM_PEEP_HIGH,     // 15 - MEDIUM               implemented
+  ALARM_PEEP_LOW,      // 16 - MEDIUM               implemented
+  ALARM_INSP_LOW,      // 17 - MEDIUM insp pressure implemented
+  ALARM_LEAK,          // 18 - MEDIUM               implemented
+  ALARM_TIDAL_HIGH,    // 19 - MEDIUM               implemented
+  ALARM_PPLAT_HIGH,    // 20 - MEDIUM
+  ALARM_TIDAL_LOW,     // 21 - LOW                  implemented 
+  ALARM_O2SENSOR_FAIL, // 22 - LOW                  implemented
+  ALARM_LOW_MEMORY,    // 23 - LOW                  implemented
+  N_ALARMS,            // 24 Number of alarms
+  ALARM_NONE,          // 25
 
   FIRST_ALARM = 0,
 
   // Alarm priority groups
   ALARM_MAX_HIGH_PRIORITY = ALARM_INSP_HIGH,
   ALARM_MAX_MED_PRIORITY = ALARM_TIDAL_HIGH,
-  ALARM_MAX_LOW_PRIORITY = ALARM_O2SENSOR_FAIL
+  ALARM_MAX_LOW_PRIORITY = ALARM_LOW_MEMORY
 };
 
 // Allow incrementing an `alarmCode` to get the next code.
@@ -47,26 +54,13 @@ enum alarmPriority {
   NO_ALARM       // 3
 };
 
-// text for display screen -- should objectify this eventually
-static const char *alarmText[N_ALARMS] = {
-  "Ventilation Shutdown",
-  "Apnea Detected",
-  "Power Failure",
-  "Air Supply Disconnected",
-  "Oxygen Supply Disconnected",
-  "Low Battery",
-  "Pressure Sensor Failure (Reservoir)",
-  "Pressure Sensor Failure (Inspiration)",
-  "Pressure Sensor Failure (Expiration)",
-  "Excess Inspiratory Pressure",
-  "High PEEP",
-  "Low PEEP",
-  "Low Inspiratory Pressure",
-  "Tidal Volume High",
-  "Plateau Pressure High",
-  "Tidal Volume Low",
-  "Oxygen Sensor Failure" 
-};
+// text for display screen, in flash (defined in AlarmManager.cpp)
+extern const char *const alarmText[N_ALARMS] PROGMEM;
+
+// the text of alarm `code`, for printing or `Display::showAlarm`
+inline const __FlashStringHelper *alarmName(alarmCode code) {
+  return reinterpret_cast<const __FlashStringHelper *>(pgm_read_ptr(&alarmText[code]));
+}
 
 class AlarmManager {
   public:
@@ -79,6 +73,7 @@ class AlarmManager {
     alarmCode topAlarm();                   // returns code of current highest priority active alarm, else `ALARM_NONE`
     void maintainAlarms();                  // call every cycle to perform alarm maintenance & update
     alarmPriority getAlarmPriority(alarmCode code);  // returns the priority of the alarm
+    void sendState();                       // sends the active alarms to telemetry and the SD recording (done on every change)
 
   private:
     bool onPriority(alarmPriority level);   // determines whether an alarm of specified priority is on
@@ -0,0 +1,66 @@
+#include "AutoTune.h"
+
+void AutoTune::begin(float setpoint, float bias, float amplitude, float hysteresis) {
+  setpoint_   = setpoint;
+  bias_       = bias;
+  amplitude_  = amplitude;
+  hysteresis_ = hysteresis;
+
+  running_    = true;
+  succeeded_  = false;
+  relay_high_ = true;
+  start_time_ = last_rise_ = millis();
+  cycles_     = 0;
+  cycle_max_  = -1e6;
+  cycle_min_  = 1e6;
+  period_sum_ = amplitude_sum_ = 0;
+}
+
+int AutoTune::update(unsigned long now, float flow) {
+  if (!running_) return 0;
+
+  if (now - start_time_ > AUTOTUNE_TIMEOUT) {
+    running_ = false; // no sustained oscillation: leave the gains alone
+    return 0;
+  }
+
+  cycle_max_ = max(cycle_max_, flow);
+  cycle_min_ = min(cycle_min_, flow);
+
+  if (relay_high_ && flow > setpoint_ + hysteresis_) {
+    relay_high_ = false;
+  } else if (!relay_high_ && flow < setpoint_ - hysteresis_) {
+    // a full cycle ends each time the relay switches back to the high opening
+    relay_high_ = true;
+    if (cycles_ >= AUTOTUNE_SKIP_CYCLES) {
+      period_sum_    += now - last_rise_;
+      amplitude_sum_ += (cycle_max_ - cycle_min_) / 2;
+    }
+    last_rise_ = now;
+    cycle_max_ = -1e6;
+    cycle_min_ = 1e6;
+
+    if (++cycles_ >= AUTOTUNE_SKIP_CYCLES + AUTOTUNE_CYCLES) {
+      finish();
+      return 0;
+    }
+  }
+
+  return relay_high_ ? bias_ + amplitude_ : bias_ - amplitude_;
+}
+
+/**
+ * Describing-function estimate of the ultimate gain for a relay with hysteresis:
+ * Ku = 4d / (pi * sqrt(a^2 - h^2))
+ */
+void AutoTune::finish() {
+  running_ = false;
+
+  float a = amplitude_sum_ / AUTOTUNE_CYCLES;
+  tu_ = period_sum_ / AUTOTUNE_CYCLES;
+  if (a <= hysteresis_ || tu_ <= 0) {
+    return; // oscillation too small to measure
+  }
+  ku_ = 4 * amplitude_ / (PI * sqrt(a * a - hysteresis_ * hysteresis_));
+  succeeded_ = true;
+}
@@ -0,0 +1,57 @@
+/**
+ * AutoTune.h
+ * Relay-feedback identification of the inspiratory valve/flow plant.
+ *
+ * The valve is switched between two openings whenever the flow crosses the
+ * setpoint, which makes the loop oscillate at its ultimate period Tu. The
+ * ultimate gain Ku follows from the relay and oscillation amplitudes, and PI
+ * gains are derived with the Tyreus-Luyben rules (less overshoot than
+ * Ziegler-Nichols, which suits a patient circuit).
+ */
+
+#ifndef AutoTune_h
+#define AutoTune_h
+
+#include "Arduino.h"
+#include "Constants.h"
+
+class AutoTune {
+  public:
+    // start an experiment around `setpoint` (SLPM), switching the valve `bias` +/- `amplitude`
+    void begin(float setpoint, float bias, float amplitude, float hysteresis);
+
+    // feed a flow sample; returns the valve command to apply
+    int update(unsigned long now, float flow);
+
+    // abandon the experiment (results are left as they were)
+    void cancel() { running_ = false; }
+
+    bool running() const { return running_; }
+    bool succeeded() const { return succeeded_; }
+
+    // identified plant and resulting gains (valid once `succeeded`)
+    float ultimateGain() const { return ku_; }
+    float ultimatePeriod() const { return tu_ / 1000.0; } // seconds
+    float kp() const { return ku_ / 3.2; }
+    float ki() const { return kp() / (2.2 * ultimatePeriod()); }
+    float kd() const { return 0; }
+
+  private:
+    float setpoint_, bias_, amplitude_, hysteresis_;
+    bool  running_ = false;
+    bool  succeeded_ = false;
+    bool  relay_high_;
+
+    unsigned long start_time_;
+    unsigned long last_rise_;  // time of the last switch to the high opening
+    int   cycles_;             // completed oscillation cycles
+    float cycle_max_, cycle_min_;
+
+    // sums over measured cycles
+    float period_sum_, amplitude_sum_;
+    float ku_, tu_;
+
+    void finish();
+};
+
+#endif
@@ -0,0 +1,612 @@
+#include "Circuit.h"
+#include "HardwareIO.h"
+#include "LoadBenchmark.h"
+
+template <class IO>
+void Circuit<IO>::readSensors() {
+  //inspiratory sensors
+  io_.inspFlow.read();      // inspiratory flow (SLPM)
+  io_.inspPressure.read();  // inspiratory pressure (cmH2O)
+
+  //expiratory sensors
+  io_.expFlow.read();       // expiratory flow (SLPM)
+  io_.expPressure.read();   // expiratory pressure (cmH2O)
+}
+
+template <class IO>
+void Circuit<IO>::tick() {
+  // go to the state machine of the current mode
+  if (vent_mode_ == PS_MODE) {
+    pressureSupport();
+  } else {
+    volumeControl();
+  }
+}
+
+template <class IO>
+void Circuit<IO>::checkTrigger() {
+  if (state_ == HOLD_EXP_STATE && io_.triggered()) {
+    beginInspiration();
+    setState(INSP_STATE);
+  }
+}
+
+/**
+ * function to check if sensor readings are within acceptable ranges
+ * activate an alarm if they are not and deactivate the alarm once they are again
+ *
+ * @param reading -- sensor reading
+ * @param compareValue -- value to compare reading to
+ * @param sensitivity -- the range of error
+ * @param highAlarmCode -- the high alarm code for a specific sensor
+ * @param lowAlarmCode -- the low alarm code for a specific sensor
+ */
+template <class IO>
+void Circuit<IO>::checkAlarmRangeWithUpdate(float reading, float &compareValue, float sensitivity, alarmCode highAlarmCode, alarmCode lowAlarmCode) {
+  // if not the first reading, compare and alarm if abnormal
+  if (!isnan(compareValue)) {
+    if (reading > compareValue + sensitivity) {
+      io_.alarms.activateAlarm(highAlarmCode);
+    } else if (reading < compareValue - sensitivity) {
+      io_.alarms.activateAlarm(lowAlarmCode);
+    } else {
+      io_.alarms.deactivateAlarm(lowAlarmCode);
+      compareValue = reading; // update to remember value for next comparison
+    }
+  } else {
+    compareValue = reading; // update to remember value for next comparison
+  }
+}
+
+/**
+ * check against a value that doesn't need to be stored -- call above with dummy variable
+ */
+template <class IO>
+void Circuit<IO>::checkAlarmRange(float reading, float compareValue, float sensitivity, alarmCode highAlarmCode, alarmCode lowAlarmCode) {
+  float dummyCompareValue = compareValue;
+  checkAlarmRangeWithUpdate(reading, dummyCompareValue, sensitivity, highAlarmCode, lowAlarmCode);
+}
+
+/**
+ * check for errors in sensor readings and take appropriate action
+ */
+template <class IO>
+void Circuit<IO>::checkReadings() {
+  // @FutureWork: We only alarm after first 5 breaths (this is a "warm up" issue where it takes time to stabilize)
+  if (cycle_count_ <= 5) {
+    return;
+  }
+
+  checkAlarmRangeWithUpdate(io_.inspPressure.peak(), last_peak_, INSP_PRESSURE_SENSITIVITY, ALARM_INSP_HIGH, ALARM_INSP_LOW);
+  if (vent_mode_ == VC_MODE) {
+    checkAlarmRange(tidal_volume_insp_, io_.settings.volume(), io_.settings.volume()/TIDAL_VOLUME_SENSITVITY, ALARM_TIDAL_HIGH, ALARM_TIDAL_LOW);
+  }
+  io_.alarms.maintainAlarms(); // maintain onging alarms
+}
+
+/**
+ * Keep the flow sensor zeros tracking while their limbs carry no flow: the
+ * inspiratory limb whenever SV3 is shut (not inspiring or holding a bias
+ * flow), the expiratory limb whenever SV4 is
+ */
+template <class IO>
+void Circuit<IO>::trackFlowZeros(bool calibrating) {
+  io_.inspFlow.trackZero(!calibrating && state_ != INSP_STATE && !biasing_);
+  io_.expFlow.trackZero(state_ == INSP_STATE || state_ == HOLD_INSP_STATE);
+}
+
+template <class IO>
+void Circuit<IO>::turnOff() {
+  if (state_ != OFF_STATE) {
+    beginOff(); // close SV3 so the limb really is idle while off
+  }
+  setState(OFF_STATE);
+}
+
+/**
+ * An interrupted inspiration's delivered volume is unknown, so the breath
+ * resumes in expiration and the next one starts when it was due. Its
+ * volumes weren't measured by this boot, so it is neither reported nor
+ * learned from (see resumed_).
+ */
+template <class IO>
+void Circuit<IO>::resume(States saved, unsigned long cycleElapsed) {
+  if (saved == OFF_STATE) {
+    beginOff();
+    setState(OFF_STATE);
+    return;
+  }
+
+  // millis() restarted from 0, so the breath began before it: cycle_timer_
+  // wraps below 0, and the unsigned differences from it (cycleElapsed, the
+  // breath's duration) still come out right. A breath already overdue ends now.
+  unsigned long now = millis();
+  cycle_timer_ = now - cycleElapsed;
+  computeBreathTargets();
+  if (target_cycle_end_time_ - cycle_timer_ <= cycleElapsed) {
+    target_cycle_end_time_ = now;
+  }
+  resumed_ = true;
+  setState(EXP_STATE);
+  beginExpiration();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// VOLUME CONTROL STATE MACHINE
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class IO>
+void Circuit<IO>::setState(States newState) {
+  state_ = newState;
+  io_.stateChanged();
+}
+
+/**
+ * This is normally the first state
+ * @FutureWork: implement a turnOffAll method in AlarmManager class to be used here
+ */
+template <class IO>
+void Circuit<IO>::beginOff() {
+  io_.pressureControl.endBreath(); // stop pressure support if a PS breath was running
+  io_.inspValve.endBreath(); // close the inspiratory valve
+  biasing_ = false;
+  io_.expFlow.trackZero(false);
+  io_.expValve.open();       // keep expiratory valve open for safety (also does not use as much power)
+}
+
+/**
+ * Hand the values of the breath that just ended to IO::reportBreath
+ */
+template <class IO>
+void Circuit<IO>::reportLastBreath(float minuteVolume) {
+  BreathReport report;
+  report.breath        = cycle_count_ - 1;
+  report.time          = cycle_timer_ - cycle_duration_;
+  report.duration      = cycle_duration_;
+  report.peak          = io_.inspPressure.peak();
+  report.plateau       = io_.inspPressure.plateau();
+  report.peep          = io_.expPressure.peep();
+  report.volumeInsp    = tidal_volume_insp_;
+  report.volumeExp     = tidal_volume_exp_;
+  report.minuteVolume  = minuteVolume;
+  report.rate          = 60000.0/cycle_duration_;
+  report.compliance    = io_.mechanics.compliance();
+  report.resistance    = io_.mechanics.resistance();
+  report.triggerDelay  = trigger_delay_;
+  report.pressureError = last_pressure_error_;
+  report.leak          = io_.leak.leakFlow();
+  report.leakFraction  = io_.leak.leakFraction();
+  io_.reportBreath(report);
+
+  last_pressure_error_ = 0.0/0.0;
+}
+
+/**
+ * Compute the breath's target intervals and flow at current settings, from cycle_timer_
+ */
+template <class IO>
+void Circuit<IO>::computeBreathTargets() {
+  unsigned long targetCycleDuration = 60000UL / io_.settings.bpm(); // ms from start of cycle to end of inspiration
+  target_insp_duration_  = 105 * targetCycleDuration * io_.settings.inspPercent() / 10000; // allowing a bit more time to complete tidal volume inhailation
+  target_cycle_end_time_ = cycle_timer_ + targetCycleDuration;                             // target time for breath to end (for HOLD_EXP_STATE to end)
+  target_insp_end_time_  = cycle_timer_ + target_insp_duration_;                           // target time for INSP_STATE to end
+  target_exp_duration_   = targetCycleDuration - target_insp_duration_ - MIN_PEEP_PAUSE;   // target time for EXP_STATE to end
+  target_insp_volume_ = io_.settings.volume() + io_.leak.compensation(io_.settings.volume(), target_insp_duration_);
+  desired_insp_flow_ = target_insp_volume_ * CC_PER_MS_TO_LPM / target_insp_duration_;   // desired inspiratory flowrate cc/ms
+}
+
+template <class IO>
+float Circuit<IO>::nextBreathVolume() const {
+  if (requestedMode == PS_MODE) return tidal_volume_insp_;
+  unsigned long inspDuration = 105 * (60000UL / io_.settings.bpm()) * io_.settings.inspPercent() / 10000; // as computeBreathTargets
+  return io_.settings.volume() + io_.leak.compensation(io_.settings.volume(), inspDuration);
+}
+
+/**
+ * Runs during any transition to the INSP_STATE from any other state
+ *
+ * The valves are switched before anything is written to the display so that
+ * a slow display transaction can't delay a patient-triggered breath.
+ */
+template <class IO>
+void Circuit<IO>::beginInspiration() {
+  cycle_duration_ = millis() - cycle_timer_; // calculate the length of the last breath
+  cycle_timer_ = millis();                   // reset the cycle timer at the start of inspiration
+
+  // record values from last breath
+  exp_duration_ = cycle_timer_ - exp_timer_;      // measured duration of last expiration (EXP_STATE + PEEP_PAUSE + EXP_HOLD)
+  tidal_volume_exp_ = expiredVolume();           // set current expired volume (less any bias flow) as the measured expiratory tidal volume for the last breath
+  biasing_ = false;                              // SV3 is taken over for the breath below
+
+  // calculate actual minute volume from last breath
+  const float minuteVolume = io_.inspFlow.getVolume() * CC_PER_MS_TO_LPM / cycle_duration_;
+
+  // compare what went in with what came back to update the leak estimate
+  if (!resumed_) {
+    io_.leak.endBreath(io_.inspFlow.getVolume(), tidal_volume_exp_, cycle_duration_);
+  }
+
+  // close expiratory valve
+  io_.expValve.close();
+
+  computeBreathTargets();
+
+  // measure how long a patient trigger took to act on, then stop watching for one
+  trigger_delay_ = io_.triggered() ? (long)(micros() - io_.triggerTime()) : -1;  // -1: not triggered
+  io_.disarmTrigger();
+
+  // a mode change takes effect on a breath boundary
+  vent_mode_ = requestedMode;
+
+  // SV3 is about to open, so the inspiratory no-flow window ends here
+  io_.inspFlow.trackZero(false);
+
+  if (vent_mode_ == PS_MODE) {
+    // ramp from the current airway pressure to the support level above PEEP
+    io_.pressureControl.beginBreath(io_.inspPressure.get(), io_.expPressure.peep() + io_.settings.peakPressure(),
+                                    io_.settings.riseTime() * 1000);
+  } else {
+    // begin PID control based on desired flow
+    io_.inspValve.beginBreath(desired_insp_flow_);
+  }
+
+  // reset tidal volume, the peak flow cycle-off is measured against and the
+  // peak pressure the disconnect check watches for
+  io_.inspFlow.resetVolume();
+  io_.inspFlow.resetPeak();
+  io_.inspPressure.resetPeak();
+  io_.leak.beginBreath(io_.inspPressure.get());
+  io_.mechanics.begin();
+  cycle_count_++;
+
+  // the blender learns the reservoir drop per cc from this breath (PS volume isn't set, use the last one)
+  io_.beginInspiration(vent_mode_ == PS_MODE ? tidal_volume_insp_ : target_insp_volume_);
+
+  // the patient is breathing again
+  if (trigger_delay_ >= 0 && io_.alarms.alarmStatus(ALARM_APNEA)) {
+    io_.alarms.deactivateAlarm(ALARM_APNEA);
+  }
+
+  checkLeak();
+
+  if (!resumed_) {
+    reportLastBreath(minuteVolume);
+  }
+  resumed_ = false;
+}
+
+/**
+ * Leak and disconnect alarms, from the breath that just ended
+ */
+template <class IO>
+void Circuit<IO>::checkLeak() {
+  if (io_.leak.disconnected()) {
+    io_.alarms.activateAlarm(ALARM_DISCONNECT);
+  } else if (io_.alarms.alarmStatus(ALARM_DISCONNECT)) {
+    io_.alarms.deactivateAlarm(ALARM_DISCONNECT);
+  }
+
+  if (io_.leak.leakFraction() > LEAK_ALARM_FRACTION) {
+    io_.alarms.activateAlarm(ALARM_LEAK);
+  } else if (io_.alarms.alarmStatus(ALARM_LEAK)) {
+    io_.alarms.deactivateAlarm(ALARM_LEAK);
+  }
+}
+
+/**
+ * Watch for the patient's inspiratory effort from the sampling interrupt
+ */
+template <class IO>
+void Circuit<IO>::armPatientTrigger() {
+  // SV3's flow is set by the reservoir pressure, so an effort barely changes it; instead the
+  // patient draws on the bias flow, and less of it leaves through the expiratory limb. The
+  // trigger is expiratory flow falling below the bias, measured now on the inspiratory limb,
+  // by the threshold: any exhalation still running only keeps the expiratory flow higher.
+  // Without enough bias to draw on (flow triggering was chosen during this expiration, or
+  // SV3 gives less than the threshold) the pressure trigger stands in for this breath.
+  float bias = biasing_ ? io_.inspFlow.get() : 0;
+  if (triggerMode == FLOW_TRIGGER && bias > flowTriggerThreshold) {
+    io_.armTrigger(true, io_.expFlow.rawFor(bias - flowTriggerThreshold));
+  } else {
+    io_.armTrigger(false, io_.expPressure.rawFor(io_.expPressure.peep() - io_.settings.sensitivity()));
+  }
+}
+
+/**
+ * Run every time we transition to HOLD_INSP state
+ */
+template <class IO>
+void Circuit<IO>::beginHoldInspiration() {
+  // close inspiratory valve, turn off PID control and reset timer
+  io_.inspValve.endBreath();
+  insp_hold_timer_ = millis();
+  pressure_window_open_ = false;
+
+  // Perform inspiration hold only once per button press on the UI
+  io_.settings.resetInspHold();
+}
+
+/**
+ * Run every time we enter EXP_STATE from any other state
+ */
+template <class IO>
+void Circuit<IO>::beginExpiration() {
+  io_.inspPressure.setPeakAndReset(); // reset pip, cmH2O
+
+  // record and display inspiratory tidal volume (less the estimated leak when compensating)
+  tidal_volume_insp_ = io_.inspFlow.getVolume();
+  if (io_.leak.compensating()) {
+    tidal_volume_insp_ -= io_.leak.inspiratoryLeak(millis() - cycle_timer_);
+  }
+  if (!resumed_) {
+    io_.showVolumeInsp(tidal_volume_insp_);
+    io_.endInspiration(io_.inspFlow.getVolume());
+  }
+
+  io_.inspValve.endBreath();   // close insp valve and turn off PID control
+  io_.expFlow.trackZero(false); // SV4 is about to open, ending the expiratory no-flow window
+  io_.expValve.open();         // open expiration valve
+  exp_timer_ = millis();       // reset  timer
+
+  // a flow trigger needs a bias flow for the patient's effort to draw on; it
+  // starts now so it has settled by the end of the PEEP pause
+  biasing_ = triggerMode == FLOW_TRIGGER;
+  if (biasing_) {
+    io_.inspValve.holdBias(FLOW_TRIGGER_BIAS);
+  }
+  bias_volume_ = 0;
+  bias_timer_ = exp_timer_;
+
+  // calculate 80% of inspired volume, whic is the condition to leave this state (bias flow not counted)
+  target_exp_volume_ = io_.inspFlow.getVolume() * 8 / 10;
+  target_exp_end_time_ = exp_timer_ + target_exp_duration_;
+
+  io_.expFlow.resetVolume();
+}
+
+/**
+ * run every time we enter PEEP_PAUSE state
+ */
+template <class IO>
+void Circuit<IO>::beginPeepPause() {
+  peep_pause_timer_ = millis(); // reset timer
+  pressure_window_open_ = false;
+}
+
+/**
+ * Expired volume, and the bias flow's volume to take off it
+ */
+template <class IO>
+void Circuit<IO>::updateExpiredVolume() {
+  io_.expFlow.updateVolume();
+  if (biasing_) {
+    unsigned long now = millis();
+    bias_volume_ += io_.inspFlow.get() * LPM_TO_CC_PER_MS * (now - bias_timer_);
+    bias_timer_ = now;
+  }
+}
+
+/**
+ * EXP_STATE, shared by both modes
+ */
+template <class IO>
+void Circuit<IO>::maintainExpiration() {
+  // To update flow graph, flip sign of expiratory flow sensor to show flow out of lungs
+  io_.showFlow(io_.expFlow.get() * -1);
+  updateExpiredVolume();
+
+  // if 80% of inspired volume has been expired, transition to PEEP_PAUSE_STATE
+  if (expiredVolume() >= target_exp_volume_ || millis() > target_exp_end_time_ + EXP_TIME_SENSITIVITY){
+    setState(PEEP_PAUSE_STATE);
+    beginPeepPause();
+  }
+}
+
+/**
+ * PEEP_PAUSE_STATE, shared by both modes
+ */
+template <class IO>
+void Circuit<IO>::maintainPeepPause() {
+  // To update flow graph, flip sign of expiratory flow sensor to show flow out of lungs
+  io_.showFlow(io_.expFlow.get() * -1);
+  updateExpiredVolume();
+
+  // average PEEP over the last PEEP_WINDOW of the pause
+  if (!pressure_window_open_ && millis() - peep_pause_timer_ >= MIN_PEEP_PAUSE - PEEP_WINDOW) {
+    io_.expPressure.beginWindow();
+    pressure_window_open_ = true;
+  }
+
+  // if the PEEP pause time has run out, transition to HOLD_EXP_STATE; not while the
+  // sampling interrupt is stopped (an O2 sample), as the trigger would be armed blind
+  if (millis() - peep_pause_timer_ >= MIN_PEEP_PAUSE && !io_.samplingSuspended()) {
+    io_.expPressure.setPeep();
+    armPatientTrigger();
+    setState(HOLD_EXP_STATE);
+  }
+}
+
+/**
+ * Volume Control state machine
+ */
+template <class IO>
+void Circuit<IO>::volumeControl() {
+  switch (state_) {
+    case OFF_STATE:
+      if (!io_.settings.isTurnedOff()) {
+        setState(INSP_STATE);
+        beginInspiration();  // beging inspiration!
+      }
+      break;
+
+    case INSP_STATE: {
+      io_.showFlow(io_.inspFlow.get());
+      io_.inspFlow.updateVolume();
+      io_.mechanics.addSample(io_.inspPressure.get(), io_.inspFlow.get(), io_.inspFlow.getVolume());
+
+      // a disconnected circuit delivers volume without building pressure
+      if (io_.leak.checkInspiration(io_.inspFlow.getVolume(), io_.inspPressure.peakSoFar())) {
+        io_.alarms.activateAlarm(ALARM_DISCONNECT);
+      }
+
+      // calculate if the INSP_STATE should time out
+      bool timeout = (millis() >= target_insp_end_time_ + INSP_TIME_SENSITIVITY);
+
+      // transition out of INSP_STATE if we either the desired tidal volume or state timed out
+      if (io_.inspFlow.getVolume() >= target_insp_volume_ || timeout) {
+        if (timeout) {
+          // this means we didn't reach tidal volume so trigger alarm
+          io_.alarms.activateAlarm(ALARM_TIDAL_LOW);
+        } else if(io_.alarms.alarmStatus(ALARM_TIDAL_LOW)){
+          io_.alarms.deactivateAlarm(ALARM_TIDAL_LOW);      //otherwise deactivate a low tidal volume alarm if one is currently on
+        }
+
+        io_.mechanics.finish(); // fit compliance and resistance over this inspiration
+
+        // if user turned on inspiratory hold, transition to INSP_HOLD_STATE
+        if (io_.settings.inspHold()) {
+          setState(HOLD_INSP_STATE);
+          beginHoldInspiration();
+        } else {
+          // otherwise, transition to EXP_STATE
+          setState(EXP_STATE);
+          beginExpiration();
+        }
+
+        insp_duration_ = millis() - cycle_timer_; // Record length of inspiration
+      } else {
+        // if transition criteria is not met, keep adjusting inspiratory valve
+        io_.inspValve.maintainBreath(cycle_timer_);
+      }
+    } break;
+
+    case HOLD_INSP_STATE:
+      io_.showFlow(io_.inspFlow.get());
+
+      // average the plateau over the last PLATEAU_WINDOW of the hold
+      if (!pressure_window_open_ && millis() - insp_hold_timer_ >= HOLD_INSP_DURATION - PLATEAU_WINDOW) {
+        io_.inspPressure.beginWindow();
+        pressure_window_open_ = true;
+      }
+
+      // if we reached the end time for HOLD_INSP_STATE
+      if (HOLD_INSP_DURATION <= millis() - insp_hold_timer_) {
+        io_.inspPressure.setPlateau();
+        // check plateau pressure range and alarm if abnormal
+        if (io_.inspPressure.plateau() > PPLAT_MAX) {
+          io_.alarms.activateAlarm(ALARM_PPLAT_HIGH);
+        } else if (io_.alarms.alarmStatus(ALARM_PPLAT_HIGH)) {
+          io_.alarms.deactivateAlarm(ALARM_PPLAT_HIGH);
+        }
+
+        setState(EXP_STATE); // switch to EXP_STATE
+        beginExpiration();
+      }
+      break;
+
+    case EXP_STATE:
+      maintainExpiration();
+      break;
+
+    case PEEP_PAUSE_STATE:
+      maintainPeepPause();
+      break;
+
+    case HOLD_EXP_STATE: {
+      io_.showFlow(io_.expFlow.get() * -1); //update flow waveform on display
+      updateExpiredVolume();                //update expiratory flow counter
+
+      // Check if patient triggers inhale (detected by the sampler) or state timed out
+      bool patientTriggered = io_.triggered();
+      bool timeout = (millis()  > target_cycle_end_time_);
+
+      if (patientTriggered || timeout) {
+        beginInspiration();
+        setState(INSP_STATE);
+      }
+
+    } break;
+  } // End switch
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// PRESSURE SUPPORT STATE MACHINE
+//////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Pressure Support state machine
+ *
+ * Breaths are patient triggered. During inspiration the PressureController
+ * holds the support pressure (after the rise time) until inspiratory flow
+ * decays to the cycle-off percentage of its peak. If the patient doesn't
+ * trigger within the apnea time a backup breath is delivered and the apnea
+ * alarm raised.
+ */
+template <class IO>
+void Circuit<IO>::pressureSupport() {
+  switch (state_) {
+    case OFF_STATE:
+      if (!io_.settings.isTurnedOff()) {
+        setState(INSP_STATE);
+        beginInspiration();
+      }
+      break;
+
+    case INSP_STATE: {
+      io_.showFlow(io_.inspFlow.get());
+      io_.inspFlow.updateVolume();
+      io_.mechanics.addSample(io_.inspPressure.get(), io_.inspFlow.get(), io_.inspFlow.getVolume());
+
+      // a disconnected circuit delivers volume without building pressure
+      if (io_.leak.checkInspiration(io_.inspFlow.getVolume(), io_.inspPressure.peakSoFar())) {
+        io_.alarms.activateAlarm(ALARM_DISCONNECT);
+      }
+
+      // cycle off once the pressure has risen and flow has decayed from its peak
+      float peakFlow = io_.inspFlow.peak();
+      bool cycledOff = io_.pressureControl.risen() && peakFlow >= PS_MIN_PEAK_FLOW &&
+                       io_.inspFlow.get() <= peakFlow * io_.settings.cycleOff() / 100;
+      bool timeout = millis() - cycle_timer_ >= PS_MAX_INSP_DURATION;
+
+      if (cycledOff || timeout) {
+        io_.pressureControl.endBreath();
+        last_pressure_error_ = io_.pressureControl.trackingError();
+        io_.mechanics.finish();
+
+        setState(EXP_STATE);
+        beginExpiration();
+        insp_duration_ = millis() - cycle_timer_;
+      }
+    } break;
+
+    case EXP_STATE:
+      maintainExpiration();
+      break;
+
+    case PEEP_PAUSE_STATE:
+      maintainPeepPause();
+      break;
+
+    case HOLD_EXP_STATE: {
+      io_.showFlow(io_.expFlow.get() * -1);
+      updateExpiredVolume();
+
+      // patient trigger (detected by the sampler) or apnea backup breath
+      bool patientTriggered = io_.triggered();
+      bool apnea = millis() - cycle_timer_ >= io_.settings.apnea() * 1000UL;
+
+      if (patientTriggered || apnea) {
+        beginInspiration();
+        setState(INSP_STATE);
+        if (!patientTriggered) {
+          io_.alarms.activateAlarm(ALARM_APNEA);
+        }
+      }
+    } break;
+  } // End switch
+}
+
+template class Circuit<HardwareIO>;
+template class Circuit<SimulatedIO>;
@@ -0,0 +1,155 @@
+/**
+ * Circuit.h
+ * One patient breathing circuit: the breath state machine (volume control
+ * and pressure support) and the timers, targets and measurements of its
+ * breaths.
+ *
+ * Everything the state machine touches comes from its IO class, a template
+ * argument: the flow and pressure sensors, the inspiratory and expiratory
+ * valves, the pressure controller, patient trigger detection, leak detector,
+ * mechanics estimate, alarms, settings, and hooks for what is shared between
+ * circuits (the display, the O2 blender, telemetry). HardwareIO (see
+ * HardwareIO.h) is the circuit wired to this board; SimulatedIO (see
+ * LoadBenchmark.h) is a lung model, used to measure how many circuits one
+ * board can drive. Circuits are instantiated in Circuit.cpp.
+ *
+ * Several circuits run from one control tick by calling each one's
+ * `readSensors` and `tick` in turn; nothing in a Circuit is shared with
+ * another.
+ */
+
+#ifndef Circuit_h
+#define Circuit_h
+
+#include "Arduino.h"
+#include "Constants.h"
+#include "AlarmManager.h"
+
+// Values of a breath that just ended, handed to IO::reportBreath
+struct BreathReport {
+  unsigned long breath;       // breath count
+  unsigned long time;         // ms since power-up at the start of the breath
+  unsigned long duration;     // ms
+  float peak, plateau, peep;  // cmH2O
+  float volumeInsp, volumeExp;  // cc
+  float minuteVolume;         // L/min
+  float rate;                 // breaths/min
+  float compliance;           // mL/cmH2O
+  float resistance;           // cmH2O/(L/s)
+  long  triggerDelay;         // us from patient trigger detection to valve response (-1 if not triggered)
+  float pressureError;        // mean inspiratory pressure tracking error after the rise (cmH2O, PS only)
+  float leak;                 // SLPM
+  float leakFraction;         // of inspired volume
+};
+
+template <class IO>
+class Circuit {
+  public:
+    explicit Circuit(IO &io) : io_(io) { }
+
+    IO &io() { return io_; }
+
+    // start the breath cycle timer, once the circuit is ready to ventilate
+    void begin() { cycle_timer_ = millis(); }
+
+    // read this circuit's sensors, once per control tick
+    void readSensors();
+
+    // run the state machine of the current mode, once per control tick
+    void tick();
+
+    // act on a patient trigger straight away (call first thing in the tick)
+    void checkTrigger();
+
+    // alarm on readings out of range and maintain the alarms (from the sixth breath)
+    void checkReadings();
+
+    // track the flow zeros while the limbs carry no flow; `calibrating` while a valve calibration has SV3 open
+    void trackFlowZeros(bool calibrating);
+
+    // stop ventilating (standby); call every tick while the circuit is turned off
+    void turnOff();
+
+    /**
+     * After a watchdog reset: resume in OFF_STATE if `saved` is, otherwise
+     * in expiration of a breath begun `cycleElapsed` ms ago
+     */
+    void resume(States saved, unsigned long cycleElapsed);
+    void restoreCount(unsigned long count) { cycle_count_ = count; }
+    void restoreMode(VentMode mode) { vent_mode_ = mode; }
+
+    States state() const { return state_; }
+    VentMode ventMode() const { return vent_mode_; }
+    unsigned long cycleCount() const { return cycle_count_; }
+    unsigned long cycleElapsed() const { return millis() - cycle_timer_; }
+
+    // volume the next breath will draw at the current settings (cc); PS breaths aren't set, so the last one's
+    float nextBreathVolume() const;
+
+    // per-circuit configuration (settings come from IO::settings)
+    VentMode    requestedMode = VC_MODE;                  // mode to switch to at the start of the next breath
+    TriggerMode triggerMode = PRESSURE_TRIGGER;           // pressure (sensitivity setting) or flow triggering
+    float       flowTriggerThreshold = FLOW_TRIGGER_SENSITIVITY; // flow drawn from the bias flow that triggers a breath (SLPM)
+
+  private:
+    IO &io_;
+
+    States   state_ = OFF_STATE;
+    VentMode vent_mode_ = VC_MODE;
+    unsigned long cycle_count_ = 0;  // number of breaths (including current breath)
+
+    // Calculated targets (ms, cc and SLPM)
+    unsigned long target_cycle_end_time_;  // desired time at end of breath (at end of HOLD_EXP_STATE)
+    unsigned long target_insp_end_time_;   // desired time for end of INSP_STATE
+    unsigned long target_exp_duration_;    // desired length of EXP_STATE (VC mode only)
+    unsigned long target_exp_end_time_;    // desired time at end of EXP_STATE (VC mode only)
+    unsigned long target_insp_duration_;   // desired duration of inspiration
+    float target_exp_volume_ = 0;          // minimum target volume for expiration
+    float target_insp_volume_;             // volume to deliver this breath (set tidal volume plus any leak compensation, VC only)
+    float desired_insp_flow_;              // desired inspiratory flowrate
+
+    // Timers (ms)
+    unsigned long cycle_timer_ = 0;        // start time of start of current breathing cycle
+    unsigned long insp_hold_timer_;        // start time of inpsiratory hold state
+    unsigned long exp_timer_ = 0;          // start time of expiration cycle (including exp hold & peep pause)
+    unsigned long peep_pause_timer_;       // start time of peep pause
+    bool pressure_window_open_;            // plateau/PEEP averaging window has started in the current hold/pause
+
+    // bias flow through SV3 during expiration, for flow triggering
+    bool  biasing_ = false;
+    float bias_volume_ = 0;                // cc of bias flow since expiration began (taken off the expired volume)
+    unsigned long bias_timer_ = 0;         // time bias_volume_ was last updated
+
+    // Measured intervals (ms)
+    unsigned long cycle_duration_;         // measured length of a whole inspiration-expiration cycle
+    unsigned long insp_duration_;          // measured length of inspiration (not including inspiratory hold)
+    unsigned long exp_duration_;           // measured length of expiration (including peep pause and expiratory hold)
+
+    float tidal_volume_insp_ = 0.0;        // measured inspiratory tidal volume
+    float tidal_volume_exp_ = 0.0;         // measured expiratory tidal volume
+    float last_peak_ = 0.0/0.0;            // peak pressure from last breath
+    float last_pressure_error_ = 0.0/0.0;  // mean inspiratory pressure tracking error from last breath (PS only)
+    long  trigger_delay_ = -1;             // us from trigger detection to valve response, last breath (-1 = not triggered)
+    bool  resumed_ = false;                // the breath began before a watchdog reset: its volumes weren't measured
+
+    void setState(States newState);
+    void computeBreathTargets();
+    void beginOff();
+    void beginInspiration();
+    void beginHoldInspiration();
+    void beginExpiration();
+    void beginPeepPause();
+    void maintainExpiration();
+    void maintainPeepPause();
+    void updateExpiredVolume();
+    float expiredVolume() const { return io_.expFlow.getVolume() - bias_volume_; }
+    void volumeControl();
+    void pressureSupport();
+    void armPatientTrigger();
+    void checkLeak();
+    void reportLastBreath(float minuteVolume);
+    void checkAlarmRangeWithUpdate(float reading, float &compareValue, float sensitivity, alarmCode highAlarmCode, alarmCode lowAlarmCode);
+    void checkAlarmRange(float reading, float compareValue, float sensitivity, alarmCode highAlarmCode, alarmCode lowAlarmCode);
+};
+
+#endif
@@ -26,12 +26,21 @@ enum VentMode {
   PS_MODE  // 1
 };
 
+// How a patient's inspiratory effort is detected
+enum TriggerMode {
+  PRESSURE_TRIGGER, // 0 - airway pressure drops below PEEP by the sensitivity
+  FLOW_TRIGGER      // 1 - the patient draws the threshold from the bias flow (expiratory-limb flow falls below it)
+};
+
 // Timing interval settings (all values in milliseconds)
 const unsigned long LOOP_PERIOD = 30;          // The period of the control loop
 const unsigned long HOLD_INSP_DURATION = 500;  // Interval to pause after inhalation
 const unsigned long MIN_PEEP_PAUSE = 50;       // Interval to pause after exhalation / before watching for an assisted inhalation
 const unsigned long MAX_EXP_DURATION = 1000;   // Maximum exhale duration (ms)
 const unsigned long SILENCE_DURATION = 120000; // silence duration (ms) - 2 min
+const unsigned long PLATEAU_WINDOW = 100;      // Plateau is averaged over the end of HOLD_INSP_STATE (ms)
+const unsigned long PEEP_WINDOW = 30;          // PEEP is averaged over the end of PEEP_PAUSE_STATE (ms)
+const unsigned long DISPLAY_ACK_TIMEOUT = 20;  // Longest wait for the screen to answer a write (ms)
 
 // Graph settings
 const int GRAPH_MIN = 0;
@@ -80,6 +89,17 @@ const int IE_INSP = 1;           // inspiratory portion in IE ratio
 const float IE_EXP = 2;          // expiratory portion in IE ratio
 const float TIDAL_VOLUME = 400;  // volume in mL (cc's)
 
+// Pressure support defaults
+const int   PS_PEAK_PRESSURE = 10;   // inspiratory pressure above PEEP (cmH2O)
+const float PS_RISE_TIME     = 0.2;  // time to reach the inspiratory pressure (s)
+const float PS_CYCLE_OFF     = 25;   // inspiration ends when flow decays to this % of its peak
+const int   PS_APNEA_TIME    = 20;   // backup breath if the patient doesn't trigger for this long (s)
+
+// Patient trigger settings
+const float FLOW_TRIGGER_SENSITIVITY = 2.0; // flow drawn from the bias flow (SLPM) that counts as a patient trigger
+const float FLOW_TRIGGER_BIAS = 5.0;        // flow through SV3 during expiration while flow triggering (SLPM)
+const int TRIGGER_DEBOUNCE_SAMPLES = 4;      // consecutive samples (~0.5 ms apart) beyond the trigger threshold
+
 // Safety settings
 const float MAX_PRESSURE = 40.0;         // Trigger high pressure alarm 
 const float SENSITIVITY = 0.5;           // acceptable margin of error in pressure (in cmH2O)
@@ -101,7 +121,208 @@ const double OUTPUT_MIN = 40;
 const int SAMPLE_TIME = 50;
 
 // initial value for valve to open according to previous tests (close to desired)
-const int DEFAULT_VALVE_POSITION;
+const int DEFAULT_VALVE_POSITION = 80;
+
+// Pressure support: PI loop on inspiratory pressure, run by the Sampler on every new sample
+const float PS_KP = 8.0;   // SV3 command per cmH2O of pressure error
+const float PS_KI = 10.0;  // SV3 command per cmH2O of error per second
+const float PS_MIN_PEAK_FLOW = 5.0;              // peak flow (SLPM) needed before flow cycle-off is considered
+const unsigned long PS_MAX_INSP_DURATION = 3000; // inspiration ends here if flow never decays (ms)
+
+// ---------------------
+// Valve Feed-Forward
+// ---------------------
+
+// Feed-forward table axes: desired inspiratory flow (SLPM) by reservoir pressure (cmH2O)
+const int   FF_FLOW_POINTS     = 7;
+const float FF_FLOW_MIN        = 0;
+const float FF_FLOW_MAX        = 90;
+const int   FF_PRESSURE_POINTS = 4;
+const float FF_PRESSURE_MIN    = 703.07;  // 10 psi (reservoir refill threshold)
+const float FF_PRESSURE_MAX    = 1756.67; // 25 psi (reservoir full threshold)
+
+// Online refinement from steady-state PID output
+const int      FF_LEARN_SHIFT         = 2;   // each breath moves the table 1/4 of the way to the PID output
+const float    FF_SETTLED_ERROR       = 0.1; // flow error (fraction of setpoint) treated as steady state
+const int      FF_MIN_SETTLED_SAMPLES = 4;   // PID samples needed before a breath is learned from
+const unsigned FF_SAVE_INTERVAL       = 500; // breaths between EEPROM saves of the learned table
+
+// Characterisation sweep (run from OFF_STATE with the circuit open to a test lung)
+const int FF_CHARACTERISE_STEP    = 5;     // valve command increment between steps
+const int FF_CHARACTERISE_SWEEPS  = 3;     // number of sweeps from OUTPUT_MIN to OUTPUT_MAX
+const unsigned long FF_CHARACTERISE_SETTLE  = 300; // ms to wait after each step before averaging
+const unsigned long FF_CHARACTERISE_AVERAGE = 200; // ms of flow averaged at each step
+
+// ---------------------
+// Iterative Learning Control
+// ---------------------
+
+// Inspiratory flow error is recorded on a fixed time grid from the start of each breath
+const int           ILC_BINS             = 40;       // number of grid points (covers ILC_BINS * ILC_BIN_DURATION ms)
+const unsigned long ILC_BIN_DURATION     = 50;       // ms per grid point (one PID sample)
+const float         ILC_ERROR_RESOLUTION = 0.25;     // SLPM per stored error count (int8 buffer)
+const float         ILC_LEARNING_GAIN    = 0.5;      // valve command added per SLPM of error, each breath
+const float         ILC_FORGETTING       = 1.0 / 32; // fraction of the correction dropped each breath
+const int           ILC_LEAD_BINS        = 1;        // error is taken this many bins ahead to cover valve/flow lag
+const float         ILC_MAX_CORRECTION   = 40;       // largest correction applied (valve command)
+const float         ILC_RESET_FRACTION   = 0.1;      // setpoint change that invalidates the learned profile
+
+// ---------------------
+// PID Auto-Tune
+// ---------------------
+
+// Relay-feedback experiment (run from OFF_STATE with the circuit open to a test lung)
+const float AUTOTUNE_FLOW        = 30;    // flow setpoint the relay oscillates around (SLPM)
+const float AUTOTUNE_RELAY       = 15;    // relay amplitude either side of the feed-forward opening (valve command)
+const float AUTOTUNE_HYSTERESIS  = 1;     // flow band around the setpoint before the relay switches (SLPM)
+const int   AUTOTUNE_CYCLES      = 6;     // oscillation cycles measured (after AUTOTUNE_SKIP_CYCLES)
+const int   AUTOTUNE_SKIP_CYCLES = 2;     // initial cycles ignored while the oscillation establishes
+const unsigned long AUTOTUNE_TIMEOUT = 20000; // ms before the experiment is abandoned
+
+// Validation of identified gains during ventilation
+const int   AUTOTUNE_VALIDATE_BREATHS = 5;   // breaths run on the current gains, then on the new ones, before they are kept
+const float AUTOTUNE_MAX_DEGRADATION  = 1.1; // new gains rejected if tracking error grows beyond this ratio
+
+// ---------------------
+// PID Gain Schedule
+// ---------------------
+
+const int GAIN_SCHEDULE_POINTS = 5; // most flow setpoints a gain schedule can hold
+
+// ---------------------
+// O2 Blending
+// ---------------------
+
+const unsigned long O2_SAMPLE_PERIOD = 1000;  // ms between O2 sensor samples
+const unsigned long O2_REFERENCE_SETTLE = 10; // ms for AREF to settle after switching reference
+const int O2_BATCH_SIZE              = 8;     // conversions averaged per O2 sample
+const int O2_FILTER_SHIFT            = 2;     // each sample moves the filtered FiO2 by 1/2^shift
+const unsigned long FILL_WINDOW      = 2000;  // ms period over which SV1/SV2 are time-proportioned
+const float FIO2_TRIM_GAIN           = 0.002; // O2 fraction trim per %FiO2 error per second
+const float FIO2_TRIM_LIMIT          = 0.2;   // largest closed-loop trim of the O2 fraction
+const float RESERVOIR_DROP_PER_CC    = 0.5;   // initial estimate of reservoir drop per cc delivered (cmH2O)
+
+// ---------------------
+// Leak and Disconnect
+// ---------------------
+
+const float DISCONNECT_PRESSURE_RISE   = 2.0;  // inspiratory pressure rise (cmH2O) a connected circuit always exceeds
+const float DISCONNECT_MIN_VOLUME      = 100;  // cc delivered before the pressure rise is judged
+const float DISCONNECT_RETURN_FRACTION = 0.1;  // expired volume below this fraction of inspired means disconnected
+const float LEAK_FILTER_WEIGHT         = 0.25; // each breath moves the leak estimate this far towards its own leak
+const float LEAK_ALARM_FRACTION        = 0.3;  // leak above this fraction of inspired volume raises ALARM_LEAK
+const float LEAK_MAX_COMPENSATION      = 0.5;  // most extra volume (fraction of set VT) delivered to cover leak
+
+// ---------------------
+// Startup
+// ---------------------
+
+const unsigned long STARTUP_WARMUP = 35;       // ms SV3 is held open to unstick it
+const float SELFTEST_REST_PRESSURE = 3.0;      // insp/exp pressure at rest must be within this of 0 (cmH2O)
+const float SELFTEST_PULSE_FLOW    = 5.0;      // flow the warm-up pulse must produce (SLPM)
+const float SELFTEST_MIN_RESERVOIR = 703.07;   // below this (10 psi) the pulse can't be expected to flow (cmH2O)
+
+// ---------------------
+// Watchdog
+// ---------------------
+
+// The hardware watchdog period is set in Supervisor.cpp (WDTO_250MS)
+const unsigned long WATCHDOG_PERIOD       = 250;      // ms from the last feed to a watchdog reset
+const unsigned long HEARTBEAT_DEADLINE    = 200;      // ms a supervised task may go without progress
+const uint8_t       WATCHDOG_MAX_RESETS   = 3;        // this many watchdog resets within
+const unsigned long WATCHDOG_RESET_WINDOW = 600000UL; // this many ms of running leave the ventilator in standby
+
+// ---------------------
+// Flow Zero Tracking
+// ---------------------
+
+// The flow sensor zero is re-estimated whenever its limb is known to carry no flow
+const unsigned long ZERO_SETTLE      = 100;  // ms after the valve closes before no-flow samples are averaged
+const uint16_t      ZERO_MIN_SAMPLES = 100;  // shortest no-flow window used (~50 ms)
+const float         ZERO_TRACK_WEIGHT = 0.25; // each window moves the zero this far towards its own estimate
+const float         ZERO_MAX_STEP    = 2.0;  // SLPM; windows further from the zero are outliers unless two agree
+const unsigned long ZERO_STARTUP_WINDOW = 50; // ms averaged by the startup calibration (both sensors at once)
+
+// ---------------------
+// Sensor Health
+// ---------------------
+
+// Raw-stream checks, per sampled channel
+const uint16_t HEALTH_WINDOW          = 256;   // samples per statistics window (~130 ms per channel)
+const uint16_t HEALTH_RAIL_LOW        = 20;    // raw readings outside 0.1-4.9 V are outside every sensor's output band
+const uint16_t HEALTH_RAIL_HIGH       = 1003;
+const uint8_t  HEALTH_RAIL_SAMPLES    = 16;    // consecutive out-of-band samples (~8 ms) that mark a channel saturated
+const uint16_t HEALTH_MAX_STEP        = 100;   // sample-to-sample change no real signal makes in ~0.5 ms
+const uint8_t  HEALTH_MAX_JUMPS       = 8;     // jumps in one window that mark a channel implausible
+const int      HEALTH_STUCK_WINDOWS   = 8;     // windows after a breath phase change without a single count of change (~1 s) that mark a channel stuck
+const int      HEALTH_RECOVER_WINDOWS = 8;     // clean windows before a failed channel is trusted again
+const float    HEALTH_NOISE_WEIGHT    = 0.125; // each window moves the noise floor estimate this far
+
+// O2 cell readings outside this range (%) are implausible
+const float O2_MIN_PLAUSIBLE = 15;
+const float O2_MAX_PLAUSIBLE = 105;
+
+// ---------------------
+// Waveform History
+// ---------------------
+
+// Flow and pressure graph values kept for freeze and replay (see WaveHistory.h)
+const unsigned long WAVE_HISTORY_PERIOD  = 30;   // ms between stored pairs (about one per control loop)
+const uint16_t      WAVE_HISTORY_BYTES   = 1024; // delta-coded ring; a power of two (~8 breaths at 20 bpm)
+const uint8_t       WAVE_HISTORY_BREATHS = 12;   // breath index entries
+const uint8_t       WAVE_REPLAY_BURST    = 2;    // most replayed pairs drawn in one loop
+
+// ---------------------
+// Trends
+// ---------------------
+
+// Per-breath values kept at three resolutions (see Trends.h)
+const uint8_t       TREND_BREATHS         = 32;     // breaths kept individually
+const uint8_t       TREND_MINUTES         = 30;     // one-minute entries (30 minutes)
+const uint8_t       TREND_QUARTERS        = 96;     // 15-minute entries (24 hours, in EEPROM)
+const uint8_t       TREND_QUARTER_MINUTES = 15;
+const unsigned long TREND_MINUTE          = 60000;  // ms
+
+// ---------------------
+// Recorder
+// ---------------------
+
+// Waveform and breath recordings on SD (see Recorder.h)
+const uint8_t  SD_CHIP_SELECT       = 53;     // the Mega's hardware SS
+const uint16_t RECORD_SECTOR        = 512;    // bytes per buffer and per card write
+const uint32_t RECORD_FILE_SECTORS  = 65536;  // sectors per file, allocated up front (32 MB, about a day of recording)
+const uint16_t RECORD_MAX_FILES     = 64;     // the oldest file is removed beyond this (2 GB)
+const uint8_t  RECORD_SCAN_ENTRIES  = 16;     // directory entries (one block) looked at per step of the card set-up
+
+// ---------------------
+// Load Benchmark
+// ---------------------
+
+// Simulated circuits run alongside the real one to measure the controller's capacity (see LoadBenchmark.h)
+const uint8_t LOAD_MAX_CIRCUITS   = 64;
+const float   LOAD_SIM_COMPLIANCE = 50;   // test lung compliance (mL/cmH2O)
+const float   LOAD_SIM_RESISTANCE = 10;   // airway resistance (cmH2O/(L/s))
+const float   LOAD_SIM_PEEP       = 5;    // pressure with the lung at rest (cmH2O)
+const float   LOAD_SIM_VALVE_FLOW = 0.3;  // simulated SV3 flow per unit of valve command (SLPM)
+
+// ---------------------
+// Memory
+// ---------------------
+
+// Free SRAM between the heap and the stack is painted with this at boot (see MemoryMonitor.h)
+const uint8_t  STACK_CANARY          = 0xC5;
+const uint16_t MEMORY_SCAN_BYTES     = 64;   // painted bytes checked per loop (a full pass takes a few seconds)
+const uint16_t MEMORY_ALARM_HEADROOM = 512;  // bytes never touched by the heap or stack below which memory is alarmed
+
+// ---------------------
+// EEPROM layout
+// ---------------------
+
+// Start address of each persistent block (see Storage.h for the block format)
+const int EEPROM_FEED_FORWARD  = 0;
+const int EEPROM_PID_GAINS     = 64;
+const int EEPROM_GAIN_SCHEDULE = 80;
+const int EEPROM_TRENDS        = 256; // not a checked block: TREND_QUARTERS entries, each with its own CRC
 
 // --------------------------
 // Generally-useful Constants
@@ -1,14 +1,40 @@
 #include "Display.h"
 #include "Constants.h"
 #include "AlarmManager.h"
+#include "WaveHistory.h"
+#include "Startup.h"
+#include "Supervisor.h"
 
-char buffer[20];
-char buffer2[20];
+// text field names on the main page (page 6), kept in flash
+static const char bannerName[]  PROGMEM = "t1";
+static const char VTTextName[]  PROGMEM = "t40";
+static const char RRTextName[]  PROGMEM = "t42";
+static const char O2TextName[]  PROGMEM = "t44";
+static const char IETextName[]  PROGMEM = "t3";
+static const char SenTextName[] PROGMEM = "t46";
+static const char pipName[]     PROGMEM = "t12";
+static const char platName[]    PROGMEM = "t13";
+static const char peepName[]    PROGMEM = "t14";
+static const char VTiName[]     PROGMEM = "t16";
+static const char VTeName[]     PROGMEM = "t18";
+static const char mvName[]      PROGMEM = "t19";
+static const char rrName[]      PROGMEM = "t28";
+static const char o2Name[]      PROGMEM = "t17";
+static const char cstName[]     PROGMEM = "t20";
+static const char resName[]     PROGMEM = "t21";
+
+// decimals and width of each patient data field, in Display::Field order
+static const uint8_t fieldDecimals[] PROGMEM = { 1, 1, 1, 1, 1, 1, 1, 0, 1, 1 };
+static const uint8_t fieldWidths[]   PROGMEM = { 4, 4, 3, 5, 5, 4, 4, 4, 4, 4 };
 
 /*
  * Initialize setting values
  */
-Display::Display() {
+Display::Display() :
+  banner(bannerName),
+  VTText(VTTextName), RRText(RRTextName), O2Text(O2TextName), IEText(IETextName), SenText(SenTextName),
+  pip(pipName), plat(platName), peep(peepName), VTi(VTiName), VTe(VTeName),
+  mv(mvName), rr(rrName), o2(o2Name), cst(cstName), res(resName) {
   settings.o2 = O2;
   settings.sensitivity = SENSITIVITY;
   settings.bpm = BPM;
@@ -16,6 +42,10 @@ Display::Display() {
   settings.ie[1] = IE_EXP; 
   settings.volume = TIDAL_VOLUME;
   settings.inspHold = false;
+  settings.peak = PS_PEAK_PRESSURE;
+  settings.riseTime = PS_RISE_TIME;
+  settings.cycleOff = PS_CYCLE_OFF;
+  settings.apnea = PS_APNEA_TIME;
 
   turnOff = false;
   locked = false;
@@ -26,7 +56,22 @@ Display::Display() {
  */ 
 void Display::init() {
   nexInit(115200); // set baud rate to 115200
+  attachCallbacks();
+}
 
+/**
+ * The screen keeps its page and baud rate through a reset of this board, so
+ * only the serial port and callbacks need setting up again
+ */
+void Display::resume() {
+  nexSerial.begin(115200);
+  attachCallbacks();
+}
+
+/**
+ * Register buttons
+ */
+void Display::attachCallbacks() {
   hold.attachPop(holdPopCallback, &hold);
   lock.attachPop(lockPopCallback, &lock);
   bell.attachPush(bellPushCallback, &bell);
@@ -36,6 +81,33 @@ void Display::init() {
   nex_listen_list[2] = NULL; 
 }
 
+/**
+ * Show the startup banner
+ */
+void Display::start() {
+  sendCommand(F("vis 1,1"));
+  banner.setBackground(65504);
+  banner.setText(F("Starting up"));
+}
+
+/**
+ * Show the current startup stage and overall progress
+ */
+void Display::showStartup(const __FlashStringHelper *stage, int percent) {
+  char text[48];
+  snprintf_P(text, sizeof(text), PSTR("Starting up: %S (%d%%)"), stage, percent);
+  banner.setText(text);
+}
+
+void Display::finishStartup(bool passed) {
+  if (passed) {
+    sendCommand(F("vis 1,0"));
+  } else {
+    banner.setBackground(63488);
+    banner.setText(F("Startup self-test failed"));
+  }
+}
+
 /**
  * Listen to callback events
  */  
@@ -43,6 +115,16 @@ void Display::listen() {
   nexLoop(nex_listen_list);
 }
 
+/**
+ * Pressure support settings (there is no PS page on the screen yet)
+ */
+void Display::setPressureSupport(int peak, float riseTime, float cycleOff, int apnea) {
+  settings.peak = peak;
+  settings.riseTime = riseTime;
+  settings.cycleOff = cycleOff;
+  settings.apnea = apnea;
+}
+
 /**
  * Reset inspiratory hold once the system registers it
  */  
@@ -53,18 +135,50 @@ void Display::resetInspHold() {
 /**
  * Show alarm banner with color based on priority
  */ 
-void Display::showAlarm(const char *buffer, int priority) {
-  sendCommand("vis 1,1");
-
-  priority == 0 ? banner.Set_background_color_bco(63488) : banner.Set_background_color_bco(65504);
-  banner.setText(buffer);
+void Display::showAlarm(const __FlashStringHelper *text, int priority) {
+  bannerShown = true;
+  bannerColor = priority == 0 ? 63488 : 65504;
+  bannerText = text;
+  pending |= _BV(BANNER_FIELD) | _BV(BANNER_TEXT_FIELD);
 }
 
 /**
  * Hide alarm banner when values return to normal
  */ 
 void Display::stopAlarm() {
-  sendCommand("vis 1,0");
+  bannerShown = false;
+  pending |= _BV(BANNER_FIELD);
+}
+
+/**
+ * Write the next queued field, taking them in turn after the one written
+ * last so a value queued every loop (VTi) can't hold up the rest. Only the
+ * latest value of a field is kept, and one write waits at most
+ * DISPLAY_ACK_TIMEOUT, so a screen that is slow or unplugged costs a loop
+ * that much and no more. A banner write the screen didn't answer is tried
+ * again; a patient value is rewritten with the next breath anyway.
+ */
+void Display::service() {
+  if (pending != 0) {
+    do {
+      lastField = (lastField + 1) % N_FIELDS;
+    } while (!(pending & _BV(lastField)));
+    pending &= ~_BV(lastField);
+
+    Field field = (Field)lastField;
+    bool written;
+    if (field == BANNER_FIELD) {
+      sendCommand(bannerShown ? F("vis 1,1") : F("vis 1,0"));
+      written = !bannerShown || banner.setBackground(bannerColor);
+    } else if (field == BANNER_TEXT_FIELD) {
+      written = bannerText == NULL || banner.setText(bannerText);
+    } else {
+      written = true;
+      valueField(field).setFixed(values[field], pgm_read_byte(&fieldDecimals[field]), pgm_read_byte(&fieldWidths[field]));
+    }
+    if (!written) pending |= _BV(field);
+  }
+  supervisor.beat(DISPLAY_TASK); // the write finished, answered or not
 }
 
 // -----------------
@@ -72,59 +186,103 @@ void Display::stopAlarm() {
 // -----------------
 void Display::updateFlowWave(float flow) {
   uint8_t val = map(flow, FLOW_RANGE_MIN, FLOW_RANGE_MAX, GRAPH_MIN, GRAPH_MAX);
-  flowWave.addValue(0, flowSmoother.smooth(val));
+  lastFlowGraph = flowSmoother.smooth(val);
+  if (!waveHistory.frozen()) {
+    flowWave.addValue(0, lastFlowGraph);
+  }
 }
 
 void Display::updatePressureWave(float pressure) {
   uint8_t val = map(pressure, PRESSURE_RANGE_MIN, PRESSURE_RANGE_MAX, GRAPH_MIN, GRAPH_MAX);
-  pressureWave.addValue(0, pressureSmoother.smooth(val));
+  lastPressureGraph = pressureSmoother.smooth(val);
+  if (!waveHistory.frozen()) {
+    pressureWave.addValue(0, lastPressureGraph);
+  }
+}
+
+void Display::drawWaves(uint8_t flow, uint8_t pressure) {
+  flowWave.addValue(0, flow);
+  pressureWave.addValue(0, pressure);
+}
+
+void Display::clearWaves() {
+  char cmd[12];
+  snprintf_P(cmd, sizeof(cmd), PSTR("cle %u,255"), flowWaveId);
+  sendCommand(cmd);
+  snprintf_P(cmd, sizeof(cmd), PSTR("cle %u,255"), pressureWaveId);
+  sendCommand(cmd);
 }
 
 // -----------------
 // patient data
 // -----------------
+/**
+ * Values are shown to one decimal (O2 to none); unmeasured (NaN) ones as "--"
+ */
+void Display::queueValue(Field field, float value) {
+  values[field] = toFixed(value, pgm_read_byte(&fieldDecimals[field]));
+  pending |= _BV(field);
+}
+
+FlashText &Display::valueField(Field field) {
+  switch (field) {
+    case PIP_FIELD:  return pip;
+    case PLAT_FIELD: return plat;
+    case PEEP_FIELD: return peep;
+    case VTI_FIELD:  return VTi;
+    case VTE_FIELD:  return VTe;
+    case MV_FIELD:   return mv;
+    case RR_FIELD:   return rr;
+    case O2_FIELD:   return o2;
+    case CST_FIELD:  return cst;
+    default:         return res;
+  }
+}
+
 void Display::writePeak(float peak) {
-  dtostrf(peak, 4, 1, buffer);
-  pip.setText(buffer);
+  queueValue(PIP_FIELD, peak);
 }
 
 void Display::writePlateau(float pressure) {
-  dtostrf(pressure, 4, 1, buffer);
-  plat.setText(buffer);
+  queueValue(PLAT_FIELD, pressure);
 } 
 
 void Display::writePeep(float pressure) {
-  dtostrf(pressure, 3, 1, buffer);
-  peep.setText(buffer);
+  queueValue(PEEP_FIELD, pressure);
 }
 
 void Display::writeVolumeInsp(float volumeInsp) {
-  dtostrf(volumeInsp, 5, 1, buffer);
-  VTi.setText(buffer);
+  queueValue(VTI_FIELD, volumeInsp);
 }
 
 void Display::writeVolumeExp(float volumeExp) {
-  dtostrf(volumeExp, 5, 1, buffer);
-  VTe.setText(buffer);
+  queueValue(VTE_FIELD, volumeExp);
 }
 
 void Display::writeMinuteVolume(float minuteVolume) {
-  dtostrf(minuteVolume, 4, 1, buffer);
-  mv.setText(buffer);
+  queueValue(MV_FIELD, minuteVolume);
 }
 
 void Display::writeBPM(float bpm) {
-  dtostrf(bpm, 4, 1, buffer);
-  rr.setText(buffer);
+  queueValue(RR_FIELD, bpm);
 }
  
-void Display::writeO2(int oxygen) {
-  dtostrf(oxygen, 4, 1, buffer);
-  o2.setText(buffer);
+void Display::writeO2(float oxygen) {
+  queueValue(O2_FIELD, oxygen);
+}
+
+void Display::writeCompliance(float compliance) {
+  queueValue(CST_FIELD, compliance);
+}
+
+void Display::writeResistance(float resistance) {
+  queueValue(RES_FIELD, resistance);
 }
 
 // Update setting values based on user input
 void Display::updateValues() {
+  char buffer[20];
+
   VTText.getText(buffer, sizeof(buffer));
   settings.volume = atoi(buffer);
 
@@ -135,7 +293,7 @@ void Display::updateValues() {
   settings.o2 = atoi(buffer);
 
   IEText.getText(buffer, sizeof(buffer));
-  sscanf(buffer, "%d:%d", &settings.ie[0], settings.ie[1]);
+  sscanf_P(buffer, PSTR("%d:%d"), &settings.ie[0], &settings.ie[1]);
 
   SenText.getText(buffer, sizeof(buffer));
   settings.sensitivity = atof(buffer);
@@ -159,6 +317,8 @@ void lockPopCallback(void *ptr) {
 
 void bellPushCallback(void *ptr) {
   alarmMgr.silence(SILENCE_DURATION);
+  startup.acknowledge(); // a failed self-test or a watchdog reset is acknowledged with the alarm
+  supervisor.acknowledge();
 }
 
 // Display
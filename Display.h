@@ -9,34 +9,65 @@
 
 #include "Arduino.h"
 #include "Nextion.h"
+#include "NexFlash.h"
 #include "Constants.h"
 #include "MeanSmooth.h"
 
 
 class Display {
 	public:
+		struct userSettings {
+			int   o2;          // O2 concentration
+			float sensitivity; // pressure sensitivity
+			int   bpm;         // Respiratory rate 
+			int   ie[2]; 			 // I:E ratio 
+			int   volume;      // Tidal volume (VC only)
+			bool  inspHold;    // inspiratory hold is on (VC only)
+			int   peak;        // peak pressure above peep (PS only)
+			int   apnea;       // apnea backup time (PS only)
+			float cycleOff;    // % peak flow at which we switch to expiration (PS only)
+			float riseTime;    // time to peak pressure in seconds (PS only)
+		};
+
 		Display();
 		// initialize screen
 		void init();
 
-		// @FutureWork: startup sequence 
+		// reattach to a screen that is already initialised (after a watchdog reset), without the handshake
+		void resume();
+
+		// startup sequence: progress is shown on the alarm banner until `finishStartup`,
+		// which leaves a warning up if the self-test failed
 		void start();
+		void showStartup(const __FlashStringHelper *stage, int percent);
+		void finishStartup(bool passed);
 
 		// nexLoop to listen for button events and update values
 		void listen();
 
+		// write one queued patient value or banner change to the screen; call once per loop
+		void service();
+
 		// update setting values based on user input
 		void updateValues();
 
-		// show alarm
-		void showAlarm(const char *buffer, int priority);
+		// show alarm (text in flash, see alarmName); queued for `service`
+		void showAlarm(const __FlashStringHelper *text, int priority);
 		void stopAlarm();
 
-		// update graphs
+		// update graphs (not drawn while the waveform history is frozen)
 		void updateFlowWave(float currentFlow);
 		void updatePressureWave(float currentPressure);
 
-		// funcitons to write live values to screen
+		// the latest graph values (0-255), drawn or not
+		uint8_t flowGraph() const { return lastFlowGraph; }
+		uint8_t pressureGraph() const { return lastPressureGraph; }
+
+		// draw graph values directly, e.g. replayed from the waveform history
+		void drawWaves(uint8_t flow, uint8_t pressure);
+		void clearWaves();
+
+		// funcitons to write live values to screen (queued for `service`, unmeasured values as NaN)
 		void writePeak(float peak);
 		void writePlateau(float plat);
 		void writePeep(float peep);
@@ -44,7 +75,9 @@ class Display {
 		void writeVolumeExp(float Vexp);
 		void writeMinuteVolume(float mv);
 		void writeBPM(float bpm);
-		void writeO2(int o2);
+		void writeO2(float o2);
+		void writeCompliance(float compliance);
+		void writeResistance(float resistance);
 
 		// reset inspiratory hold on screen after end of cycle
 		void setInspHold() { settings.inspHold = true; }
@@ -52,6 +85,7 @@ class Display {
 
 		// returns true if user clicked on standby and confirmed 
 		bool isTurnedOff() { return turnOff; }
+		void setTurnedOff(bool off) { turnOff = off; }
 
 		// getters for user settings
 		int oxygen() const { return settings.o2; }
@@ -63,24 +97,25 @@ class Display {
 		int bpm() const { return settings.bpm; } 
 		unsigned inspPercent() const { return settings.ie[0]*100 / (settings.ie[0] + settings.ie[1]); } 
 
+		// Pressure Support only
+		int peakPressure() const { return settings.peak; }
+		float riseTime() const { return settings.riseTime; }
+		float cycleOff() const { return settings.cycleOff; }
+		int apnea() const { return settings.apnea; }
+		void setPressureSupport(int peak, float riseTime, float cycleOff, int apnea);
+
+		// all settings at once, for the watchdog snapshot
+		const userSettings &currentSettings() const { return settings; }
+		void restoreSettings(const userSettings &saved) { settings = saved; }
+
 		// indicates settings are locked
 		bool locked;
 
 	private:
 		bool turnOff;
+		void attachCallbacks();
 		
-		struct userSettings {
-			int   o2;          // O2 concentration
-			float sensitivity; // pressure sensitivity
-			int   bpm;         // Respiratory rate 
-			int   ie[2]; 			 // I:E ratio 
-			int   volume;      // Tidal volume (VC only)
-			bool  inspHold;    // inspiratory hold is on (VC only)
-			int   peak;        // peak pressure above peep (PS only)
-			int   apnea;       // apnea backup time (PS only)
-			float cycleOff;    // % peak flow at which we switch to expiration (PS only)
-			float riseTime;    // time to peak pressure (PS only)
-		} settings;
+		userSettings settings;
 
 		// hold button
 		NexButton hold = NexButton( 6, 4, "b2" );
@@ -88,30 +123,34 @@ class Display {
 		// switch
 		NexButton lock = NexButton( 6, 63, "sw0");
 
-		// waveform
-		NexWaveform flowWave = NexWaveform( 6, 12, "s0" );
-		NexWaveform pressureWave = NexWaveform( 6, 37, "s1" );
+		// waveform (the ids are also used to clear them, see clearWaves)
+		static const uint8_t flowWaveId = 12;
+		static const uint8_t pressureWaveId = 37;
+		NexWaveform flowWave = NexWaveform( 6, flowWaveId, "s0" );
+		NexWaveform pressureWave = NexWaveform( 6, pressureWaveId, "s1" );
 
 		// Alarm stuff
-		NexText banner = NexText( 6, 1, "t1");
+		FlashText banner;
 		NexButton bell = NexButton( 6, 67, "b6");
 
-		// settings
-		NexText VTText  = NexText( 6, 68, "t40" );
-		NexText RRText  = NexText( 6, 69, "t42" );
-		NexText O2Text  = NexText( 6, 70, "t44" );
-		NexText IEText  = NexText( 6, 71, "t3" );
-		NexText SenText = NexText( 6, 72, "t46" );
+		// settings (text fields are named in Display.cpp)
+		FlashText VTText, RRText, O2Text, IEText, SenText;
 
 		// patient data
-		NexText pip  = NexText( 6, 39, "t12" );
-		NexText plat = NexText( 6, 40, "t13" );
-		NexText peep = NexText( 6, 41, "t14" );
-		NexText VTi  = NexText( 6, 42, "t16" );
-		NexText VTe  = NexText( 6, 44, "t18" );
-		NexText mv   = NexText( 6, 45, "t19" );
-		NexText rr   = NexText( 6, 46, "t28" );
-		NexText o2   = NexText( 6, 43, "t17" );
+		FlashText pip, plat, peep, VTi, VTe, mv, rr, o2, cst, res;
+
+		// writes waiting for `service`: the patient data fields, then the banner's visibility and colour, and its text
+		enum Field { PIP_FIELD, PLAT_FIELD, PEEP_FIELD, VTI_FIELD, VTE_FIELD, MV_FIELD, RR_FIELD, O2_FIELD,
+		             CST_FIELD, RES_FIELD, BANNER_FIELD, BANNER_TEXT_FIELD, N_FIELDS };
+		int32_t values[BANNER_FIELD];        // fixed point, see FixedPoint.h
+		uint16_t pending = 0;                // one bit per Field
+		uint8_t lastField = N_FIELDS - 1;    // the field `service` wrote last
+		bool bannerShown = false;
+		uint16_t bannerColor = 0;
+		const __FlashStringHelper *bannerText = NULL;
+
+		void queueValue(Field field, float value);
+		FlashText &valueField(Field field);
 
 		// listen events
 		NexTouch *nex_listen_list[3];
@@ -119,6 +158,8 @@ class Display {
 		// graph smoothing
 		MeanSmooth flowSmoother;
     MeanSmooth pressureSmoother;
+		uint8_t lastFlowGraph = 0;
+		uint8_t lastPressureGraph = 0;
 };
 
 // callbacks for buttons
@@ -0,0 +1,88 @@
+/**
+ * FastPin.h
+ * Compile-time pin access for the ATmega2560.
+ *
+ * digitalWrite() and analogRead() look the pin's port, bit and ADC channel up
+ * in flash tables on every call (and digitalWrite also checks for a PWM timer),
+ * a few microseconds each. With the pin as a template argument all of that is
+ * resolved by the compiler: a digital write is a single sbi/cbi instruction
+ * (atomic with respect to interrupts) and an ADC channel select is two
+ * register stores. Digital pins without a specialisation below fall back to
+ * the Arduino functions.
+ */
+
+#ifndef Fast_Pin_h
+#define Fast_Pin_h
+
+#include "Arduino.h"
+
+template <uint8_t Pin>
+struct FastPin {
+  static void output() { pinMode(Pin, OUTPUT); }
+  static void high() { digitalWrite(Pin, HIGH); }
+  static void low() { digitalWrite(Pin, LOW); }
+};
+
+#define FAST_PIN(pin, port, bit)                     \
+  template <> struct FastPin<pin> {                  \
+    static void output() { DDR##port |= _BV(bit); }  \
+    static void high() { PORT##port |= _BV(bit); }   \
+    static void low() { PORT##port &= ~_BV(bit); }   \
+  };
+
+// PORTA: digital 22-29 (solenoid valve relays), no PWM on any of them
+FAST_PIN(22, A, 0)
+FAST_PIN(23, A, 1)
+FAST_PIN(24, A, 2)
+FAST_PIN(25, A, 3)
+FAST_PIN(26, A, 4)
+FAST_PIN(27, A, 5)
+FAST_PIN(28, A, 6)
+FAST_PIN(29, A, 7)
+
+#undef FAST_PIN
+
+/**
+ * The output compare register behind a PWM pin. Once analogWrite has
+ * connected the pin to its timer (with any value but 0 or 255), a write here
+ * changes the duty without the read-modify-write of the timer's control
+ * register that makes analogWrite unsafe in an interrupt. In the Arduino's
+ * phase-correct 8-bit PWM a duty of 0 holds the pin low. Duties are 8-bit, so
+ * the high byte that every 16-bit timer register write goes through (the
+ * shared TEMP register) is 0 whichever code writes it.
+ */
+template <uint8_t Pin>
+struct PwmPin;
+
+template <> struct PwmPin<5> {  // OC3A
+  static void write(uint8_t duty) { OCR3A = duty; }
+};
+
+// ADMUX reference bits
+const uint8_t ADC_REF_AVCC  = _BV(REFS0);  // DEFAULT, 5 V
+const uint8_t ADC_REF_1V1   = _BV(REFS1);  // INTERNAL1V1
+
+/**
+ * Select ADC channel `mux` (0-15) against reference `refs`; takes effect at
+ * the next conversion start
+ */
+inline void selectAdcChannel(uint8_t mux, uint8_t refs) {
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | ((mux & 0x08) ? _BV(MUX5) : 0);
+  ADMUX  = refs | (mux & 0x07);
+}
+
+template <uint8_t Pin>
+struct AnalogPin {
+  static const uint8_t mux = Pin - A0;  // ADC channel number
+
+  static void select(uint8_t refs) { selectAdcChannel(mux, refs); }
+
+  // blocking conversion of the selected channel; the ADC must not be in use by the Sampler
+  static uint16_t read() {
+    ADCSRA |= _BV(ADSC);
+    while (ADCSRA & _BV(ADSC)) { }
+    return ADC;
+  }
+};
+
+#endif
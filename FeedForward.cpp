@@ -0,0 +1,124 @@
+#include "FeedForward.h"
+#include "Storage.h"
+
+FeedForward::FeedForward() {
+  reset(DEFAULT_VALVE_POSITION);
+}
+
+void FeedForward::reset(int command) {
+  for (int p = 0; p < FF_PRESSURE_POINTS; p++) {
+    for (int f = 0; f < FF_FLOW_POINTS; f++) {
+      table_[p][f] = (uint16_t)command << 8;
+    }
+  }
+  visited_ = 0;
+}
+
+/**
+ * Position of `value` along an axis in Q8 cell units, clamped so that the
+ * integer part always leaves room for the next cell.
+ */
+uint16_t FeedForward::axisPosition(float value, float minimum, float maximum, int points) {
+  const long last = (long)(points - 1) << 8;
+  long position = (long)((value - minimum) * (last / (maximum - minimum)));
+  if (position < 0) position = 0;
+  if (position >= last) position = last - 1;
+  return position;
+}
+
+int FeedForward::lookup(float flow, float pressure) const {
+  uint16_t f = axisPosition(flow, FF_FLOW_MIN, FF_FLOW_MAX, FF_FLOW_POINTS);
+  uint16_t p = axisPosition(pressure, FF_PRESSURE_MIN, FF_PRESSURE_MAX, FF_PRESSURE_POINTS);
+  uint8_t col = f >> 8, row = p >> 8;
+  uint16_t wf = f & 0xFF, wp = p & 0xFF;
+
+  // interpolate along flow in both rows, then between rows (all Q8)
+  uint32_t lower = ((uint32_t)table_[row][col] * (256 - wf) + (uint32_t)table_[row][col + 1] * wf) >> 8;
+  uint32_t upper = ((uint32_t)table_[row + 1][col] * (256 - wf) + (uint32_t)table_[row + 1][col + 1] * wf) >> 8;
+  uint32_t command = (lower * (256 - wp) + upper * wp) >> 8;
+
+  return (command + 128) >> 8; // round to nearest whole command
+}
+
+void FeedForward::learn(float flow, float pressure, int command, int shift) {
+  uint16_t f = axisPosition(flow, FF_FLOW_MIN, FF_FLOW_MAX, FF_FLOW_POINTS);
+  uint16_t p = axisPosition(pressure, FF_PRESSURE_MIN, FF_PRESSURE_MAX, FF_PRESSURE_POINTS);
+  uint8_t col = f >> 8, row = p >> 8;
+  uint16_t wf = f & 0xFF, wp = p & 0xFF;
+
+  // Q8 weight of each surrounding cell (products need 32 bits on the AVR)
+  const uint16_t weights[2][2] = {
+    { (uint16_t)((256UL - wp) * (256 - wf) >> 8), (uint16_t)((256UL - wp) * wf >> 8) },
+    { (uint16_t)((uint32_t)wp * (256 - wf) >> 8), (uint16_t)((uint32_t)wp * wf >> 8) }
+  };
+
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      uint16_t &cell = table_[row + i][col + j];
+      long error = ((long)command << 8) - cell;
+      long value = cell + ((error * weights[i][j]) >> (8 + shift));
+      cell = constrain(value, 0L, 255L << 8);
+
+      // only count a cell as characterised if the sample was close to it
+      if (weights[i][j] >= 64) {
+        visited_ |= 1UL << ((row + i) * FF_FLOW_POINTS + col + j);
+      }
+    }
+  }
+}
+
+/**
+ * Fill unvisited cells of one pressure row by linear interpolation between
+ * the visited cells on either side, or by copying the nearest one at the ends.
+ */
+void FeedForward::fillRow(int row) {
+  int previous = -1;
+  for (int f = 0; f <= FF_FLOW_POINTS; f++) {
+    if (f < FF_FLOW_POINTS && !isVisited(row, f)) continue;
+
+    for (int g = previous + 1; g < f && g < FF_FLOW_POINTS; g++) {
+      if (previous < 0) {
+        table_[row][g] = table_[row][f];
+      } else if (f == FF_FLOW_POINTS) {
+        table_[row][g] = table_[row][previous];
+      } else {
+        long span = table_[row][f] - (long)table_[row][previous];
+        table_[row][g] = table_[row][previous] + span * (g - previous) / (f - previous);
+      }
+    }
+    previous = f;
+  }
+}
+
+void FeedForward::fillGaps() {
+  int lastFilled = -1;
+  for (int p = 0; p < FF_PRESSURE_POINTS; p++) {
+    bool any = false;
+    for (int f = 0; f < FF_FLOW_POINTS; f++) {
+      any = any || isVisited(p, f);
+    }
+    if (!any) continue;
+
+    fillRow(p);
+
+    // rows never reached during characterisation take the nearest filled row
+    for (int q = lastFilled + 1; q < p; q++) {
+      memcpy(table_[q], table_[p], sizeof(table_[p]));
+    }
+    lastFilled = p;
+  }
+
+  if (lastFilled >= 0) {
+    for (int q = lastFilled + 1; q < FF_PRESSURE_POINTS; q++) {
+      memcpy(table_[q], table_[lastFilled], sizeof(table_[q]));
+    }
+  }
+}
+
+bool FeedForward::load() {
+  return loadBlock(EEPROM_FEED_FORWARD, eeprom_magic_, table_, sizeof(table_));
+}
+
+void FeedForward::save() const {
+  saveBlock(EEPROM_FEED_FORWARD, eeprom_magic_, table_, sizeof(table_));
+}
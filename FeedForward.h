@@ -0,0 +1,52 @@
+/**
+ * FeedForward.h
+ * Maps (desired flow, reservoir pressure) to an inspiratory valve command.
+ *
+ * The table is evenly spaced on both axes and holds commands in Q8 fixed
+ * point (command * 256) so that small per-breath corrections accumulate.
+ * Lookups use bilinear interpolation in integer arithmetic.
+ */
+
+#ifndef FeedForward_h
+#define FeedForward_h
+
+#include "Arduino.h"
+#include "Constants.h"
+
+class FeedForward {
+  public:
+    FeedForward();
+
+    // fill every cell with the same command (used before characterisation)
+    void reset(int command);
+
+    // interpolated valve command for the given operating point
+    int lookup(float flow, float pressure) const;
+
+    /**
+     * Move the table towards `command` at the given operating point.
+     * The correction is shared between the four surrounding cells by their
+     * interpolation weights and scaled down by 2^shift.
+     */
+    void learn(float flow, float pressure, int command, int shift);
+
+    // characterisation bookkeeping: forget/fill cells that were never learned
+    void clearVisited() { visited_ = 0; }
+    void fillGaps();
+
+    // persist to / restore from EEPROM
+    bool load();
+    void save() const;
+
+  private:
+    static const uint16_t eeprom_magic_ = 0xFF01;
+
+    uint16_t table_[FF_PRESSURE_POINTS][FF_FLOW_POINTS]; // Q8 valve commands
+    uint32_t visited_;  // bit per cell, set when `learn` touched it
+
+    static uint16_t axisPosition(float value, float minimum, float maximum, int points);
+    bool isVisited(int row, int col) const { return visited_ & (1UL << (row * FF_FLOW_POINTS + col)); }
+    void fillRow(int row);
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "FixedPoint.h"
+
+static const float scales[FIXED_MAX_DECIMALS + 1] PROGMEM = { 1, 10, 100, 1000 };
+
+static const uint8_t MAX_DIGITS = 13; // "-2147483.648"
+static const uint8_t MAX_WIDTH  = 16;
+
+int32_t toFixed(float value, uint8_t decimals) {
+  if (isnan(value)) return FIXED_UNKNOWN;
+  float counts = value * pgm_read_float(&scales[min(decimals, FIXED_MAX_DECIMALS)]);
+  if (counts >= 2147483647.0) return INT32_MAX;
+  if (counts <= -2147483647.0) return -INT32_MAX;
+  return (int32_t)(counts + (counts < 0 ? -0.5 : 0.5));
+}
+
+/**
+ * Digits are produced from the right, so the text is built at the end of a
+ * scratch buffer and then moved into place behind the padding
+ */
+uint8_t formatFixed(char *text, int32_t value, uint8_t decimals, uint8_t width) {
+  char digits[MAX_DIGITS];
+  uint8_t pos = sizeof(digits);
+  decimals = min(decimals, FIXED_MAX_DECIMALS);
+
+  if (value == FIXED_UNKNOWN) {
+    digits[--pos] = '-';
+    digits[--pos] = '-';
+  } else {
+    uint32_t magnitude = value < 0 ? -(uint32_t)value : value;
+    for (uint8_t place = 0; magnitude > 0 || place <= decimals; place++) {
+      if (place == decimals && decimals > 0) {
+        digits[--pos] = '.';
+      }
+      digits[--pos] = '0' + magnitude % 10;
+      magnitude /= 10;
+    }
+    if (value < 0) {
+      digits[--pos] = '-';
+    }
+  }
+
+  uint8_t length = sizeof(digits) - pos;
+  uint8_t padding = width > length ? width - length : 0;
+  memset(text, ' ', padding);
+  memcpy(text + padding, digits + pos, length);
+  text[padding + length] = '\0';
+  return padding + length;
+}
+
+size_t printFixed(Print &out, int32_t value, uint8_t decimals, uint8_t width) {
+  char text[MAX_WIDTH + 1];
+  uint8_t length = formatFixed(text, value, decimals, min(width, MAX_WIDTH));
+  return out.write((const uint8_t *)text, length);
+}
@@ -0,0 +1,37 @@
+/**
+ * FixedPoint.h
+ * Integer fixed-point values and their formatting, for the display and text
+ * output.
+ *
+ * A value is held as an integer count of tenths, hundredths, ... (e.g. 12.5
+ * cmH2O with one decimal is 125). Formatting one is plain integer division,
+ * so it avoids `dtostrf` and the soft-float formatting behind it, and it is
+ * written straight to a stream (such as the screen's serial port) instead of
+ * going through an intermediate string.
+ */
+
+#ifndef Fixed_Point_h
+#define Fixed_Point_h
+
+#include "Arduino.h"
+
+// Fixed-point value for anything not measured (NaN); formatted as "--"
+const int32_t FIXED_UNKNOWN = INT32_MIN;
+
+// Most decimals a value can have
+const uint8_t FIXED_MAX_DECIMALS = 3;
+
+// `value` as a count of 10^-decimals, rounded and saturating (NaN -> FIXED_UNKNOWN)
+int32_t toFixed(float value, uint8_t decimals);
+
+/**
+ * Format `value` (a count of 10^-decimals) right-aligned in at least `width`
+ * characters, e.g. 125 with 1 decimal in 5 -> " 12.5". `text` needs room for
+ * max(width, 13) characters and the terminator. Returns the length.
+ */
+uint8_t formatFixed(char *text, int32_t value, uint8_t decimals, uint8_t width);
+
+// write `value` formatted as by formatFixed to `out`
+size_t printFixed(Print &out, int32_t value, uint8_t decimals, uint8_t width = 0);
+
+#endif
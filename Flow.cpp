@@ -1,39 +1,73 @@
 #include "Flow.h"
 #include "Constants.h"
+#include "Sampler.h"
+
+// sensor_read(0.5-4.5 V) maps linearly to flow_rate_ (0-150 SLPM)
+static const float Fmax       = 150;                     // max flow in SLPM. (Min flow is 0)
+static const long Vsupply     = 5000;                    // voltage supplied, mv
+static const long sensorMin   = 1023L*500 / Vsupply;     // Sensor value at 500 mv
+static const long sensorRange = 1023L * 4000 / Vsupply;  // 4000 mv range (regardless of calibration?)
 
 /*
  * Initialize values
  */
-Flow::Flow(int pin) {
-  sensor_pin_ = pin;
+template <uint8_t Pin>
+Flow<Pin>::Flow() {
   flow_rate_ = 0.0;
   accum_volume_ = 0.0;
   zero_flow_offset_ = 0;
   last_timepoint_ = millis();
+  no_flow_ = false;
+  zero_window_open_ = false;
+  rejected_zero_ = 0.0/0.0;
 }
 
 /**
  * Get flow readings
  */
-void Flow::read() {
-  // read the voltage
-  long R = analogRead(sensor_pin_);
-
-  // sensor_read(0.5-4.5 V) maps linearly to flow_rate_ (0-150 SLPM)
-  const float Fmax       = 150;                     // max flow in SLPM. (Min flow is 0)
-  const long Vsupply     = 5000;                    // voltage supplied, mv
-  const long sensorMin   = 1023L*500 / Vsupply;     // Sensor value at 500 mv
-  const long sensorRange = 1023L * 4000 / Vsupply;  // 4000 mv range (regardless of calibration?)
-  
-  // Convert analog reading to flow rate at standard temperature and pressure
-  // offset is from calibration during zero-flow initialization
-  flow_rate_ = (R - sensorMin) * (Fmax / sensorRange)- zero_flow_offset_;  
+template <uint8_t Pin>
+void Flow<Pin>::read() {
+  // latest reading from the interrupt-driven sampler
+  long R = sampler.latest(Pin);
+
+  flow_rate_ = toFlow(R);
+}
+
+/**
+ * Convert a raw ADC reading to flow rate at standard temperature and pressure
+ * offset is from calibration during zero-flow initialization
+ */
+template <uint8_t Pin>
+float Flow<Pin>::toFlow(float R) const {
+  return (R - sensorMin) * (Fmax / sensorRange) - zero_flow_offset_;
+}
+
+template <uint8_t Pin>
+bool Flow<Pin>::healthy() const {
+  return !sampler.faulted(Pin);
+}
+
+template <uint8_t Pin>
+float Flow<Pin>::peak() const {
+  return toFlow(sampler.peak(Pin));
+}
+
+template <uint8_t Pin>
+void Flow<Pin>::resetPeak() {
+  sampler.resetPeak(Pin);
+}
+
+template <uint8_t Pin>
+uint16_t Flow<Pin>::rawFor(float flow) const {
+  float R = (flow + zero_flow_offset_) * (sensorRange / Fmax) + sensorMin;
+  return constrain(R, 0, 1023);
 }
 
 /**
  * Start/restart volume integration.
  */
-void Flow::resetVolume() {
+template <uint8_t Pin>
+void Flow<Pin>::resetVolume() {
   last_timepoint_ = millis();
   accum_volume_ = 0;
 }
@@ -45,7 +79,8 @@ void Flow::resetVolume() {
  * the midpoint betweenthe previous flow and the current flow, but that 
  * is unlikely to make much difference.
  */
-void Flow::updateVolume() {
+template <uint8_t Pin>
+void Flow<Pin>::updateVolume() {
   unsigned long new_timepoint = millis();
   unsigned long interval = new_timepoint - last_timepoint_;
 
@@ -56,20 +91,70 @@ void Flow::updateVolume() {
   last_timepoint_ = new_timepoint;
 }
 
-void Flow::calibrateToZero() {
-  // set offset to zero
-  zero_flow_offset_ = 0; 
-  float fm[5];
-  for (int i = 0; i < 5; i++) {
-    read();
-    fm[i] = flow_rate_;
-    delay(100);
+/**
+ * Startup zero from a short average of the full-rate stream. Both sensors can
+ * calibrate at once since each has its own window.
+ */
+template <uint8_t Pin>
+void Flow<Pin>::beginCalibration() {
+  sampler.beginWindow(Pin);
+  zero_window_open_ = false; // the window belongs to the calibration now
+}
+
+template <uint8_t Pin>
+void Flow<Pin>::finishCalibration() {
+  float raw;
+  if (sampler.windowMean(Pin, raw)) {
+    zero_flow_offset_ += toFlow(raw); // flow read with the old zero is the zero's error
+  }
+  rejected_zero_ = 0.0/0.0;
+}
+
+template <uint8_t Pin>
+void Flow<Pin>::trackZero(bool noFlow) {
+  unsigned long now = millis();
+  if (noFlow && !no_flow_) {
+    no_flow_since_ = now;
   }
+  no_flow_ = noFlow;
 
-  // average last three readings
-  zero_flow_offset_ = (fm[2]+fm[3]+fm[4])/3;  
+  if (noFlow) {
+    if (!zero_window_open_ && now - no_flow_since_ >= ZERO_SETTLE) {
+      sampler.beginWindow(Pin);
+      zero_window_open_ = true;
+    }
+  } else if (zero_window_open_) {
+    zero_window_open_ = false;
+    float raw;
+    uint16_t samples = sampler.windowCount(Pin);
+    if (samples >= ZERO_MIN_SAMPLES && sampler.windowMean(Pin, raw)) {
+      updateZero(toFlow(raw) + zero_flow_offset_);
+    }
+  }
 }
 
+/**
+ * Move the zero towards a no-flow window's estimate, rejecting single outliers
+ * (e.g. a patient effort through the limb) but following a genuine shift that
+ * two windows in a row agree on
+ */
+template <uint8_t Pin>
+void Flow<Pin>::updateZero(float estimate) {
+  if (fabs(estimate - zero_flow_offset_) > ZERO_MAX_STEP) {
+    if (isnan(rejected_zero_) || fabs(estimate - rejected_zero_) > ZERO_MAX_STEP) {
+      rejected_zero_ = estimate;
+      return;
+    }
+    zero_flow_offset_ = (estimate + rejected_zero_) / 2; // the zero has moved
+  } else {
+    zero_flow_offset_ += (estimate - zero_flow_offset_) * ZERO_TRACK_WEIGHT;
+  }
+  rejected_zero_ = 0.0/0.0;
+}
+
+template class Flow<FLOW_INSP>;
+template class Flow<FLOW_EXP>;
+
 // Flow sensors
-Flow inspFlowReader(FLOW_INSP);
-Flow expFlowReader(FLOW_EXP);
+Flow<FLOW_INSP> inspFlowReader;
+Flow<FLOW_EXP>  expFlowReader;
@@ -2,24 +2,56 @@
  * Flow.h
  * Calculates and stores the key flow values in the breathing cycle.
  * All flow values are measured in SLPM
+ *
+ * The analog pin is a template argument so the Sampler channel is fixed at
+ * compile time; the sensors used are instantiated in Flow.cpp.
  */
 
 #ifndef Flow_h
 #define Flow_h
 
+#include "Arduino.h"
+#include "Constants.h"
 
+
+template <uint8_t Pin>
 class Flow {
   public:
-    Flow(int pin);
+    Flow();
 
     // reads sensor, should be called at most once per main loop iteration
     void read();
     void reset();
-    void calibrateToZero();
+
+    // startup zero: average the full-rate stream from `beginCalibration` (limb
+    // must carry no flow) until `finishCalibration`, ZERO_STARTUP_WINDOW later
+    void beginCalibration();
+    void finishCalibration();
+
+    /**
+     * Online zero tracking; call every loop with whether the sensor's limb is
+     * known to carry no flow (valve closed). Samples are averaged from
+     * ZERO_SETTLE after that starts until it ends, and the window's mean
+     * updates the zero unless it is an outlier. Call with false *before*
+     * opening the valve so no flowing samples reach the window.
+     */
+    void trackZero(bool noFlow);
+    float zero() const { return zero_flow_offset_; }
+    void setZero(float zero) { zero_flow_offset_ = zero; } // e.g. restored after a watchdog reset
 
     // `get` can be called efficiently at will after `read` is called
     float get() const { return flow_rate_; }
 
+    // raw ADC reading corresponding to `flow` (for thresholds checked by the Sampler)
+    uint16_t rawFor(float flow) const;
+
+    // false while the sensor health monitor has the sensor marked failed
+    bool healthy() const;
+
+    // highest flow in the full-rate sample stream since the last `resetPeak`
+    float peak() const;
+    void resetPeak();
+
     // The following functions integrate flow over time to get a computed volume.
     void resetVolume();
     void updateVolume();
@@ -35,11 +67,19 @@ class Flow {
     float getVolume() const { return accum_volume_; }
 
   private:
-    int   sensor_pin_;
     float flow_rate_;
 
     // raw reading at 0 flow -> adjustment to future readings
-    long zero_flow_offset_;  
+    float zero_flow_offset_;  
+
+    // zero tracking
+    bool          no_flow_;         // limb known to carry no flow since no_flow_since_
+    unsigned long no_flow_since_;
+    bool          zero_window_open_;
+    float         rejected_zero_;   // last outlier estimate (NaN if none), accepted if the next agrees
+    void updateZero(float estimate);
+
+    float toFlow(float raw) const;
 
     // Volume integraton
     unsigned long last_timepoint_; // Time of last call to `resetVolume` or `updateVolume`.
@@ -47,7 +87,7 @@ class Flow {
 };
 
 // Flow sensors
-extern Flow inspFlowReader;
-extern Flow expFlowReader;
+extern Flow<FLOW_INSP> inspFlowReader;
+extern Flow<FLOW_EXP>  expFlowReader;
 
 #endif // Flow_h
@@ -0,0 +1,66 @@
+#include "GainSchedule.h"
+#include "Storage.h"
+
+// schedule as stored in EEPROM
+struct StoredSchedule {
+  uint8_t   count;
+  GainPoint points[GAIN_SCHEDULE_POINTS];
+};
+
+bool GainSchedule::set(float flow, float kp, float ki, float kd) {
+  if (kp < 0 || ki < 0 || kd < 0) return false;
+
+  // find the insertion point, replacing an existing point at the same flow
+  int i = 0;
+  while (i < count_ && points_[i].flow < flow) i++;
+  if (i == count_ || points_[i].flow != flow) {
+    if (count_ == GAIN_SCHEDULE_POINTS) return false;
+    memmove(&points_[i + 1], &points_[i], (count_ - i) * sizeof(GainPoint));
+    count_++;
+  }
+
+  points_[i].flow = flow;
+  points_[i].kp = kp;
+  points_[i].ki = ki;
+  points_[i].kd = kd;
+  return true;
+}
+
+void GainSchedule::lookup(float flow, double &kp, double &ki, double &kd) const {
+  if (count_ == 0) return;
+
+  if (flow <= points_[0].flow) {
+    kp = points_[0].kp; ki = points_[0].ki; kd = points_[0].kd;
+    return;
+  }
+  for (int i = 1; i < count_; i++) {
+    if (flow < points_[i].flow) {
+      const GainPoint &a = points_[i - 1], &b = points_[i];
+      float t = (flow - a.flow) / (b.flow - a.flow);
+      kp = a.kp + t * (b.kp - a.kp);
+      ki = a.ki + t * (b.ki - a.ki);
+      kd = a.kd + t * (b.kd - a.kd);
+      return;
+    }
+  }
+  const GainPoint &last = points_[count_ - 1];
+  kp = last.kp; ki = last.ki; kd = last.kd;
+}
+
+bool GainSchedule::load() {
+  StoredSchedule stored;
+  if (!loadBlock(EEPROM_GAIN_SCHEDULE, eeprom_magic_, &stored, sizeof(stored)) || stored.count > GAIN_SCHEDULE_POINTS) {
+    return false;
+  }
+  count_ = stored.count;
+  memcpy(points_, stored.points, sizeof(points_));
+  return true;
+}
+
+void GainSchedule::save() const {
+  StoredSchedule stored;
+  memset(&stored, 0, sizeof(stored));
+  stored.count = count_;
+  memcpy(stored.points, points_, count_ * sizeof(GainPoint));
+  saveBlock(EEPROM_GAIN_SCHEDULE, eeprom_magic_, &stored, sizeof(stored));
+}
@@ -0,0 +1,48 @@
+/**
+ * GainSchedule.h
+ * PID gains for the inspiratory valve as a function of the flow setpoint.
+ *
+ * Points are kept sorted by flow and gains are interpolated linearly between
+ * them (held constant beyond the first and last point). An empty schedule is
+ * inactive and the valve keeps its fixed gains.
+ */
+
+#ifndef GainSchedule_h
+#define GainSchedule_h
+
+#include "Arduino.h"
+#include "Constants.h"
+
+struct GainPoint {
+  float flow;       // flow setpoint (SLPM)
+  float kp, ki, kd;
+};
+
+class GainSchedule {
+  public:
+    GainSchedule() : count_(0) { }
+
+    bool active() const { return count_ > 0; }
+    int  points() const { return count_; }
+    const GainPoint &point(int index) const { return points_[index]; }
+
+    void clear() { count_ = 0; }
+
+    // add a point, or replace the one at the same flow; false if the schedule is full
+    bool set(float flow, float kp, float ki, float kd);
+
+    // interpolated gains at `flow` (only meaningful when `active`)
+    void lookup(float flow, double &kp, double &ki, double &kd) const;
+
+    // persist to / restore from EEPROM
+    bool load();
+    void save() const;
+
+  private:
+    static const uint16_t eeprom_magic_ = 0x6501;
+
+    uint8_t   count_;
+    GainPoint points_[GAIN_SCHEDULE_POINTS];
+};
+
+#endif
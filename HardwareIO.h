@@ -0,0 +1,60 @@
+/**
+ * HardwareIO.h
+ * The IO of the Circuit wired to this board: the sensors, valves and
+ * controllers are the global instances, patient triggers are detected by the
+ * Sampler, and the hooks drive what the board has one of (the display, the
+ * O2 blender, telemetry, the SD recording, trends and the watchdog snapshot).
+ *
+ * The hooks are defined in circuit-control.ino, next to the rest of that
+ * shared work.
+ */
+
+#ifndef Hardware_IO_h
+#define Hardware_IO_h
+
+#include "Arduino.h"
+#include "Constants.h"
+#include "Circuit.h"
+#include "Flow.h"
+#include "Pressure.h"
+#include "Valve.h"
+#include "ProportionalValve.h"
+#include "PressureController.h"
+#include "AlarmManager.h"
+#include "LeakDetector.h"
+#include "Mechanics.h"
+#include "Display.h"
+
+struct HardwareIO {
+  Flow<FLOW_INSP>           &inspFlow        = inspFlowReader;
+  Flow<FLOW_EXP>            &expFlow         = expFlowReader;
+  Pressure<PRESSURE_INSP>   &inspPressure    = inspPressureReader;
+  Pressure<PRESSURE_EXP>    &expPressure     = expPressureReader;
+  ProportionalValve         &inspValve       = ::inspValve;
+  Valve<SV4_CONTROL, true>  &expValve        = ::expValve;
+  PressureController        &pressureControl = pressureController;
+  AlarmManager              &alarms          = alarmMgr;
+  LeakDetector              &leak            = leakDetector;
+  Mechanics                 &mechanics       = ::mechanics;
+  Display                   &settings        = display;
+
+  // patient trigger detection, from the sampling interrupt
+  void armTrigger(bool flow, uint16_t raw);
+  bool triggered();
+  unsigned long triggerTime();
+  void disarmTrigger();
+
+  // the sampling interrupt is stopped (by the O2 task), so a trigger or the pressure loop would be blind
+  bool samplingSuspended();
+
+  // a breath starts delivering `volume` (cc); inspiration ended having delivered `volume`
+  void beginInspiration(float volume);
+  void endInspiration(float volume);
+
+  void showFlow(float flow);
+  void showVolumeInsp(float volume);
+  void reportBreath(const BreathReport &report);
+  void stateChanged();
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "IterativeLearning.h"
+
+void IterativeLearning::clear() {
+  for (int i = 0; i < ILC_BINS; i++) {
+    corrections_[i] = 0;
+  }
+  recording_ = false;
+}
+
+void IterativeLearning::beginBreath() {
+  bin_ = 0;
+  bin_sum_ = 0;
+  bin_samples_ = 0;
+  recording_ = true;
+}
+
+/**
+ * Store the mean error of the current bin, saturated to the int8 range
+ */
+void IterativeLearning::closeBin() {
+  if (bin_ < ILC_BINS) {
+    float counts = bin_samples_ > 0 ? bin_sum_ / bin_samples_ / ILC_ERROR_RESOLUTION : 0;
+    errors_[bin_] = constrain(counts, -127, 127);
+  }
+  bin_++;
+  bin_sum_ = 0;
+  bin_samples_ = 0;
+}
+
+void IterativeLearning::record(unsigned long elapsed, float error) {
+  if (!recording_) return;
+
+  int bin = elapsed / ILC_BIN_DURATION;
+  while (bin_ < bin && bin_ < ILC_BINS) {
+    closeBin(); // bins skipped by a slow loop are recorded as zero error
+  }
+  if (bin_ < ILC_BINS) {
+    bin_sum_ += error;
+    bin_samples_++;
+  }
+}
+
+float IterativeLearning::correction(unsigned long elapsed) const {
+  unsigned long bin = elapsed / ILC_BIN_DURATION;
+  return bin < ILC_BINS ? (float)corrections_[bin] / correction_scale_ : 0.0;
+}
+
+/**
+ * u[i] <- smooth((1 - forgetting) * u[i] + gain * e[i + lead])
+ *
+ * Only bins that were reached this breath are updated. The 1-2-1 smoothing
+ * acts as the ILC Q-filter, keeping noise from being learned bin by bin.
+ */
+void IterativeLearning::endBreath() {
+  if (!recording_) return;
+  recording_ = false;
+
+  if (bin_samples_ > 0) {
+    closeBin(); // keep the partially-filled last bin
+  }
+  int bins = min(bin_, ILC_BINS);
+  if (bins == 0) return;
+
+  float updated[ILC_BINS];
+  for (int i = 0; i < bins; i++) {
+    int lead = min(i + ILC_LEAD_BINS, bins - 1);
+    float error = errors_[lead] * ILC_ERROR_RESOLUTION;
+    updated[i] = (1.0 - ILC_FORGETTING) * corrections_[i] / correction_scale_ + ILC_LEARNING_GAIN * error;
+  }
+
+  for (int i = 0; i < bins; i++) {
+    float left  = updated[i > 0 ? i - 1 : i];
+    float right = updated[i < bins - 1 ? i + 1 : i];
+    float smoothed = (left + 2 * updated[i] + right) / 4;
+    smoothed = constrain(smoothed, -ILC_MAX_CORRECTION, ILC_MAX_CORRECTION);
+    corrections_[i] = smoothed * correction_scale_;
+  }
+}
@@ -0,0 +1,51 @@
+/**
+ * IterativeLearning.h
+ * Breath-to-breath iterative learning control (ILC) of the inspiratory flow profile.
+ *
+ * The flow error of each inspiration is recorded on a fixed time grid. At the
+ * end of the breath it is folded into a correction profile that is added to
+ * the PID output on the next breath, so errors that repeat every breath (such
+ * as the early-inspiration undershoot) are removed over a few cycles.
+ */
+
+#ifndef IterativeLearning_h
+#define IterativeLearning_h
+
+#include "Arduino.h"
+#include "Constants.h"
+
+class IterativeLearning {
+  public:
+    IterativeLearning() { clear(); }
+
+    // forget the learned profile (e.g. when the flow setpoint changes)
+    void clear();
+
+    // start recording a new inspiration
+    void beginBreath();
+
+    // record flow error (setpoint - measured, SLPM) at `elapsed` ms into inspiration
+    void record(unsigned long elapsed, float error);
+
+    // correction (valve command) to add to the PID output at `elapsed` ms
+    float correction(unsigned long elapsed) const;
+
+    // update the correction profile from the recorded errors
+    void endBreath();
+
+  private:
+    static const int correction_scale_ = 16; // corrections are stored in 1/16 command
+
+    int8_t  errors_[ILC_BINS];       // mean error per bin, in ILC_ERROR_RESOLUTION counts
+    int16_t corrections_[ILC_BINS];  // correction per bin, in 1/correction_scale_ command
+
+    // accumulation for the bin currently being recorded
+    int   bin_;
+    float bin_sum_;
+    int   bin_samples_;
+    bool  recording_;
+
+    void closeBin();
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include "LeakDetector.h"
+#include "Constants.h"
+
+void LeakDetector::beginBreath(float baselinePressure) {
+  baseline_ = baselinePressure;
+  checked_ = false;
+  risen_ = false;
+}
+
+bool LeakDetector::checkInspiration(float volume, float peakPressure) {
+  if (!risen_ && peakPressure - baseline_ >= DISCONNECT_PRESSURE_RISE) {
+    risen_ = true;
+  }
+  if (!checked_ && volume >= DISCONNECT_MIN_VOLUME) {
+    checked_ = true;
+    if (!risen_) {
+      disconnected_ = true; // gas is going somewhere other than the lungs
+    }
+  }
+  return disconnected_;
+}
+
+void LeakDetector::endBreath(float volumeInsp, float volumeExp, unsigned long cycleDuration) {
+  if (volumeInsp < DISCONNECT_MIN_VOLUME || cycleDuration == 0) {
+    return; // too small a breath to say anything
+  }
+
+  if (!risen_ || volumeExp < volumeInsp * DISCONNECT_RETURN_FRACTION) {
+    disconnected_ = true;
+    return; // a disconnected breath says nothing about the leak
+  }
+  disconnected_ = false;
+
+  float leak = max(volumeInsp - volumeExp, 0.0f);
+  leak_fraction_ += (leak / volumeInsp - leak_fraction_) * LEAK_FILTER_WEIGHT;
+  leak_flow_ += (leak * CC_PER_MS_TO_LPM / cycleDuration - leak_flow_) * LEAK_FILTER_WEIGHT;
+}
+
+float LeakDetector::inspiratoryLeak(unsigned long inspDuration) const {
+  return leak_flow_ * LPM_TO_CC_PER_MS * inspDuration;
+}
+
+float LeakDetector::compensation(float volume, unsigned long inspDuration) const {
+  if (!compensating_ || disconnected_) return 0;
+  return min(inspiratoryLeak(inspDuration), volume * LEAK_MAX_COMPENSATION);
+}
+
+LeakDetector leakDetector;
@@ -0,0 +1,69 @@
+/**
+ * LeakDetector.h
+ * Circuit leak estimation and disconnect detection.
+ *
+ * Two checks run on every breath:
+ *  - during inspiration, the running peak of the full-rate inspiratory
+ *    pressure stream must rise above the pressure at the start of the breath
+ *    once a minimum volume has been delivered. A disconnected circuit lets the
+ *    gas out without building pressure, so this flags a disconnect within the
+ *    breath it happens in.
+ *  - once the breath's expiration is complete, the inspired and expired
+ *    volumes are compared. The difference, spread over the breath, gives the
+ *    leak flow, which is filtered across breaths. Almost no returned volume is
+ *    also treated as a disconnect.
+ *
+ * The leak is taken as constant over the breath, so the share lost during
+ * inspiration is proportional to its duration. With compensation on, VC
+ * breaths deliver that much extra volume.
+ */
+
+#ifndef Leak_Detector_h
+#define Leak_Detector_h
+
+#include "Arduino.h"
+
+class LeakDetector {
+  public:
+    LeakDetector() : leak_flow_(0), leak_fraction_(0), baseline_(0), checked_(false),
+      risen_(false), disconnected_(false), compensating_(false) { }
+
+    // at the start of inspiration, with the airway pressure before the valve opened
+    void beginBreath(float baselinePressure);
+
+    /**
+     * During inspiration: `volume` delivered so far and the peak inspiratory
+     * pressure so far. Returns true while the breath looks disconnected.
+     */
+    bool checkInspiration(float volume, float peakPressure);
+
+    // once the expired volume of the breath is known
+    void endBreath(float volumeInsp, float volumeExp, unsigned long cycleDuration);
+
+    bool disconnected() const { return disconnected_; }
+
+    float leakFlow() const { return leak_flow_; }          // SLPM
+    float leakFraction() const { return leak_fraction_; }  // of inspired volume
+
+    // cc expected to leak during an inspiration of `inspDuration` ms
+    float inspiratoryLeak(unsigned long inspDuration) const;
+
+    // extra volume to deliver so the patient receives `volume` (0 unless compensating)
+    float compensation(float volume, unsigned long inspDuration) const;
+
+    void setCompensation(bool on) { compensating_ = on; }
+    bool compensating() const { return compensating_; }
+
+  private:
+    float leak_flow_;
+    float leak_fraction_;
+    float baseline_;
+    bool  checked_;       // enough volume delivered this breath to judge the pressure rise
+    bool  risen_;         // pressure rose this breath
+    bool  disconnected_;
+    bool  compensating_;
+};
+
+extern LeakDetector leakDetector;
+
+#endif
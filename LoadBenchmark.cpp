@@ -0,0 +1,202 @@
+#include "LoadBenchmark.h"
+#include "MemoryMonitor.h"
+#include "Supervisor.h"
+
+/**
+ * Single-compartment lung: SV3 delivers flow in proportion to its command,
+ * the open SV4 lets the elastic pressure drive flow back out through the
+ * airway resistance
+ */
+void SimLung::step() {
+  unsigned long now = millis();
+  unsigned long dt = now - last;
+  last = now;
+
+  inspFlow = valve * LOAD_SIM_VALVE_FLOW;
+  float elastic = volume / LOAD_SIM_COMPLIANCE;
+  expFlow = expOpen && elastic > 0 ? elastic / LOAD_SIM_RESISTANCE * 60 : 0; // L/s to SLPM
+
+  volume += (inspFlow - expFlow) * LPM_TO_CC_PER_MS * dt;
+  if (volume < 0) volume = 0;
+  pressure = LOAD_SIM_PEEP + volume / LOAD_SIM_COMPLIANCE + LOAD_SIM_RESISTANCE * (inspFlow - expFlow) / 60; // SLPM to L/s
+}
+
+void SimFlow::read() {
+  flow_ = inspiratory_ ? lung_.inspFlow : lung_.expFlow;
+  if (flow_ > peak_) peak_ = flow_;
+}
+
+void SimFlow::resetVolume() {
+  volume_ = 0;
+  last_ = millis();
+}
+
+void SimFlow::updateVolume() {
+  unsigned long now = millis();
+  volume_ += flow_ * LPM_TO_CC_PER_MS * (now - last_);
+  last_ = now;
+}
+
+void SimPressure::read() {
+  current_ = lung_.pressure;
+  if (current_ > peak_so_far_) peak_so_far_ = current_;
+  window_sum_ += current_;
+  window_count_++;
+}
+
+SimValve::SimValve(SimLung &lung) :
+  lung_(lung), controller_(&input_, &output_, &setpoint_, VKP, VKI, VKD, DIRECT) {
+  controller_.SetOutputLimits(OUTPUT_MIN, OUTPUT_MAX);
+  controller_.SetSampleTime(SAMPLE_TIME);
+}
+
+void SimValve::beginBreath(float desiredFlow) {
+  setpoint_ = desiredFlow;
+  output_ = DEFAULT_VALVE_POSITION;
+  controller_.SetMode(AUTOMATIC);
+  lung_.valve = output_;
+}
+
+void SimValve::maintainBreath(unsigned long) {
+  input_ = lung_.inspFlow;
+  controller_.Compute();
+  lung_.valve = output_;
+}
+
+void SimValve::endBreath() {
+  controller_.SetMode(MANUAL);
+  lung_.valve = 0;
+}
+
+void SimValve::holdBias(float flow) {
+  lung_.valve = flow / LOAD_SIM_VALVE_FLOW;
+}
+
+void SimPressureControl::beginBreath(float start, float target, unsigned long riseTime) {
+  start_ = start;
+  target_ = target;
+  began_ = millis();
+  rise_time_ = riseTime;
+  error_sum_ = 0;
+  error_count_ = 0;
+  active_ = true;
+}
+
+void SimPressureControl::endBreath() {
+  if (!active_) return;
+  active_ = false;
+  lung_.valve = 0;
+  tracking_error_ = error_count_ ? error_sum_ / error_count_ : 0.0/0.0;
+}
+
+void SimPressureControl::step() {
+  unsigned long elapsed = millis() - began_;
+  float target = target_;
+  if (elapsed < rise_time_) {
+    target = start_ + (target_ - start_) * elapsed / rise_time_;
+  } else {
+    error_sum_ += fabs(target - lung_.pressure);
+    error_count_++;
+  }
+  lung_.valve = constrain(PS_KP * (target - lung_.pressure), 0, 255);
+}
+
+SimulatedIO::SimulatedIO() :
+  inspFlow(lung, true), expFlow(lung, false),
+  inspPressure(lung), expPressure(lung),
+  inspValve(lung), expValve(lung), pressureControl(lung) { }
+
+void SimulatedIO::step() {
+  if (pressureControl.active()) {
+    pressureControl.step();
+  }
+  lung.step();
+}
+
+struct LoadBenchmark::SimCircuit {
+  SimulatedIO io;
+  Circuit<SimulatedIO> circuit;
+  SimCircuit() : circuit(io) { }
+};
+
+uint16_t LoadBenchmark::bytesPerCircuit() {
+  return sizeof(SimCircuit);
+}
+
+bool LoadBenchmark::start(uint8_t circuits) {
+  stop();
+  if (circuits == 0) return true;
+  if (circuits > LOAD_MAX_CIRCUITS ||
+      (uint32_t)circuits * sizeof(SimCircuit) + MEMORY_ALARM_HEADROOM > memoryMonitor.headroom()) {
+    return false;
+  }
+
+  circuits_ = new SimCircuit[circuits];
+  if (!circuits_) return false;
+  count_ = circuits;
+  for (uint8_t i = 0; i < count_; i++) {
+    circuits_[i].circuit.requestedMode = i % 2 ? PS_MODE : VC_MODE;
+    circuits_[i].io.lung.last = millis();
+    circuits_[i].circuit.begin();
+  }
+
+  ticks_ = 0;
+  sim_sum_ = sim_max_ = 0;
+  loop_sum_ = loop_max_ = 0;
+  baseline_max_ = 0;
+  overruns_at_start_ = supervisor.overruns();
+  return true;
+}
+
+void LoadBenchmark::stop() {
+  delete[] circuits_;
+  circuits_ = 0;
+  count_ = 0;
+}
+
+void LoadBenchmark::tick() {
+  if (count_ == 0) return;
+
+  unsigned long start = micros();
+  if (ticks_ > 0) {
+    unsigned long loop = start - last_tick_;
+    loop_sum_ += loop;
+    if (loop > loop_max_) loop_max_ = loop;
+    if (loop - last_sim_ > baseline_max_) baseline_max_ = loop - last_sim_;
+  }
+
+  for (uint8_t i = 0; i < count_; i++) {
+    Circuit<SimulatedIO> &circuit = circuits_[i].circuit;
+    circuit.io().step();
+    circuit.readSensors();
+    circuit.checkReadings();
+    circuit.tick();
+    circuit.trackFlowZeros(false);
+  }
+
+  last_sim_ = micros() - start;
+  sim_sum_ += last_sim_;
+  if (last_sim_ > sim_max_) sim_max_ = last_sim_;
+  last_tick_ = start;
+  ticks_++;
+}
+
+unsigned long LoadBenchmark::breaths() const {
+  unsigned long total = 0;
+  for (uint8_t i = 0; i < count_; i++) {
+    total += circuits_[i].io.breaths;
+  }
+  return total;
+}
+
+unsigned long LoadBenchmark::overruns() const {
+  return supervisor.overruns() - overruns_at_start_;
+}
+
+unsigned long LoadBenchmark::capacity() const {
+  unsigned long budget = LOOP_PERIOD * 1000;
+  if (maxCircuit() == 0 || baseline_max_ >= budget) return 0;
+  return (budget - baseline_max_) / maxCircuit();
+}
+
+LoadBenchmark loadBenchmark;
@@ -0,0 +1,252 @@
+/**
+ * LoadBenchmark.h
+ * How many breathing circuits can one controller drive within LOOP_PERIOD?
+ *
+ * `start(n)` adds n simulated circuits that run from the main loop right
+ * after the real one, each a full Circuit (both state machines, the flow PID,
+ * mechanics fit, leak detection and alarm checks) on a SimulatedIO: a
+ * single-compartment test lung in place of the sensors and valves, and no-op
+ * display, blender and trigger hooks. Each is stepped, read and ticked in
+ * turn, so the circuits' sampling is interleaved through the tick the way
+ * several real circuits would be. Alternate circuits run volume control and
+ * pressure support; all start together, so their breath transitions line up
+ * (the worst case for one tick).
+ *
+ * The simulated circuits live on the heap and are only allocated while they
+ * fit above MEMORY_ALARM_HEADROOM. Meant for a bench unit on a test lung: the
+ * extra load slows the real circuit's loop like any other work would.
+ */
+
+#ifndef Load_Benchmark_h
+#define Load_Benchmark_h
+
+#include "Arduino.h"
+#include "Constants.h"
+#include "Circuit.h"
+#include "PID_v1.h"
+#include "LeakDetector.h"
+#include "Mechanics.h"
+
+// The test lung of one simulated circuit, shared by its sensors and valves
+struct SimLung {
+  float volume   = 0;              // cc above rest
+  float inspFlow = 0;              // SLPM
+  float expFlow  = 0;              // SLPM
+  float pressure = LOAD_SIM_PEEP;  // cmH2O
+  float valve    = 0;              // SV3 command (0-255)
+  bool  expOpen  = true;
+  unsigned long last = 0;
+
+  // advance to now
+  void step();
+};
+
+// Flow sensor on one limb of the lung (same interface as Flow)
+class SimFlow {
+  public:
+    SimFlow(SimLung &lung, bool inspiratory) : lung_(lung), inspiratory_(inspiratory) { }
+
+    void read();
+    float get() const { return flow_; }
+    float peak() const { return peak_; }
+    void resetPeak() { peak_ = 0; }
+    void resetVolume();
+    void updateVolume();
+    float getVolume() const { return volume_; }
+    void trackZero(bool) { }
+    uint16_t rawFor(float) const { return 0; }
+
+  private:
+    SimLung &lung_;
+    bool  inspiratory_;
+    float flow_ = 0, peak_ = 0, volume_ = 0;
+    unsigned long last_ = 0;
+};
+
+// Airway pressure sensor (same interface as Pressure)
+class SimPressure {
+  public:
+    explicit SimPressure(SimLung &lung) : lung_(lung) { }
+
+    void read();
+    float get() const { return current_; }
+    float peak() const { return peak_; }
+    float peakSoFar() const { return peak_so_far_; }
+    float plateau() const { return plateau_; }
+    float peep() const { return peep_; }
+    void setPeakAndReset() { peak_ = peak_so_far_; peak_so_far_ = current_; }
+    void resetPeak() { peak_so_far_ = current_; }
+    void beginWindow() { window_sum_ = 0; window_count_ = 0; }
+    void setPlateau() { plateau_ = windowAverage(); }
+    void setPeep() { peep_ = windowAverage(); }
+    uint16_t rawFor(float) const { return 0; }
+
+  private:
+    SimLung &lung_;
+    float current_ = LOAD_SIM_PEEP, peak_so_far_ = LOAD_SIM_PEEP;
+    float peak_ = 0.0/0.0, plateau_ = 0.0/0.0, peep_ = LOAD_SIM_PEEP;
+    float window_sum_ = 0;
+    uint16_t window_count_ = 0;
+
+    float windowAverage() const { return window_count_ ? window_sum_ / window_count_ : current_; }
+};
+
+// SV3 under flow PID control, as ProportionalValve without the learning
+class SimValve {
+  public:
+    explicit SimValve(SimLung &lung);
+
+    void beginBreath(float desiredFlow);
+    void maintainBreath(unsigned long cycleTimer);
+    void endBreath();
+    void holdBias(float flow);
+
+  private:
+    SimLung &lung_;
+    double input_ = 0, output_ = 0, setpoint_ = 0;
+    PID controller_;
+};
+
+// SV4 (same interface as Valve)
+class SimExpValve {
+  public:
+    explicit SimExpValve(SimLung &lung) : lung_(lung) { }
+    void open() { lung_.expOpen = true; }
+    void close() { lung_.expOpen = false; }
+
+  private:
+    SimLung &lung_;
+};
+
+// Pressure support of SV3 (same interface as PressureController); stepped with the lung
+class SimPressureControl {
+  public:
+    explicit SimPressureControl(SimLung &lung) : lung_(lung) { }
+
+    void beginBreath(float start, float target, unsigned long riseTime);
+    void endBreath();
+    bool active() const { return active_; }
+    bool risen() const { return millis() - began_ >= rise_time_; }
+    float trackingError() const { return tracking_error_; }
+
+    // proportional control of SV3 towards the ramped target
+    void step();
+
+  private:
+    SimLung &lung_;
+    bool  active_ = false;
+    float start_ = 0, target_ = 0;
+    unsigned long began_ = 0, rise_time_ = 0;
+    float error_sum_ = 0;
+    uint16_t error_count_ = 0;
+    float tracking_error_ = 0.0/0.0;
+};
+
+// Alarm states only; nothing is shown or sounded
+class SimAlarms {
+  public:
+    void activateAlarm(alarmCode code) { active_ |= 1UL << code; }
+    void deactivateAlarm(alarmCode code) { active_ &= ~(1UL << code); }
+    bool alarmStatus(alarmCode code) const { return active_ & (1UL << code); }
+    void maintainAlarms() { }
+
+  private:
+    uint32_t active_ = 0;  // bit per alarmCode (N_ALARMS <= 32)
+};
+
+// The default settings, as a freshly started Display holds them
+class SimSettings {
+  public:
+    int volume() const { return TIDAL_VOLUME; }
+    int bpm() const { return BPM; }
+    unsigned inspPercent() const { return IE_INSP*100 / (IE_INSP + IE_EXP); }
+    bool inspHold() const { return false; }
+    void resetInspHold() { }
+    bool isTurnedOff() const { return false; }
+    float sensitivity() const { return SENSITIVITY; }
+    int peakPressure() const { return PS_PEAK_PRESSURE; }
+    float riseTime() const { return PS_RISE_TIME; }
+    float cycleOff() const { return PS_CYCLE_OFF; }
+    int apnea() const { return PS_APNEA_TIME; }
+};
+
+// The IO of a simulated circuit (see Circuit.h)
+struct SimulatedIO {
+  SimLung            lung;
+  SimFlow            inspFlow, expFlow;
+  SimPressure        inspPressure, expPressure;
+  SimValve           inspValve;
+  SimExpValve        expValve;
+  SimPressureControl pressureControl;
+  SimAlarms          alarms;
+  LeakDetector       leak;
+  Mechanics          mechanics;
+  SimSettings        settings;
+  unsigned long      breaths = 0;
+
+  SimulatedIO();
+
+  // advance the lung, and the pressure control that runs from the ADC interrupt on the board
+  void step();
+
+  // the simulated patient never triggers, and nothing is shown
+  void armTrigger(bool, uint16_t) { }
+  bool triggered() { return false; }
+  unsigned long triggerTime() { return 0; }
+  void disarmTrigger() { }
+  bool samplingSuspended() { return false; }
+  void beginInspiration(float) { }
+  void endInspiration(float) { }
+  void showFlow(float) { }
+  void showVolumeInsp(float) { }
+  void reportBreath(const BreathReport &) { breaths++; }
+  void stateChanged() { }
+};
+
+class LoadBenchmark {
+  public:
+    /**
+     * Run `circuits` simulated circuits from now on, replacing any running;
+     * false (and none run) if that many don't fit in SRAM
+     */
+    bool start(uint8_t circuits);
+    void stop();
+
+    // call once per loop, after the real circuit's tick
+    void tick();
+
+    uint8_t circuits() const { return count_; }
+    static uint16_t bytesPerCircuit();
+    unsigned long breaths() const;  // by all simulated circuits since `start`
+    unsigned long ticks() const { return ticks_; }
+
+    // us per simulated circuit per tick, mean and worst
+    unsigned long meanCircuit() const { return ticks_ && count_ ? sim_sum_ / ticks_ / count_ : 0; }
+    unsigned long maxCircuit() const { return count_ ? sim_max_ / count_ : 0; }
+
+    // us from one tick to the next (the whole loop), mean and worst
+    unsigned long meanLoop() const { return ticks_ > 1 ? loop_sum_ / (ticks_ - 1) : 0; }
+    unsigned long maxLoop() const { return loop_max_; }
+
+    // loop overruns (see Supervisor) since `start`
+    unsigned long overruns() const;
+
+    // circuits that fit in LOOP_PERIOD alongside the worst loop without the simulated ones
+    unsigned long capacity() const;
+
+  private:
+    struct SimCircuit;
+    SimCircuit *circuits_ = 0;
+    uint8_t count_ = 0;
+
+    unsigned long ticks_ = 0;
+    unsigned long last_tick_ = 0, last_sim_ = 0;  // us
+    unsigned long sim_sum_ = 0, sim_max_ = 0;
+    unsigned long loop_sum_ = 0, loop_max_ = 0;
+    unsigned long baseline_max_ = 0;              // worst loop less its simulated circuits
+    unsigned long overruns_at_start_ = 0;
+};
+
+extern LoadBenchmark loadBenchmark;
+
+#endif
@@ -0,0 +1,71 @@
+#include "Mechanics.h"
+#include "Constants.h"
+
+// fewest samples worth fitting three parameters to
+static const unsigned MIN_SAMPLES = 10;
+
+// samples are taken at the flow PID's rate, so the fit weights the breath evenly
+static const unsigned long SAMPLE_PERIOD = SAMPLE_TIME;
+
+// fits whose regressors are this correlated (squared) are too ill-conditioned to solve
+static const float MAX_CORRELATION = 0.999;
+
+void Mechanics::begin() {
+  n_ = 0;
+  mq_ = mv_ = mp_ = 0;
+  cqq_ = cqv_ = cvv_ = cqp_ = cvp_ = 0;
+}
+
+void Mechanics::addSample(float pressure, float flow, float volume) {
+  unsigned long now = millis();
+  if (n_ > 0 && now - last_sample_ < SAMPLE_PERIOD) return;
+  last_sample_ = now;
+
+  float q = flow / 60.0;     // SLPM -> L/s
+  float v = volume / 1000.0; // cc -> L
+
+  n_++;
+  float dq = q - mq_;
+  float dv = v - mv_;
+  float dp = pressure - mp_;
+  mq_ += dq / n_;
+  mv_ += dv / n_;
+  mp_ += dp / n_;
+  cqq_ += dq * (q - mq_);
+  cqv_ += dq * (v - mv_);
+  cvv_ += dv * (v - mv_);
+  cqp_ += dq * (pressure - mp_);
+  cvp_ += dv * (pressure - mp_);
+}
+
+/**
+ * With the data centred, P0 drops out and the normal equations are 2x2:
+ *
+ *   | cqq cqv | |R|   |cqp|
+ *   | cqv cvv | |E| = |cvp|
+ *
+ * where E = 1/C is the elastance in cmH2O/L; then P0 = mp - R mq - E mv.
+ */
+bool Mechanics::finish() {
+  compliance_ = resistance_ = 0.0/0.0;
+  if (n_ < MIN_SAMPLES) return false;
+
+  // flow and volume are nearly collinear (e.g. a square flow wave with no ramp)
+  float scale = cqq_ * cvv_;
+  float det = scale - cqv_ * cqv_;
+  if (scale <= 0 || det <= (1 - MAX_CORRELATION) * scale) return false;
+
+  float r = (cqp_ * cvv_ - cvp_ * cqv_) / det;
+  float e = (cvp_ * cqq_ - cqp_ * cqv_) / det;
+  float p0 = mp_ - r * mq_ - e * mv_;
+
+  // a physiological lung has positive resistance and elastance
+  if (r <= 0 || e <= 0) return false;
+
+  resistance_ = r;
+  compliance_ = 1000.0 / e; // mL/cmH2O
+  offset_     = p0;
+  return true;
+}
+
+Mechanics mechanics;
@@ -0,0 +1,55 @@
+/**
+ * Mechanics.h
+ * Streaming least-squares estimate of respiratory mechanics during inspiration.
+ *
+ * Fits the single-compartment equation of motion
+ *
+ *    P = R * Q + V / C + P0
+ *
+ * over the inspiratory samples as they arrive, taken at the flow PID's rate.
+ * Only the running means and centred co-moments are kept (updated in
+ * Welford's manner), so memory and per-sample cost are constant and the
+ * float sums don't cancel the way raw sums of squares do.
+ */
+
+#ifndef Mechanics_h
+#define Mechanics_h
+
+#include "Arduino.h"
+
+class Mechanics {
+  public:
+    Mechanics() : compliance_(0.0/0.0), resistance_(0.0/0.0) { begin(); }
+
+    // clear the sums at the start of an inspiration
+    void begin();
+
+    /**
+     * Add one sample
+     * @param pressure -- airway pressure (cmH2O)
+     * @param flow -- inspiratory flow (SLPM)
+     * @param volume -- volume delivered so far this breath (cc)
+     */
+    void addSample(float pressure, float flow, float volume);
+
+    // solve for this breath; returns false if the fit is ill-conditioned or unphysiological,
+    // and the estimates are then unknown (NaN, shown as "--")
+    bool finish();
+
+    float compliance() const { return compliance_; } // mL/cmH2O (NaN until the first fit)
+    float resistance() const { return resistance_; } // cmH2O/(L/s)
+    float offset() const { return offset_; }         // P0, total PEEP seen by the fit (cmH2O)
+
+  private:
+    // running means of regressors q (L/s), v (L) and response p (cmH2O), and co-moments about them
+    unsigned n_;
+    float mq_, mv_, mp_;
+    float cqq_, cqv_, cvv_, cqp_, cvp_;
+    unsigned long last_sample_;
+
+    float compliance_, resistance_, offset_;
+};
+
+extern Mechanics mechanics;
+
+#endif
@@ -0,0 +1,87 @@
+#include "MemoryMonitor.h"
+#include "Constants.h"
+
+// section bounds from the avr-libc linker script (only their addresses matter)
+extern uint8_t __data_start, __data_end;
+extern uint8_t __bss_start, __bss_end;
+extern uint8_t __noinit_start, __noinit_end;
+extern uint8_t __heap_start;
+extern char *__brkval;  // top of the heap, 0 until the first malloc
+
+/**
+ * Paint from the start of the heap to the top of SRAM. Runs from .init3, like
+ * the watchdog disable in Supervisor.cpp, before the stack holds anything. The
+ * pointer is volatile so the loop can't be turned into a call to memset,
+ * whose return address would be painted over.
+ */
+void paintStack() __attribute__((naked, used, section(".init3")));
+void paintStack() {
+  for (volatile uint8_t *p = &__heap_start; p <= (uint8_t *)RAMEND; p++) {
+    *p = STACK_CANARY;
+  }
+}
+
+uint16_t MemoryMonitor::dataSize() {
+  return &__data_end - &__data_start;
+}
+
+uint16_t MemoryMonitor::bssSize() {
+  return &__bss_end - &__bss_start;
+}
+
+uint16_t MemoryMonitor::noinitSize() {
+  return &__noinit_end - &__noinit_start;
+}
+
+uint16_t MemoryMonitor::heapSize() const {
+  return __brkval ? (uint8_t *)__brkval - &__heap_start : 0;
+}
+
+uint16_t MemoryMonitor::stackSize() const {
+  return RAMEND - SP;
+}
+
+uint16_t MemoryMonitor::stackPeak() const {
+  uint16_t peak = (uint8_t *)(RAMEND + 1) - low_water_;
+  uint16_t now = stackSize();
+  return now > peak ? now : peak;
+}
+
+// everything below the highest heap break has been heap at some point
+uint8_t *MemoryMonitor::heapFloor() const {
+  return &__heap_start + heap_peak_;
+}
+
+uint16_t MemoryMonitor::headroom() const {
+  uint8_t *floor = heapFloor();
+  return low_water_ > floor ? low_water_ - floor : 0;
+}
+
+bool MemoryMonitor::low() const {
+  return scanned_ && headroom() < MEMORY_ALARM_HEADROOM;
+}
+
+void MemoryMonitor::update() {
+  uint16_t heap = heapSize();
+  if (heap > heap_peak_) {
+    heap_peak_ = heap;
+    Serial.print(F("memory: heap grew to "));
+    Serial.print(heap);
+    Serial.println(F(" bytes"));
+  }
+
+  // scan up from the heap; the first byte that lost its paint is the stack's low-water mark
+  uint8_t *floor = heapFloor();
+  if (scan_ < floor) scan_ = floor;
+  for (uint16_t i = 0; i < MEMORY_SCAN_BYTES; i++) {
+    if (scan_ >= low_water_ || *scan_ != STACK_CANARY) {
+      if (scan_ < low_water_) low_water_ = scan_;
+      scan_ = floor; // start the next pass
+      scanned_ = true;
+      return;
+    }
+    scan_++;
+  }
+}
+
+MemoryMonitor memoryMonitor;
@@ -0,0 +1,55 @@
+/**
+ * MemoryMonitor.h
+ * SRAM usage: static data, heap and the deepest the stack has ever reached.
+ *
+ * Everything between the end of the static data and the top of SRAM is
+ * painted with STACK_CANARY before the C runtime starts. The stack (including
+ * interrupt frames) overwrites the paint as it grows down and the heap as it
+ * grows up, so the paint left untouched between them is the headroom that
+ * has never been needed. `update` checks a few bytes of the painted region
+ * per loop, so it never costs a noticeable slice of the loop.
+ *
+ * The heap is tracked through avr-libc's break pointer: apart from the load
+ * benchmark's simulated circuits this firmware never allocates, so any growth
+ * comes from a library (e.g. the Nextion library's String commands) and is
+ * logged when it happens.
+ */
+
+#ifndef Memory_Monitor_h
+#define Memory_Monitor_h
+
+#include "Arduino.h"
+
+class MemoryMonitor {
+  public:
+    // call every loop
+    void update();
+
+    // static SRAM by section (bytes)
+    static uint16_t dataSize();    // initialised globals
+    static uint16_t bssSize();     // zeroed globals
+    static uint16_t noinitSize();  // kept across a watchdog reset
+
+    uint16_t heapSize() const;                     // current heap extent
+    uint16_t heapPeak() const { return heap_peak_; }
+    uint16_t stackSize() const;                    // stack in use now
+    uint16_t stackPeak() const;                    // deepest the stack has been
+
+    // bytes never touched by either the heap or the stack
+    uint16_t headroom() const;
+
+    // true once a full pass over the paint has found less than MEMORY_ALARM_HEADROOM
+    bool low() const;
+
+  private:
+    uint8_t *scan_      = 0;                        // next painted byte to check
+    uint8_t *low_water_ = (uint8_t *)(RAMEND + 1);  // lowest byte the stack has written
+    uint16_t heap_peak_ = 0;
+    bool     scanned_   = false;                    // a full pass has completed
+
+    uint8_t *heapFloor() const;
+};
+
+extern MemoryMonitor memoryMonitor;
+
+#endif
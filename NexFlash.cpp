@@ -0,0 +1,85 @@
+#include "NexFlash.h"
+#include "Constants.h"
+
+/**
+ * Drop any stale replies, as the library's sendCommand does, so the next
+ * reply read is the one for this command
+ */
+static void beginCommand() {
+  while (nexSerial.available()) {
+    nexSerial.read();
+  }
+}
+
+static void endCommand() {
+  nexSerial.write(0xFF);
+  nexSerial.write(0xFF);
+  nexSerial.write(0xFF);
+}
+
+void sendCommand(const __FlashStringHelper *cmd) {
+  beginCommand();
+  nexSerial.print(cmd);
+  endCommand();
+}
+
+template <class Text>
+bool FlashText::assign(Text text) {
+  beginCommand();
+  nexSerial.print(name_);
+  nexSerial.print(F(".txt=\""));
+  nexSerial.print(text);
+  nexSerial.print('"');
+  endCommand();
+  return recvRetCommandFinished(DISPLAY_ACK_TIMEOUT);
+}
+
+bool FlashText::setText(const char *text) {
+  return assign(text);
+}
+
+bool FlashText::setText(const __FlashStringHelper *text) {
+  return assign(text);
+}
+
+bool FlashText::setFixed(int32_t value, uint8_t decimals, uint8_t width) {
+  beginCommand();
+  nexSerial.print(name_);
+  nexSerial.print(F(".txt=\""));
+  printFixed(nexSerial, value, decimals, width);
+  nexSerial.print('"');
+  endCommand();
+  return recvRetCommandFinished(DISPLAY_ACK_TIMEOUT);
+}
+
+bool FlashText::setBackground(uint16_t color) {
+  beginCommand();
+  nexSerial.print(name_);
+  nexSerial.print(F(".bco="));
+  nexSerial.print(color);
+  endCommand();
+
+  beginCommand();
+  nexSerial.print(F("ref "));
+  nexSerial.print(name_);
+  endCommand();
+  return recvRetCommandFinished(DISPLAY_ACK_TIMEOUT);
+}
+
+uint16_t FlashText::getText(char *buffer, uint16_t len) {
+  beginCommand();
+  nexSerial.print(F("get "));
+  nexSerial.print(name_);
+  nexSerial.print(F(".txt"));
+  endCommand();
+  return recvRetString(buffer, len, DISPLAY_ACK_TIMEOUT);
+}
+
+bool FlashNumber::setValue(int32_t value) {
+  beginCommand();
+  nexSerial.print(name_);
+  nexSerial.print(F(".val="));
+  nexSerial.print(value);
+  endCommand();
+  return recvRetCommandFinished(DISPLAY_ACK_TIMEOUT);
+}
@@ -0,0 +1,68 @@
+/**
+ * NexFlash.h
+ * Nextion text fields and commands whose strings live in flash.
+ *
+ * The Nextion library keeps each object's name as a pointer into SRAM and
+ * builds every command in a heap String. FlashText takes its object name from
+ * PROGMEM and writes commands straight to the screen's serial port, accepting
+ * text from either SRAM or flash (`F("...")`), so constant UI text never has
+ * to be copied into the Mega's 8 KB of SRAM. Numbers are written as fixed
+ * point (see FixedPoint.h): formatted into a text field, or sent as the
+ * integer `.val` of a Number or Xfloat object.
+ *
+ * Each write or read waits at most DISPLAY_ACK_TIMEOUT for the screen's
+ * reply (the library waits 100 ms), so a screen that is slow to answer or not
+ * there at all holds up the loop for no longer than that. A late reply is
+ * dropped before the next command.
+ */
+
+#ifndef Nex_Flash_h
+#define Nex_Flash_h
+
+#include "Arduino.h"
+#include "Nextion.h"
+#include "FixedPoint.h"
+
+// send a command held in flash, e.g. sendCommand(F("vis 1,0"))
+void sendCommand(const __FlashStringHelper *cmd);
+
+class FlashText {
+  public:
+    // `name` is the object name on the screen, in PROGMEM
+    explicit FlashText(const char *name) : name_(reinterpret_cast<const __FlashStringHelper *>(name)) { }
+
+    bool setText(const char *text);
+    bool setText(const __FlashStringHelper *text);
+
+    // show a fixed-point value (a count of 10^-decimals) right-aligned in `width` characters
+    bool setFixed(int32_t value, uint8_t decimals, uint8_t width);
+
+    // set the background colour (RGB565) and redraw
+    bool setBackground(uint16_t color);
+
+    // read the text into `buffer`; returns its length
+    uint16_t getText(char *buffer, uint16_t len);
+
+  private:
+    const __FlashStringHelper *name_;
+
+    template <class Text> bool assign(Text text);
+};
+
+/**
+ * A Number or Xfloat object. An Xfloat shows its integer `.val` with the
+ * decimals set in the HMI (`vvs1`), so fixed-point values are sent as they
+ * are, in fewer bytes than as text.
+ */
+class FlashNumber {
+  public:
+    // `name` is the object name on the screen, in PROGMEM
+    explicit FlashNumber(const char *name) : name_(reinterpret_cast<const __FlashStringHelper *>(name)) { }
+
+    bool setValue(int32_t value);
+
+  private:
+    const __FlashStringHelper *name_;
+};
+
+#endif
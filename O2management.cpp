@@ -1,5 +1,6 @@
 #include "O2management.h"
 #include "Pressure.h"
+#include "Oxygen.h"
 #include "Valve.h"
 #include "AlarmManager.h"
 
@@ -9,26 +10,102 @@ static const float UPPER_PRESSURE_THRESHOLD = 1756.67; //cmH2O (25 psi)
 static const float LOWER_PRESSURE_THRESHOLD = 703.07;  //cmH2O (10 psi)
 static const float LOWER_PRESSURE_LIMIT     = 400;     //cmH2O
 
+static const float AIR_O2    = 21;  // % O2 in medical air
+static const float SUPPLY_O2 = 100; // % O2 in the oxygen supply
+
+// Blending state
+static bool  filling = false;              // reservoir is being refilled
+static unsigned long fillStart;            // start of the current refill (time-proportioning reference)
+static float o2Trim = 0;                   // closed-loop correction to the O2 fraction
+static unsigned long lastO2Sample = 0;     // time the last O2 sample was used
+
+// Reservoir drop prediction
+static float dropPerCc = RESERVOIR_DROP_PER_CC; // learned reservoir pressure drop per cc delivered
+static float nextBreathVolume = 0;              // volume the coming breath will draw (0 during inspiration)
+static float inspStartPressure;                 // reservoir pressure when inspiration began
+static bool  refilledDuringInsp = false;        // the drop can't be learned if we refilled mid-breath
+
+/**
+ * Each time the O2 sampling task publishes a sample, trim the O2 fraction so
+ * the measured FiO2 converges on the target. Implausible readings leave the
+ * trim alone.
+ */
+static void trimFromSensor(int O2target) {
+  if (!oxygenReader.available()) return;
+  unsigned long now = millis();
+  float dt = min((now - lastO2Sample) / 1000.0, 2.0 * O2_SAMPLE_PERIOD / 1000); // first sample has no interval
+  lastO2Sample = now;
+
+  float measured = oxygenReader.filtered();
+  if (measured < AIR_O2 - 5 || measured > SUPPLY_O2 + 5) return;
+
+  o2Trim += FIO2_TRIM_GAIN * (O2target - measured) * dt;
+  o2Trim = constrain(o2Trim, -FIO2_TRIM_LIMIT, FIO2_TRIM_LIMIT);
+}
+
+/**
+ * Open one valve and close the other, touching the pins only on a change
+ */
+template <class On, class Off>
+static void switchSupply(On &on, Off &off) {
+  if (off.get() != CLOSED) off.close();
+  if (on.get() != OPEN) on.open();
+}
+
+static void selectSupply(bool oxygen) {
+  if (oxygen) {
+    switchSupply(oxygenValve, airValve);
+  } else {
+    switchSupply(airValve, oxygenValve);
+  }
+}
 
 void o2Management(int O2target){
-  if(reservoirPressureReader.get() < LOWER_PRESSURE_LIMIT){
+  float pressure = reservoirPressureReader.get();
+  if(pressure < LOWER_PRESSURE_LIMIT){
     alarmMgr.activateAlarm(ALARM_INLET_GAS);
   }
-  if(reservoirPressureReader.get()<= LOWER_PRESSURE_THRESHOLD){
-    if (O2target == 21) {
-      airValve.open();
-    } else if (O2target == 60){
-      airValve.open();
-      oxygenValve.open();
-    } else if (O2target == 100){
-      oxygenValve.open();
-    } else {
-      airValve.open();
-    }
-  }
-  else if(reservoirPressureReader.get() >= UPPER_PRESSURE_THRESHOLD){
+
+  trimFromSensor(O2target);
+
+  // Start refilling before the coming breath if it would take us below the threshold:
+  // its drop is the learned drop per cc times its volume. The anticipation is capped so
+  // a refill always has room to run before the upper threshold.
+  float anticipated = min(dropPerCc * nextBreathVolume, (UPPER_PRESSURE_THRESHOLD - LOWER_PRESSURE_THRESHOLD) / 2);
+  float predicted = pressure - anticipated;
+  if (!filling && (pressure <= LOWER_PRESSURE_THRESHOLD || predicted <= LOWER_PRESSURE_THRESHOLD)) {
+    filling = true;
+    fillStart = millis();
+    refilledDuringInsp = true;
+  } else if (filling && pressure >= UPPER_PRESSURE_THRESHOLD) {
+    filling = false;
     airValve.close();
     oxygenValve.close();
   }
-  
+
+  if (filling) {
+    // Time-proportion the two supplies within each fill window: the O2 valve is
+    // open for the fraction of the window that gives the target mix, then air.
+    float fraction = (O2target - AIR_O2) / (SUPPLY_O2 - AIR_O2) + o2Trim;
+    fraction = constrain(fraction, 0.0, 1.0);
+    unsigned long phase = (millis() - fillStart) % FILL_WINDOW;
+    selectSupply(phase < fraction * FILL_WINDOW);
+  }
+}
+
+void o2PlanBreath(float volume) {
+  nextBreathVolume = volume;
+}
+
+void o2BeginInspiration() {
+  inspStartPressure = reservoirPressureReader.get();
+  refilledDuringInsp = filling;
+}
+
+void o2EndInspiration(float volume) {
+  if (refilledDuringInsp || volume <= 0) return;
+  float drop = (inspStartPressure - reservoirPressureReader.get()) / volume;
+  if (drop > 0) {
+    dropPerCc += (drop - dropPerCc) / 4;
+  }
 }
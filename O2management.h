@@ -2,8 +2,26 @@
 #define O2management_h
 
 /**
- * Run the O2 management state machine for the desired O2 concentration target
+ * Run the O2 blending controller for the desired O2 concentration target (21-100 %)
  */ 
 void o2Management(int O2target);
 
+/**
+ * Tell the blender the next breath will draw `volume` cc (0 while one is
+ * being delivered). Call before o2Management every loop, so a refill starts
+ * before the breath if it would pull the reservoir below the refill threshold.
+ */
+void o2PlanBreath(float volume);
+
+/**
+ * Tell the blender an inspiration is starting
+ */
+void o2BeginInspiration();
+
+/**
+ * Tell the blender the inspiration delivered `volume` cc, to learn how far
+ * the reservoir pressure drops per breath
+ */
+void o2EndInspiration(float volume);
+
 #endif
@@ -1,26 +1,76 @@
 #include "Oxygen.h"
+#include "Sampler.h"
+#include "FastPin.h"
 
 /**
- * Get oxygen concentration reading (may want to research a better approach)
+ * Run one step of the acquisition task
  */
-void Oxygen::read() {
-  // change analog pin reference voltage to 1.1V and discard first reading
-  analogReference(INTERNAL1V1);
-  analogRead(sensor_pin_);
+template <uint8_t Pin>
+void Oxygen<Pin>::update(bool mayStart) {
+  unsigned long now = millis();
+  switch (state_) {
+    case IDLE:
+      if (mayStart && now - last_sample_ >= O2_SAMPLE_PERIOD) {
+        // take the ADC from the sampler, then change analog pin reference voltage
+        // to 1.1V (takes effect on this discarded read)
+        sampler.suspend();
+        AnalogPin<Pin>::select(ADC_REF_1V1);
+        AnalogPin<Pin>::read();
+        last_sample_ = state_timer_ = now;
+        state_ = SETTLING;
+      }
+      break;
 
-  unsigned R = analogRead(sensor_pin_); // map linearly to concentration
+    case SETTLING:
+      if (now - state_timer_ >= O2_REFERENCE_SETTLE) {
+        sample();
 
-  const unsigned O2Max = 100;                      // max oxygen percentage
-  const unsigned Vref = 1100;                      // reference voltage (mv)
-  const unsigned sensorVMax = 60;                  // voltage range (0-60 mV) returned from sensor
-  const unsigned Rmax = 1023U * sensorVMax / Vref; // Max sensor reading (corresponding to 60mv)
+        // change analog pin reference voltage back to 5.0 V and discard a reading
+        AnalogPin<Pin>::select(ADC_REF_AVCC);
+        AnalogPin<Pin>::read();
+        state_timer_ = now;
+        state_ = RESTORING;
+      }
+      break;
 
-  concentration_ = R * O2Max / Rmax;  // Concentration in percent
+    case RESTORING:
+      if (now - state_timer_ >= O2_REFERENCE_SETTLE) {
+        sampler.resume();
+        state_ = IDLE;
+      }
+      break;
+  }
+}
+
+/**
+ * Average a batch of conversions and publish the concentration (fixed point, tenths of a percent)
+ */
+template <uint8_t Pin>
+void Oxygen<Pin>::sample() {
+  unsigned long sum = 0;
+  for (int i = 0; i < O2_BATCH_SIZE; i++) {
+    sum += AnalogPin<Pin>::read(); // map linearly to concentration
+  }
 
-  // change analog pin reference voltage back to 5.0 V and discard first reading again
-  analogReference(DEFAULT);
-  analogRead(sensor_pin_);
+  const unsigned long O2Max = 1000;                     // max oxygen percentage (tenths)
+  const unsigned long Vref = 1100;                      // reference voltage (mv)
+  const unsigned long sensorVMax = 60;                  // voltage range (0-60 mV) returned from sensor
+  const unsigned long Rmax = 1023UL * sensorVMax / Vref; // Max sensor reading (corresponding to 60mv)
+
+  concentration_ = sum * O2Max / (Rmax * O2_BATCH_SIZE); // Concentration in tenths of a percent
+
+  // Kept scaled so no fraction is lost each step: the filter settles on the true
+  // value from either side, rather than up to 2^shift - 1 counts low.
+  if (filtered_ < 0) {
+    filter_sum_ = (long)concentration_ << O2_FILTER_SHIFT;
+  } else {
+    filter_sum_ += concentration_ - (filter_sum_ >> O2_FILTER_SHIFT);
+  }
+  filtered_ = filter_sum_ >> O2_FILTER_SHIFT;
+  available_ = true;
 }
 
+template class Oxygen<O2_SENSOR>;
+
 // The oxygen reader
-Oxygen oxygenReader(O2_SENSOR);
+Oxygen<O2_SENSOR> oxygenReader;
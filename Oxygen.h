@@ -1,6 +1,16 @@
 /**
  * Oxygen.h
  * Calculates and stores the oxygen concentration value given to patient
+ *
+ * The O2 cell only produces 0-60 mV, so it is read against the internal 1.1 V
+ * reference. Switching the ADC reference disturbs every other analog channel
+ * until AREF settles, so sampling runs as a low-rate task: switch reference,
+ * wait, take a batch of conversions, switch back, wait again. While the task
+ * is away from the default reference the Sampler is suspended and `masking()`
+ * is true; the other sensors hold their last values.
+ *
+ * The pin is a template argument and the task drives the ADC registers
+ * directly with the channel and reference fixed at compile time.
  */
 
 #ifndef Oxygen_h
@@ -9,18 +19,51 @@
 #include "Arduino.h"
 #include "Constants.h"
 
+template <uint8_t Pin>
 class Oxygen {
   public:
-    Oxygen(int pin) : sensor_pin_(pin) { }
-    int get() const { return concentration_; }
-    void read();
+    Oxygen() : state_(IDLE), last_sample_(0),
+      concentration_(0), filtered_(-1), filter_sum_(0), available_(false) { }
+
+    // advance the acquisition task; call every loop, it never blocks on settling.
+    // A new sample is only started when `mayStart` (e.g. in expiration, before a trigger is armed).
+    void update(bool mayStart = true);
+
+    // true while the ADC reference is switched and other channels would read wrong
+    bool masking() const { return state_ != IDLE; }
+
+    // true once for each newly published sample
+    bool available() {
+      bool fresh = available_;
+      available_ = false;
+      return fresh;
+    }
+
+    int get() const { return concentration_ / 10; }
+
+    // low-pass filtered concentration in percent (NaN until the first sample)
+    float filtered() const { return filtered_ < 0 ? 0.0/0.0 : filtered_ / 10.0; }
 
   private:
-    int sensor_pin_;
-    int concentration_;
+    enum TaskState {
+      IDLE,      // default reference, waiting for the next sample period
+      SETTLING,  // switched to 1.1 V, waiting for AREF to settle
+      RESTORING  // switched back to default, waiting for AREF to settle
+    };
+
+    TaskState state_;
+    unsigned long state_timer_;  // time of the last reference switch
+    unsigned long last_sample_;  // time the last sample started
+
+    int  concentration_;  // latest concentration in tenths of a percent
+    int  filtered_;       // filtered concentration in tenths of a percent (-1 = none yet)
+    long filter_sum_;     // filter state, the filtered concentration scaled by 2^O2_FILTER_SHIFT
+    bool available_;
+
+    void sample();
 };
 
 // The oxygen reader
-extern Oxygen oxygenReader;
+extern Oxygen<O2_SENSOR> oxygenReader;
 
 #endif
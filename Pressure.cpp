@@ -1,50 +1,105 @@
 #include "Pressure.h"
 #include "Constants.h"
+#include "Sampler.h"
 
 /*
  * Initialize values
  */
-Pressure::Pressure(int pin) {
-  sensor_pin_ = pin;
+template <uint8_t Pin>
+Pressure<Pin>::Pressure() {
   current_ = 0.0;
-  current_peak_ = 0.0;
   peak_ = 0.0;
   plateau_ = 0.0;
   peep_ = 0.0;
 }
 
+// gauge sensor transfer function
+static const float mBarTocmH2O = 1.01972;
+
+static const float Pmin = -163.155 * mBarTocmH2O;   // pressure max in cmH2O
+static const float Pmax = 163.155 * mBarTocmH2O;    // pressure min in cmH2O
+static const float Prange = Pmax - Pmin;
+static const unsigned long Vsupply     = 5000;                    // voltage supplied, mv
+static const unsigned long sensorMin   = 1023UL * 500 / Vsupply;  // Sensor value at 500 mv
+static const unsigned long sensorMax   = 1023UL * 4500 / Vsupply; // Sensor value at 4500 mv
+static const unsigned long sensorRange = sensorMax - sensorMin;
+
+/**
+ * Convert a raw ADC reading (which may be an average) to gauge pressure
+ */
+template <uint8_t Pin>
+float Pressure<Pin>::toPressure(float R) {
+  return (R - sensorMin) * (Prange / sensorRange) + Pmin; //cmH2O
+}
+
+template <uint8_t Pin>
+uint16_t Pressure<Pin>::rawFor(float pressure) const {
+  float R = (pressure - Pmin) * (sensorRange / Prange) + sensorMin;
+  return constrain(R, 0, 1023);
+}
+
 /**
  * Get pressure reading
  */
-void Pressure::read() {
-  // read the voltage
-  int R = analogRead(sensor_pin_);
+template <uint8_t Pin>
+void Pressure<Pin>::read() {
+  current_ = toPressure(sampler.latest(Pin));
+}
+
+template <uint8_t Pin>
+void Pressure<Pin>::readReservoir(){
+  int V = sampler.latest(Pin);
+  float pressure = 70.307*100*(5.0*V/1023-0.25)/4.5;  // in cmH20 sensorRead(0.5-4.5 V) maps linearly to flow_read(+-1053.6 cmH2O)
+  current_ = pressure;
+}
 
-  static const float mBarTocmH2O = 1.01972;
+template <uint8_t Pin>
+void Pressure<Pin>::setPeakAndReset() {
+  peak_ = toPressure(sampler.peak(Pin));
+  sampler.resetPeak(Pin);
+}
 
-  static const float Pmin = -163.155 * mBarTocmH2O;   // pressure max in cmH2O
-  static const float Pmax = 163.155 * mBarTocmH2O;    // pressure min in cmH2O
-  static const float Prange = Pmax - Pmin;
-  const unsigned long Vsupply     = 5000;                    // voltage supplied, mv
-  const unsigned long sensorMin   = 1023UL * 500 / Vsupply;  // Sensor value at 500 mv
-  const unsigned long sensorMax   = 1023UL * 4500 / Vsupply; // Sensor value at 4500 mv
-  const unsigned long sensorRange = sensorMax - sensorMin;
+template <uint8_t Pin>
+bool Pressure<Pin>::healthy() const {
+  return !sampler.faulted(Pin);
+}
 
-  // convert to pressure
-  float pressure = (R - sensorMin) * (Prange / sensorRange) + Pmin; //cmH2O
+template <uint8_t Pin>
+void Pressure<Pin>::resetPeak() {
+  sampler.resetPeak(Pin);
+}
 
-  // update peak and reset
-  current_peak_ = max(current_peak_, pressure);
-  current_ = pressure;
+template <uint8_t Pin>
+float Pressure<Pin>::peakSoFar() const {
+  return toPressure(sampler.peak(Pin));
 }
 
-void Pressure::readReservoir(){
-  int V = analogRead(sensor_pin_);
-  float pressure = 70.307*100*(5.0*V/1023-0.25)/4.5;  // in cmH20 sensorRead(0.5-4.5 V) maps linearly to flow_read(+-1053.6 cmH2O)
-  current_ = pressure;
+template <uint8_t Pin>
+void Pressure<Pin>::beginWindow() {
+  sampler.beginWindow(Pin);
 }
 
+template <uint8_t Pin>
+float Pressure<Pin>::windowAverage() const {
+  float raw;
+  return sampler.windowMean(Pin, raw) ? toPressure(raw) : get();
+}
+
+template <uint8_t Pin>
+void Pressure<Pin>::setPlateau() {
+  plateau_ = windowAverage();
+}
+
+template <uint8_t Pin>
+void Pressure<Pin>::setPeep() {
+  peep_ = windowAverage();
+}
+
+template class Pressure<PRESSURE_INSP>;
+template class Pressure<PRESSURE_EXP>;
+template class Pressure<PRESSURE_RESERVOIR>;
+
 // Known pressure sensors
-Pressure inspPressureReader(PRESSURE_INSP);
-Pressure expPressureReader(PRESSURE_EXP);
-Pressure reservoirPressureReader(PRESSURE_RESERVOIR);
+Pressure<PRESSURE_INSP>      inspPressureReader;
+Pressure<PRESSURE_EXP>       expPressureReader;
+Pressure<PRESSURE_RESERVOIR> reservoirPressureReader;
@@ -1,32 +1,49 @@
 /**
  * Pressure.h
  * Calculates and stores the key pressure values of the breathing cycle.
+ *
+ * Readings come from the interrupt-driven Sampler, so the peak is the true
+ * peak of the full-rate sample stream and plateau/PEEP are averages over a
+ * window of samples rather than single loop-rate snapshots.
+ *
+ * The analog pin is a template argument; the sensors used are instantiated in
+ * Pressure.cpp.
  */
 
 #ifndef Pressure_h
 #define Pressure_h
 
 #include "Arduino.h"
+#include "Constants.h"
 
+template <uint8_t Pin>
 class Pressure {
 public:
-  Pressure(int pin);
+  Pressure();
 
   void read();
   void readReservoir();
 
-  void setPeakAndReset() {
-    peak_ = current_peak_;
-    current_peak_ = 0.0;
-  }
+  // latch the peak since the last call and start tracking a new one
+  void setPeakAndReset();
 
-  void setPlateau() {
-    plateau_ = get();
-  }
+  // start tracking a new peak without latching; `peakSoFar` is the running peak
+  void resetPeak();
+  float peakSoFar() const;
 
-  void setPeep() {
-    peep_ = get();
-  }
+  // start averaging samples for the plateau / PEEP measurement
+  void beginWindow();
+
+  // latch the window average as plateau / PEEP (falls back to the latest reading)
+  void setPlateau();
+  void setPeep();
+  void restorePeep(float peep) { peep_ = peep; } // e.g. after a watchdog reset
+
+  // false while the sensor health monitor has the sensor marked failed
+  bool healthy() const;
+
+  // raw ADC reading corresponding to `pressure` (for thresholds checked by the Sampler)
+  uint16_t rawFor(float pressure) const;
 
   // All pressures are in cmH2O
   float get() const { return current_; }
@@ -35,15 +52,16 @@ public:
   float peep() const { return peep_; }
 
 private:
-  int sensor_pin_;
   float current_;
-  float current_peak_;
   float peak_, plateau_, peep_;
+
+  static float toPressure(float raw);
+  float windowAverage() const;
 };
 
 // Known pressure sensors;
-extern Pressure inspPressureReader;
-extern Pressure expPressureReader;
-extern Pressure reservoirPressureReader;
+extern Pressure<PRESSURE_INSP>      inspPressureReader;
+extern Pressure<PRESSURE_EXP>       expPressureReader;
+extern Pressure<PRESSURE_RESERVOIR> reservoirPressureReader;
 
 #endif
@@ -0,0 +1,88 @@
+#include "PressureController.h"
+#include "Constants.h"
+#include "Pressure.h"
+#include "Sampler.h"
+#include "FastPin.h"
+#include <util/atomic.h>
+
+static void onInspPressure(uint16_t raw) {
+  pressureController.onSample(raw);
+}
+
+void PressureController::beginBreath(float start, float target, unsigned long riseTime) {
+  float rate = sampler.channelRate();
+  counts_per_cmH2O_ = (inspPressureReader.rawFor(40) - inspPressureReader.rawFor(0)) / 40.0;
+
+  // express the gains per raw count and, for the integral, per sample
+  kp_ = PS_KP / counts_per_cmH2O_ * 65536.0;
+  ki_ = PS_KI / counts_per_cmH2O_ / rate * 65536.0;
+
+  int32_t from = (int32_t)inspPressureReader.rawFor(start) << 16;
+  final_ = (int32_t)inspPressureReader.rawFor(target) << 16;
+  uint16_t samples = constrain(riseTime * rate / 1000, 1, 0xFFFF);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    target_ = from;
+    step_ = (final_ - from) / samples;
+    ramp_left_ = samples;
+    integral_ = (int32_t)OUTPUT_MIN << 16; // start from the valve's cracking opening
+    output_ = OUTPUT_MIN;
+    error_sum_ = 0;
+    error_count_ = 0;
+    active_ = true;
+  }
+  analogWrite(SV3_CONTROL, OUTPUT_MIN); // connects SV3 to its timer for the interrupt's PwmPin writes
+  sampler.attachHook(PRESSURE_INSP, onInspPressure);
+}
+
+void PressureController::endBreath() {
+  if (!active_) return;
+  sampler.detachHook();
+  active_ = false;
+  analogWrite(SV3_CONTROL, 0);
+
+  uint32_t sum;
+  uint16_t count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sum = error_sum_;
+    count = error_count_;
+  }
+  tracking_error_ = count == 0 ? 0.0/0.0 : sum / (float)count / counts_per_cmH2O_;
+}
+
+void PressureController::onSample(uint16_t raw) {
+  // a failed pressure sensor must not drive the valve; hold SV3 closed
+  if (!inspPressureReader.healthy()) {
+    if (output_ != 0) {
+      output_ = 0;
+      PwmPin<SV3_CONTROL>::write(0);
+    }
+    return;
+  }
+
+  if (ramp_left_ > 0) {
+    target_ += step_;
+    if (--ramp_left_ == 0) target_ = final_;
+  }
+
+  int32_t error = ((target_ + 0x8000) >> 16) - (int32_t)raw;
+
+  // clamp the integral to the output range so it can't wind up
+  int32_t integral = integral_ + ki_ * error;
+  integral = constrain(integral, 0, (int32_t)OUTPUT_MAX << 16);
+  integral_ = integral;
+
+  int32_t output = (integral + kp_ * error) >> 16;
+  output = constrain(output, 0, (int32_t)OUTPUT_MAX);
+  if (output != output_) {
+    output_ = output;
+    PwmPin<SV3_CONTROL>::write(output);
+  }
+
+  if (ramp_left_ == 0 && error_count_ < 0xFFFF) {
+    error_sum_ += error < 0 ? -error : error;
+    error_count_++;
+  }
+}
+
+PressureController pressureController;
@@ -0,0 +1,74 @@
+/**
+ * PressureController.h
+ * Inspiratory pressure control of SV3 for pressure support breaths.
+ *
+ * The loop runs from the Sampler interrupt on every new inspiratory pressure
+ * sample (~1.9 kHz), far faster than the flow PID, so the pressure rise is
+ * shaped by the controller rather than by the main loop period. The target
+ * ramps linearly from the starting pressure to the inspiratory pressure over
+ * the rise time, then holds. Everything in the interrupt is integer
+ * arithmetic on raw ADC counts (Q16 gains, no divisions) so each sample costs
+ * a fixed few microseconds.
+ *
+ * The interrupt writes each new opening straight to SV3's compare register
+ * (see PwmPin in FastPin.h), so the valve follows the pressure at the sample
+ * rate, whatever loop() is doing; analogWrite itself isn't interrupt-safe,
+ * so it is only used from loop() to connect the pin at the start of the
+ * breath and to close the valve at its end. Nothing else writes SV3 during a
+ * pressure support breath.
+ *
+ * While the O2 task has the Sampler suspended the valve holds its last
+ * opening.
+ */
+
+#ifndef Pressure_Controller_h
+#define Pressure_Controller_h
+
+#include "Arduino.h"
+
+class PressureController {
+  public:
+    /**
+     * Start controlling inspiratory pressure, ramping from `start` to `target`
+     * (cmH2O) over `riseTime` ms
+     */
+    void beginBreath(float start, float target, unsigned long riseTime);
+
+    // stop controlling and close SV3; latches the tracking error of the breath
+    void endBreath();
+
+    bool active() const { return active_; }
+
+    // true once the target has reached the inspiratory pressure
+    bool risen() const { return ramp_left_ == 0; }
+
+    // mean |target - pressure| after the rise, last breath (cmH2O, NaN if none)
+    float trackingError() const { return tracking_error_; }
+
+    // called from the ADC interrupt only
+    void onSample(uint16_t raw);
+
+  private:
+    volatile bool active_ = false;
+    float counts_per_cmH2O_ = 1;
+
+    // target in Q16 raw counts and its per-sample increment during the rise
+    volatile int32_t  target_ = 0;
+    int32_t           final_  = 0;
+    int32_t           step_   = 0;
+    volatile uint16_t ramp_left_ = 0;  // samples left in the rise
+
+    // PI terms in Q16 valve command per raw count
+    int32_t          kp_ = 0;
+    int32_t          ki_ = 0;
+    volatile int32_t integral_ = 0;
+    volatile uint8_t output_   = 0;
+
+    volatile uint32_t error_sum_   = 0;  // raw counts, after the rise
+    volatile uint16_t error_count_ = 0;
+    float tracking_error_ = 0.0/0.0;
+};
+
+extern PressureController pressureController;
+
+#endif
@@ -1,9 +1,17 @@
 #include "ProportionalValve.h"
 #include "PID_v1.h"
 #include "Flow.h"
+#include "Pressure.h"
+#include "Storage.h"
 
 unsigned long nextPID = 0;
 
+// gains as stored in EEPROM
+struct StoredGains {
+  float kp, ki, kd;
+};
+static const uint16_t GAINS_MAGIC = 0x6A01;
+
 /**
  * Set PID gains to tuned kp, ki, and kd values
  */
@@ -11,50 +19,118 @@ void ProportionalValve::setGains(double kp, double ki, double kd) {
   kp_ = kp;
   ki_ = ki;
   kd_ = kd;
+  controller.SetTunings(kp_, ki_, kd_);
+}
+
+/**
+ * Load per-unit gains saved by a validated auto-tune, if any (otherwise VKP/VKI/VKD stay),
+ * and the gain schedule if one has been saved
+ */
+void ProportionalValve::restoreGains() {
+  StoredGains gains;
+  if (loadBlock(EEPROM_PID_GAINS, GAINS_MAGIC, &gains, sizeof(gains))) {
+    setGains(gains.kp, gains.ki, gains.kd);
+  }
+  schedule_.load();
 }
 
 /**
- * Moves proportional valve given an increment in mm
+ * Moves proportional valve according to the PID output
  */
 void ProportionalValve::move() {
+  move(0);
+}
+
+/**
+ * Moves proportional valve according to the PID output plus a feed-forward correction
+ */
+void ProportionalValve::move(float correction) {
   pid_input_ = inspFlowReader.get();
-  controller.Compute();           // do a round of inspiratory PID computing
-  position_ = (int)pid_output_;   // move based on PID output 
+  bool computed = controller.Compute(); // do a round of inspiratory PID computing
+  position_ = constrain((int)(pid_output_ + correction), OUTPUT_MIN, OUTPUT_MAX); // move based on PID output 
   analogWrite(valve_pin_, position_); 
 
+  // remember the opening while flow is on target so the feed-forward table can learn it.
+  // This is the applied position, learned correction included: the PID output alone is
+  // biased by whatever the correction contributes, so it would not give the setpoint.
+  if (computed && fabs(pid_setpoint_ - pid_input_) <= FF_SETTLED_ERROR * pid_setpoint_) {
+    settled_output_sum_   += position_;
+    settled_pressure_sum_ += reservoirPressureReader.get();
+    settled_samples_++;
+  }
 }
 
 /**
  * Trigger inspiration by starting PID control
  */
 void ProportionalValve::beginBreath(float desiredSetpoint) {
+  // look up the opening expected to give the desired flow at the current reservoir pressure
+  start_position_ = feed_forward_.lookup(desiredSetpoint, reservoirPressureReader.get());
+
   //implement burst to unstick SV3
   position_ = burst_amplitude_;
   analogWrite(SV3_CONTROL, burst_amplitude_);    // set SV3 all the way open
   delay(burst_time_);                            // wait for 15 milliseconds
-  position_ = previousPosition;
-  analogWrite(SV3_CONTROL, previousPosition);    // open SV3 to desired opening (calculated based on previous breath's opening)
+  position_ = start_position_;
+  analogWrite(SV3_CONTROL, start_position_);     // open SV3 to the feed-forward opening
 
   // set setpoint to desired inspiratory flow rate set tidal volume / desired inspiratory time
   pid_setpoint_ = desiredSetpoint;
+
+  // Gains only change here, while the controller is in MANUAL, so the switch is
+  // bumpless. While auto-tuned gains are compared with the current ones both
+  // run as they are, without the schedule.
+  if (schedule_.active() && !comparing()) {
+    double kp = kp_, ki = ki_, kd = kd_;
+    schedule_.lookup(desiredSetpoint, kp, ki, kd);
+    controller.SetTunings(kp, ki, kd);
+  } else {
+    controller.SetTunings(kp_, ki_, kd_);
+  }
+
+  pid_output_ = start_position_;     // PID starts (bumpless) from the feed-forward opening
   controller.SetMode(AUTOMATIC);
   active_memory_ = used_memory_ = 0; //reset PID memory
+
+  // the learned flow profile only applies to the setpoint it was learned at
+  if (fabs(desiredSetpoint - learned_setpoint_) > ILC_RESET_FRACTION * desiredSetpoint) {
+    learning_.clear();
+    learned_setpoint_ = desiredSetpoint;
+  }
+  learning_.beginBreath();
 }
 
 /**
  * Compute PID output and continue moving the valve
  */
 void ProportionalValve::maintainBreath(unsigned long cycleTimer) {
-  if (millis() - cycleTimer < burst_wait_) {
+  unsigned long elapsed = millis() - cycleTimer;
+
+  // never let the PID or the learned profile act on a failed flow sensor
+  if (!inspFlowReader.healthy()) {
+    position_ = start_position_;
+    analogWrite(valve_pin_, position_); // hold the feed-forward opening
+    return;
+  }
+
+  // record this breath's flow error and look up the correction learned from previous breaths
+  learning_.record(elapsed, pid_setpoint_ - inspFlowReader.get());
+  float correction = learning_.correction(elapsed);
+
+  if (elapsed < burst_wait_) {
     // wait for initial burst to settle
-    position_ = previousPosition;
-    analogWrite(valve_pin_, position_); // move according to previous output
-  } else if (controller.GetMode() == MANUAL) {
-    // if the controller is turned off, turn it on and move the valve
-    controller.SetMode(AUTOMATIC);
-    move();
+    position_ = constrain((int)(start_position_ + correction), OUTPUT_MIN, OUTPUT_MAX);
+    analogWrite(valve_pin_, position_); // hold the feed-forward opening
   } else {
-    move();
+    if (controller.GetMode() == MANUAL) {
+      // if the controller is turned off, turn it on before moving the valve
+      controller.SetMode(AUTOMATIC);
+    }
+    move(correction);
+
+    // tracking error under the current gains, used to validate auto-tuned gains
+    tracking_error_sum_ += fabs(pid_setpoint_ - pid_input_) / pid_setpoint_;
+    tracking_samples_++;
   }
 
 }
@@ -63,18 +139,224 @@ void ProportionalValve::maintainBreath(unsigned long cycleTimer) {
  * Trigger expiration
  */
 void ProportionalValve::endBreath() {
-  previousPosition = pid_output_;  // save successfull position to begin with next loop
+  learnFeedForward(); // refine the table with this breath's steady-state opening
+  learning_.endBreath(); // fold this breath's flow error into the next breath's profile
+  trackBreath();
 
   // turn off insp PID computing and close valve
   controller.SetMode(MANUAL);    
   analogWrite(valve_pin_, 0);    
 }
 
+/**
+ * Open to the feed-forward table's opening for a small bias flow, between
+ * breaths (see Circuit::beginExpiration)
+ */
+void ProportionalValve::holdBias(float flow) {
+  position_ = feed_forward_.lookup(flow, reservoirPressureReader.get());
+  analogWrite(valve_pin_, position_);
+}
+
 void ProportionalValve::initializePID(double outputMin, double outputMax, int sampleTime){
   controller.SetOutputLimits(outputMin, outputMax);
   controller.SetSampleTime(sampleTime);
 }
 
+/**
+ * Load the feed-forward table saved by a previous characterisation or run.
+ * Without one the table starts flat at DEFAULT_VALVE_POSITION and is learned online.
+ */
+void ProportionalValve::restoreFeedForward() {
+  if (!feed_forward_.load()) {
+    feed_forward_.reset(DEFAULT_VALVE_POSITION);
+  }
+}
+
+/**
+ * Move the feed-forward table towards the average valve opening seen while the
+ * flow was settled on the setpoint. Breaths that never settled are ignored.
+ */
+void ProportionalValve::learnFeedForward() {
+  if (settled_samples_ >= FF_MIN_SETTLED_SAMPLES) {
+    int command = settled_output_sum_ / settled_samples_ + 0.5;
+    feed_forward_.learn(pid_setpoint_, settled_pressure_sum_ / settled_samples_, command, FF_LEARN_SHIFT);
+
+    // EEPROM endurance is limited, so only persist the learned table occasionally
+    if (++breaths_since_save_ >= FF_SAVE_INTERVAL) {
+      feed_forward_.save();
+      breaths_since_save_ = 0;
+    }
+  }
+
+  settled_output_sum_ = settled_pressure_sum_ = 0;
+  settled_samples_ = 0;
+}
+
+/**
+ * Start sweeping SV3 from OUTPUT_MIN to OUTPUT_MAX, recording the steady flow
+ * and reservoir pressure at each step. The expiratory valve must be open to
+ * a test lung or atmosphere.
+ */
+void ProportionalValve::beginCharacterisation() {
+  controller.SetMode(MANUAL);
+  feed_forward_.clearVisited();
+  characterising_ = true;
+  sweep_ = 0;
+  stepCharacterisation(OUTPUT_MIN);
+}
+
+/**
+ * Advance the characterisation sweep; call once per loop after reading sensors.
+ * Returns true when the sweep has finished and the table has been saved.
+ */
+bool ProportionalValve::maintainCharacterisation() {
+  if (!characterising_) return true;
+
+  unsigned long elapsed = millis() - step_timer_;
+  if (elapsed < FF_CHARACTERISE_SETTLE) {
+    return false; // let the flow settle after the step
+  } 
+  if (elapsed < FF_CHARACTERISE_SETTLE + FF_CHARACTERISE_AVERAGE) {
+    step_flow_sum_     += inspFlowReader.get();
+    step_pressure_sum_ += reservoirPressureReader.get();
+    step_samples_++;
+    return false;
+  }
+
+  if (step_samples_ > 0) {
+    feed_forward_.learn(step_flow_sum_ / step_samples_, step_pressure_sum_ / step_samples_, position_, 0);
+  }
+
+  int next = position_ + FF_CHARACTERISE_STEP;
+  if (next > OUTPUT_MAX) {
+    if (++sweep_ >= FF_CHARACTERISE_SWEEPS) {
+      stopCharacterisation();
+      feed_forward_.fillGaps();
+      feed_forward_.save();
+      return true;
+    }
+    next = OUTPUT_MIN;
+  }
+  stepCharacterisation(next);
+  return false;
+}
+
+/**
+ * Close the valve and leave characterisation (the table keeps whatever was learned)
+ */
+void ProportionalValve::stopCharacterisation() {
+  characterising_ = false;
+  position_ = 0;
+  analogWrite(valve_pin_, 0);
+}
+
+/**
+ * Start a relay-feedback experiment around AUTOTUNE_FLOW, centred on the
+ * feed-forward opening for that flow. The expiratory valve must be open.
+ * A comparison of earlier tuned gains still running is abandoned, and the
+ * gains it started from are put back.
+ */
+void ProportionalValve::beginAutoTune() {
+  if (comparing()) {
+    setGains(previous_kp_, previous_ki_, previous_kd_);
+    baseline_breaths_ = validating_breaths_ = 0;
+  }
+  controller.SetMode(MANUAL);
+  float bias = feed_forward_.lookup(AUTOTUNE_FLOW, reservoirPressureReader.get());
+  tuner_.begin(AUTOTUNE_FLOW, bias, AUTOTUNE_RELAY, AUTOTUNE_HYSTERESIS);
+}
+
+/**
+ * Advance the auto-tune experiment; call once per loop after reading sensors.
+ * Returns true when it has finished. Identified gains are compared with the
+ * current ones over the next breaths (see trackBreath) and only applied for
+ * good and saved if they track no worse.
+ */
+bool ProportionalValve::maintainAutoTune() {
+  if (!tuner_.running()) return true;
+
+  int command = tuner_.update(millis(), inspFlowReader.get());
+  if (tuner_.running()) {
+    position_ = constrain(command, 0, 255);
+    analogWrite(valve_pin_, position_);
+    return false;
+  }
+
+  stopAutoTune();
+  if (!tuner_.succeeded()) {
+    Serial.println(F("autotune: no oscillation measured, gains unchanged"));
+    return true;
+  }
+
+  Serial.print(F("autotune: Ku=")); Serial.print(tuner_.ultimateGain(), 3);
+  Serial.print(F(" Tu="));          Serial.print(tuner_.ultimatePeriod(), 3);
+  Serial.print(F(" kp="));          Serial.print(tuner_.kp(), 3);
+  Serial.print(F(" ki="));          Serial.println(tuner_.ki(), 3);
+
+  previous_kp_ = kp_;
+  previous_ki_ = ki_;
+  previous_kd_ = kd_;
+  tuned_kp_ = tuner_.kp();
+  tuned_ki_ = tuner_.ki();
+  tuned_kd_ = tuner_.kd();
+  validation_error_sum_ = 0;
+  baseline_breaths_ = AUTOTUNE_VALIDATE_BREATHS;
+  Serial.println(F("autotune: comparing with the current gains over the next breaths"));
+  return true;
+}
+
+void ProportionalValve::stopAutoTune() {
+  tuner_.cancel();
+  position_ = 0;
+  analogWrite(valve_pin_, 0);
+}
+
+/**
+ * Close out this breath's tracking error. After an auto-tune the current
+ * gains run AUTOTUNE_VALIDATE_BREATHS breaths for a baseline, then the tuned
+ * gains as many to be validated against it: both on the patient, at the
+ * settings of the moment, and both on fixed gains (the schedule is left out
+ * while comparing, see beginBreath), so like is compared with like.
+ */
+void ProportionalValve::trackBreath() {
+  if (tracking_samples_ == 0) return;
+  float error = tracking_error_sum_ / tracking_samples_;
+  tracking_error_sum_ = 0;
+  tracking_samples_ = 0;
+
+  if (baseline_breaths_ > 0) {
+    validation_error_sum_ += error;
+    if (--baseline_breaths_ == 0) {
+      baseline_error_ = validation_error_sum_ / AUTOTUNE_VALIDATE_BREATHS;
+      Serial.print(F("autotune: baseline error ")); Serial.println(baseline_error_, 3);
+      validation_error_sum_ = 0;
+      setGains(tuned_kp_, tuned_ki_, tuned_kd_); // from the next breath
+      validating_breaths_ = AUTOTUNE_VALIDATE_BREATHS;
+    }
+  } else if (validating_breaths_ > 0) {
+    validation_error_sum_ += error;
+    if (--validating_breaths_ == 0) {
+      float tuned = validation_error_sum_ / AUTOTUNE_VALIDATE_BREATHS;
+      if (tuned <= baseline_error_ * AUTOTUNE_MAX_DEGRADATION) {
+        StoredGains gains = { (float)kp_, (float)ki_, (float)kd_ };
+        saveBlock(EEPROM_PID_GAINS, GAINS_MAGIC, &gains, sizeof(gains));
+        Serial.println(F("autotune: gains validated and saved"));
+      } else {
+        setGains(previous_kp_, previous_ki_, previous_kd_);
+        Serial.println(F("autotune: gains rejected, previous gains restored"));
+      }
+    }
+  }
+}
+
+void ProportionalValve::stepCharacterisation(int command) {
+  position_ = command;
+  analogWrite(valve_pin_, position_);
+  step_timer_ = millis();
+  step_flow_sum_ = step_pressure_sum_ = 0;
+  step_samples_ = 0;
+}
+
 float ProportionalValve::integrateReadings() {
   // get most recent flow reading in insp line
   PIDMemory[(active_memory_+used_memory_)%memory_length_] = inspFlowReader.get(); 
@@ -9,6 +9,10 @@
 #include "Arduino.h"
 #include "Constants.h"
 #include "PID_v1.h"
+#include "FeedForward.h"
+#include "IterativeLearning.h"
+#include "AutoTune.h"
+#include "GainSchedule.h"
 
 class ProportionalValve {
 
@@ -19,11 +23,35 @@ class ProportionalValve {
     void  beginBreath(float desiredFlow);
     void  maintainBreath(unsigned long cycleTimer);
     void  endBreath();
+
+    // hold the valve (not under PID control) at the opening expected to give `flow`
+    void  holdBias(float flow);
     float integrateReadings();
     void  initializePID(double outputMin, double outputMax, int sampleTime);
-    int previousPosition = 0;   // position of valve at end of last breath (close to desired opening)(should be global)
+    void  restoreFeedForward();
+    void  restoreGains();
     double desiredSetpoint = 0;
 
+    // characterisation sweep used to populate the feed-forward table (ventilation must be off)
+    void beginCharacterisation();
+    bool maintainCharacterisation();
+    void stopCharacterisation();
+    bool characterising() const { return characterising_; }
+
+    // relay-feedback auto-tune of the PID gains (ventilation must be off)
+    void beginAutoTune();
+    bool maintainAutoTune();
+    void stopAutoTune();
+    bool autoTuning() const { return tuner_.running(); }
+
+    double kp() const { return kp_; }
+    double ki() const { return ki_; }
+    double kd() const { return kd_; }
+
+    // gains by flow setpoint; when active it overrides the fixed gains above.
+    // Changes take effect at the start of the next breath.
+    GainSchedule &schedule() { return schedule_; }
+
     int get() const { return position_; }
     int position() const { return position_; }
 
@@ -32,6 +60,7 @@ class ProportionalValve {
   private:
     int valve_pin_;
     int position_  = 0;     // physical position setting of the valve (0-255)
+    int start_position_ = DEFAULT_VALVE_POSITION; // feed-forward opening for the current breath
     double pid_setpoint_     = 10.0;  // default the setpoint to a lowish flowrate
     double pid_input_        = 0.0;
     double pid_output_       = 0.0;
@@ -46,9 +75,45 @@ class ProportionalValve {
     static const int memory_length_   = 4;     //length of PID output memory
     float PIDMemory[memory_length_];    //create an arrat of length memory_length_
 
+    // feed-forward table and the steady-state valve opening it learns from
+    FeedForward feed_forward_;
+    float    settled_output_sum_   = 0;
+    float    settled_pressure_sum_ = 0;
+    int      settled_samples_      = 0;
+    unsigned breaths_since_save_   = 0;
+
+    // breath-to-breath learned correction to the flow profile
+    IterativeLearning learning_;
+    double learned_setpoint_ = 0; // setpoint the learned profile belongs to
+
+    // characterisation sweep state
+    bool  characterising_ = false;
+    int   sweep_          = 0;
+    unsigned long step_timer_ = 0;
+    float step_flow_sum_      = 0;
+    float step_pressure_sum_  = 0;
+    int   step_samples_       = 0;
+
+    GainSchedule schedule_;
+
+    // auto-tune, and the comparison of the tuned gains with the current ones over the following breaths
+    AutoTune tuner_;
+    double previous_kp_, previous_ki_, previous_kd_; // restored if validation fails
+    double tuned_kp_, tuned_ki_, tuned_kd_;          // applied once the baseline is measured
+    float tracking_error_sum_   = 0;  // sum of |error| / setpoint after the burst, this breath
+    int   tracking_samples_     = 0;
+    float baseline_error_       = 0;  // mean tracking error of the current gains, before the tuned ones run
+    float validation_error_sum_ = 0;  // sum of per-breath errors, baseline or validation
+    int   baseline_breaths_     = 0;  // breaths left on the current gains before the tuned ones run
+    int   validating_breaths_   = 0;  // breaths left before tuned gains are kept or rejected
+
+    bool comparing() const { return baseline_breaths_ > 0 || validating_breaths_ > 0; }
 
     PID controller = PID(&pid_input_, &pid_output_, &pid_setpoint_, kp_, ki_, kd_, DIRECT);
     void move(float increment);
+    void learnFeedForward();
+    void trackBreath();
+    void stepCharacterisation(int command);
 };
 
 // Inspiration valve
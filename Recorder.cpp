@@ -0,0 +1,329 @@
+#include "Recorder.h"
+#include <SPI.h>
+
+static const uint8_t NAME_LENGTH = 13; // "REC00001.BIN" and its terminator
+
+// the sequence number in the first sector of a file not yet recorded into
+static const uint32_t RECORD_UNUSED = 0xFFFFFFFF;
+
+void Recorder::fileName(uint16_t number, char *name) {
+  snprintf_P(name, NAME_LENGTH, PSTR("REC%05u.BIN"), number);
+}
+
+// `name` as it is in a directory entry: "REC00001BIN"
+bool Recorder::parseName(const uint8_t *name, uint16_t &number) {
+  if (memcmp_P(name, PSTR("REC"), 3) != 0 || memcmp_P(name + 8, PSTR("BIN"), 3) != 0) {
+    return false;
+  }
+  uint32_t n = 0;
+  for (uint8_t i = 3; i < 8; i++) {
+    if (!isdigit(name[i])) return false;
+    n = n * 10 + (name[i] - '0');
+  }
+  if (n == 0 || n > 0xFFFF) return false;
+  number = n;
+  return true;
+}
+
+bool Recorder::managing() const {
+  if (phase_ < RECORDING_PHASE) return true;
+  return phase_ == RECORDING_PHASE && (next_number_ == 0 || next_number_ - oldest_ >= RECORD_MAX_FILES);
+}
+
+void Recorder::manage() {
+  switch (phase_) {
+    case MOUNT_PHASE:
+      mount();
+      break;
+
+    case SCAN_PHASE:
+      scan();
+      break;
+
+    case RECOVER_PHASE:
+      recover();
+      break;
+
+    case CREATE_PHASE:
+      // a file made ahead by the last boot is recorded into first
+      if (next_number_ != 0) {
+        file_number_ = next_number_;
+        file_block_ = next_block_;
+        next_number_ = 0;
+      } else if (file_number_ != 0xFFFF && create(file_number_ + 1, file_block_)) {
+        file_number_++;
+      } else {
+        stop(F("can't create a file, recording stopped"));
+        break;
+      }
+      file_sectors_ = 0;
+      startRecording();
+      break;
+
+    case RECORDING_PHASE:
+      if (waiting_) break; // the block cache holds a sector for the card
+      if (next_number_ == 0) {
+        if (file_number_ == 0xFFFF || !create(file_number_ + 1, next_block_)) {
+          stop(F("can't create a file, recording stopped"));
+        } else {
+          next_number_ = file_number_ + 1;
+        }
+      } else if (next_number_ - oldest_ >= RECORD_MAX_FILES) {
+        char name[NAME_LENGTH];
+        fileName(oldest_++, name);
+        SdFile::remove(&root_, name);
+      }
+      break;
+
+    case OFF_PHASE:
+      break;
+  }
+  // record() hands sectors off through the cache and mustn't have to flush it
+  if (phase_ == RECORDING_PHASE && !waiting_) volume_.cacheClear();
+}
+
+/**
+ * A card answers CMD0 at once; without one Sd2Card::init retries it for
+ * 2 s, so this quick look comes first
+ */
+bool Recorder::probe() {
+  const uint8_t cmd0[] = { 0x40, 0, 0, 0, 0, 0x95 };
+  pinMode(SD_CHIP_SELECT, OUTPUT);
+  digitalWrite(SD_CHIP_SELECT, HIGH);
+  SPI.begin();
+  SPI.beginTransaction(SPISettings(250000, MSBFIRST, SPI_MODE0));
+  for (uint8_t i = 0; i < 10; i++) SPI.transfer(0xFF); // the 74+ clocks a card needs after power-up
+  digitalWrite(SD_CHIP_SELECT, LOW);
+  for (uint8_t i = 0; i < sizeof(cmd0); i++) SPI.transfer(cmd0[i]);
+  uint8_t response = 0xFF;
+  for (uint8_t i = 0; i < 8 && response == 0xFF; i++) response = SPI.transfer(0xFF);
+  digitalWrite(SD_CHIP_SELECT, HIGH);
+  SPI.transfer(0xFF);
+  SPI.endTransaction();
+  return response != 0xFF;
+}
+
+void Recorder::mount() {
+  if (!probe() || !card_.init(SPI_FULL_SPEED, SD_CHIP_SELECT) || !volume_.init(&card_) || !root_.openRoot(&volume_)) {
+    stop(F("no SD card"));
+    return;
+  }
+  file_number_ = 0;
+  oldest_ = 0xFFFF;
+  phase_ = SCAN_PHASE;
+}
+
+/**
+ * Find the recordings already on the card, a directory block at a time
+ */
+void Recorder::scan() {
+  dir_t entry;
+  for (uint8_t i = 0; i < RECORD_SCAN_ENTRIES; i++) {
+    if (root_.readDir(&entry) <= 0) {
+      if (file_number_ == 0) oldest_ = 1;
+      phase_ = RECOVER_PHASE;
+      return;
+    }
+    uint16_t number;
+    if (DIR_IS_FILE(&entry) && parseName(entry.name, number)) {
+      if (number > file_number_) file_number_ = number;
+      if (number < oldest_) oldest_ = number;
+    }
+  }
+}
+
+/**
+ * Find where the recording in file `file_number_` ends, to carry on after
+ * it: the first sector whose sequence doesn't follow on from the file's
+ * first, by bisection. A file made ahead and never recorded into is kept as
+ * the next file and the one before it is looked at instead (on the next
+ * call).
+ */
+void Recorder::recover() {
+  if (file_number_ == 0) {
+    phase_ = CREATE_PHASE; // an empty card
+    return;
+  }
+
+  char name[NAME_LENGTH];
+  fileName(file_number_, name);
+  SdFile last;
+  uint32_t first = 0, end = 0;
+  bool contiguous = last.open(&root_, name, O_READ) && last.contiguousRange(&first, &end);
+  last.close();
+
+  SectorHeader header;
+  if (!contiguous || end - first + 1 != RECORD_FILE_SECTORS || !readHeader(first, header)) {
+    phase_ = CREATE_PHASE; // not a file this recorder made: start the next one
+    return;
+  }
+  if (header.sequence == RECORD_UNUSED) {
+    if (next_number_ == 0 && file_number_ > oldest_) {
+      next_number_ = file_number_;
+      next_block_ = first;
+      file_number_--;
+    } else {
+      file_block_ = first; // only unused files: record into this one
+      file_sectors_ = 0;
+      startRecording();
+    }
+    return;
+  }
+
+  uint32_t low = 1, high = RECORD_FILE_SECTORS;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    SectorHeader other;
+    if (readHeader(first + middle, other) && other.sequence == header.sequence + middle) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  sequence_ = header.sequence + low;
+  file_block_ = first;
+  file_sectors_ = low;
+  startRecording();
+}
+
+/**
+ * Create file `number` whole and contiguous, and mark its first sector
+ * unused so that whatever the card held there isn't taken for a recording.
+ * The mark is written through the volume's cache, as the sector may be
+ * filling.
+ */
+bool Recorder::create(uint16_t number, uint32_t &block) {
+  char name[NAME_LENGTH];
+  fileName(number, name);
+  SdFile file;
+  uint32_t end;
+  if (!file.createContiguous(&root_, name, RECORD_FILE_SECTORS * RECORD_SECTOR) || !file.contiguousRange(&block, &end)) {
+    file.close();
+    return false;
+  }
+
+  SectorHeader header;
+  header.sequence = RECORD_UNUSED;
+  header.time = millis();
+  header.dropped = 0;
+  uint8_t frame[TELEMETRY_FRAME_OVERHEAD + sizeof(SectorHeader)];
+  frame[0] = TELEMETRY_SYNC_1;
+  frame[1] = TELEMETRY_SYNC_2;
+  frame[2] = TELEMETRY_SECTOR;
+  frame[3] = sizeof(header);
+  memcpy(frame + 4, &header, sizeof(header));
+  frame[sizeof(frame) - 1] = Telemetry::crc(TELEMETRY_SECTOR, &header, sizeof(header));
+  bool marked = file.write(frame, sizeof(frame)) == sizeof(frame);
+  return file.close() && marked;
+}
+
+/**
+ * Read the SectorHeader at the start of card block `block`; false if there
+ * isn't a valid one. Only used before recording starts, so the sector is
+ * free to read into.
+ */
+bool Recorder::readHeader(uint32_t block, SectorHeader &header) {
+  uint8_t *sector = sector_;
+  if (!card_.readBlock(block, sector)) return false;
+  memcpy(&header, sector + 4, sizeof(header));
+  return sector[0] == TELEMETRY_SYNC_1 && sector[1] == TELEMETRY_SYNC_2 &&
+         sector[2] == TELEMETRY_SECTOR && sector[3] == sizeof(header) &&
+         sector[4 + sizeof(header)] == Telemetry::crc(TELEMETRY_SECTOR, &header, sizeof(header));
+}
+
+void Recorder::startRecording() {
+  phase_ = RECORDING_PHASE;
+  waiting_ = false;
+  startSector();
+}
+
+void Recorder::sample(float inspFlow, float expFlow, float inspPressure, float expPressure) {
+  if (phase_ != RECORDING_PHASE && !telemetry.enabled()) return;
+
+  unsigned long now = millis();
+  WaveSample &s = wave_.samples[wave_.count];
+  if (wave_.count == 0) {
+    wave_.time = now;
+    s.interval = 0;
+  } else {
+    s.interval = min(now - last_sample_, 255UL);
+  }
+  last_sample_ = now;
+  s.inspFlow = Telemetry::fixed(inspFlow, 10);
+  s.expFlow = Telemetry::fixed(expFlow, 10);
+  s.inspPressure = Telemetry::fixed(inspPressure, 10);
+  s.expPressure = Telemetry::fixed(expPressure, 10);
+
+  if (++wave_.count == TELEMETRY_WAVE_SAMPLES) {
+    record(TELEMETRY_WAVE, &wave_, sizeof(wave_));
+    telemetry.sendWave(wave_);
+    wave_.count = 0;
+  }
+}
+
+void Recorder::record(uint8_t type, const void *payload, uint8_t length) {
+  if (phase_ != RECORDING_PHASE) return;
+
+  if (used_ + TELEMETRY_FRAME_OVERHEAD + length > RECORD_SECTOR) {
+    if (waiting_) {
+      dropped_++; // the card hasn't taken the last sector yet
+      return;
+    }
+    memset(sector_ + used_, 0, RECORD_SECTOR - used_);
+    memcpy(volume_.cacheClear(), sector_, RECORD_SECTOR); // ~0.2 ms; manage left the cache clean
+    waiting_ = true;
+    startSector();
+  }
+  append(type, payload, length);
+}
+
+void Recorder::startSector() {
+  used_ = 0;
+  SectorHeader header;
+  header.sequence = sequence_++;
+  header.time = millis();
+  header.dropped = dropped_;
+  append(TELEMETRY_SECTOR, &header, sizeof(header));
+}
+
+void Recorder::append(uint8_t type, const void *payload, uint8_t length) {
+  uint8_t *frame = sector_ + used_;
+  frame[0] = TELEMETRY_SYNC_1;
+  frame[1] = TELEMETRY_SYNC_2;
+  frame[2] = type;
+  frame[3] = length;
+  memcpy(frame + 4, payload, length);
+  frame[4 + length] = Telemetry::crc(type, payload, length);
+  used_ += TELEMETRY_FRAME_OVERHEAD + length;
+}
+
+void Recorder::service() {
+  if (phase_ != RECORDING_PHASE || !waiting_ || card_.isBusy()) return;
+
+  if (file_sectors_ == RECORD_FILE_SECTORS) {
+    if (next_number_ == 0) return; // made in the next standby; frames are dropped until then
+    file_number_ = next_number_;
+    file_block_ = next_block_;
+    file_sectors_ = 0;
+    next_number_ = 0;
+  }
+
+  // returns once the card has the data, without waiting for it to be programmed
+  if (!card_.writeBlock(file_block_ + file_sectors_, volume_.cacheClear(), 0)) {
+    stop(F("card write failed, recording stopped"));
+    return;
+  }
+  waiting_ = false;
+  file_sectors_++;
+}
+
+/**
+ * Stop recording (no card, or it failed); ventilation is unaffected
+ */
+void Recorder::stop(const __FlashStringHelper *why) {
+  phase_ = OFF_PHASE;
+  Serial.print(F("recorder: "));
+  Serial.println(why);
+}
+
+Recorder recorder;
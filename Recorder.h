@@ -0,0 +1,132 @@
+/**
+ * Recorder.h
+ * Full-disclosure recording of the waveforms and breath summaries to an SD
+ * card, for QA and incident review.
+ *
+ * The recording is made of telemetry frames (see Telemetry.h): a WaveBlock
+ * every TELEMETRY_WAVE_SAMPLES control loops and a BreathSummary per breath.
+ * Frames are gathered into a 512-byte sector; once it is full it is copied
+ * into the SD library's block cache to wait for the card while the next one
+ * fills, so the library's buffer serves as the second one (SRAM is short: see
+ * the README). A frame never straddles two sectors (the end of a sector is
+ * zero-padded) and every sector starts with a SectorHeader, so any sector can
+ * be decoded on its own.
+ *
+ * Nothing the control loop does waits for the card:
+ *
+ *    service -- every loop: writes at most one sector, and only once the card
+ *               has finished programming the last one. The sector goes
+ *               straight to the card's block (the write returns as soon as
+ *               the card has taken the data), so this costs ~1 ms of SPI.
+ *    manage  -- one slow card operation: mounting the card and finding the
+ *               last recording, creating a file, removing the oldest. These
+ *               touch the FAT and can take a second or more, so they only
+ *               run during startup (before the watchdog is armed) and in
+ *               standby, with the watchdog stretched (see Supervisor.h).
+ *               They go through the block cache, so they wait while a sector
+ *               is in it, and leave it flushed.
+ *
+ * To need no FAT or directory update while ventilating, every file is
+ * created whole and contiguous (RECORD_FILE_SECTORS, with its full size in
+ * the directory) and sector n of it is written straight to its block n. The
+ * next file is created ahead of time (at startup, or in standby once the
+ * recording has moved into it), so the recording moves on
+ * to it without touching the FAT; if the current file fills before a
+ * standby has made the next one, frames are dropped and counted until then.
+ * If the card falls behind, whole frames are dropped and counted, never
+ * waited for.
+ *
+ * Files are REC00001.BIN, REC00002.BIN, ... in the card's root. Each sector
+ * header carries a sequence number that counts on across files and boots;
+ * a file's recording ends at the first sector whose sequence doesn't follow
+ * on from its first (the rest of the file is whatever the card held). A new
+ * file's first sector is marked unused when it is created. At boot the
+ * recording carries on after the last valid sector of the newest file, so a
+ * power loss only loses the sectors still in SRAM.
+ *
+ * After a watchdog reset the card is mounted again at the next standby;
+ * nothing is recorded until then.
+ */
+
+#ifndef Recorder_h
+#define Recorder_h
+
+#include "Arduino.h"
+#include "Constants.h"
+#include "Telemetry.h"
+#include <SD.h>
+
+class Recorder {
+  public:
+    // a card operation is waiting for `manage` (the card is being set up, or the next file or a removal is due)
+    bool managing() const;
+
+    // set up with the next file made, or there is no card (removing old files can wait for standby)
+    bool prepared() const { return phase_ == OFF_PHASE || (phase_ == RECORDING_PHASE && next_number_ != 0); }
+
+    bool active() const { return phase_ == RECORDING_PHASE; }
+
+    // add one control loop's readings; a full WaveBlock is recorded and sent as telemetry
+    void sample(float inspFlow, float expFlow, float inspPressure, float expPressure);
+
+    // add a frame (dropped if the sector is full and the last is still waiting for the card)
+    void record(uint8_t type, const void *payload, uint8_t length);
+
+    // call every loop: writes at most one sector, only if the card isn't busy
+    void service();
+
+    // does at most one slow card operation; only in standby or before the watchdog is armed
+    void manage();
+
+    uint16_t file() const { return file_number_; }
+    uint32_t sectors() const { return file_sectors_; }
+    uint16_t dropped() const { return dropped_; }
+
+  private:
+    enum Phase {
+      MOUNT_PHASE,      // find and initialise the card, open its root directory
+      SCAN_PHASE,       // find the oldest and newest recordings, RECORD_SCAN_ENTRIES entries at a time
+      RECOVER_PHASE,    // find where the newest recording ends
+      CREATE_PHASE,     // create the first file to record into
+      RECORDING_PHASE,  // recording; the next file and removals are made by `manage`
+      OFF_PHASE         // no card, or it failed
+    };
+
+    uint8_t  sector_[RECORD_SECTOR]; // the sector frames are added to
+    uint16_t used_ = 0;          // bytes of it used
+    bool     waiting_ = false;   // a full sector is in the volume's block cache, waiting for the card
+
+    Sd2Card  card_;
+    SdVolume volume_;
+    SdFile   root_;
+    Phase    phase_ = MOUNT_PHASE;
+
+    uint16_t file_number_ = 0;
+    uint32_t file_block_ = 0;    // the current file's first block on the card
+    uint32_t file_sectors_ = 0;  // sectors written to the current file
+    uint16_t next_number_ = 0;   // the file created ahead for the recording to move on to (0 for none)
+    uint32_t next_block_ = 0;
+    uint16_t oldest_ = 0;        // number of the oldest file on the card
+    uint32_t sequence_ = 0;      // sequence number of the next sector
+    uint16_t dropped_ = 0;
+
+    WaveBlock wave_;
+    unsigned long last_sample_ = 0;
+
+    static void fileName(uint16_t number, char *name);
+    static bool parseName(const uint8_t *name, uint16_t &number);
+    bool probe();
+    void mount();
+    void scan();
+    void recover();
+    bool create(uint16_t number, uint32_t &block);
+    bool readHeader(uint32_t block, SectorHeader &header);
+    void startRecording();
+    void startSector();
+    void append(uint8_t type, const void *payload, uint8_t length);
+    void stop(const __FlashStringHelper *why);
+};
+
+extern Recorder recorder;
+
+#endif
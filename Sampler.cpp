@@ -0,0 +1,265 @@
+#include "Sampler.h"
+#include "Constants.h"
+#include "FastPin.h"
+#include <util/atomic.h>
+
+static void clearStats(volatile ChannelStats &s) {
+  s.min = 0xFFFF;
+  s.max = 0;
+  s.sum = s.squares = 0;
+  s.rail = 0;
+  s.jumps = 0;
+}
+
+void Sampler::begin(const uint8_t *pins, uint8_t count) {
+  count_ = count;
+  if (count_ > max_channels_) count_ = max_channels_;
+  memset(slot_of_mux_, 0, sizeof(slot_of_mux_));
+  for (uint8_t i = 0; i < count_; i++) {
+    slot_of_mux_[(pins[i] - A0) & 0x0F] = i + 1;
+    channels_[i].mux = pins[i] - A0;
+    channels_[i].latest = channels_[i].peak = 0;
+    channels_[i].window_open = false;
+    clearStats(channels_[i].stats);
+    channels_[i].stats_count = 0;
+    channels_[i].rail_run = 0;
+    channels_[i].faulted = false;
+    channels_[i].completed_fresh = false;
+  }
+  resume();
+}
+
+void Sampler::suspend() {
+  suspended_ = true;
+  ADCSRA &= ~_BV(ADIE);
+  while (ADCSRA & _BV(ADSC)) { } // at most one conversion (~104 us)
+}
+
+void Sampler::resume() {
+  if (count_ == 0) return;
+  suspended_ = false;
+
+  // The blocking reads made while suspended leave ADIF set. Writing it clears it, so
+  // the interrupt first fires for this conversion, with current_ already pointing at it.
+  current_ = 0;
+  selectAdcChannel(channels_[0].mux, ADC_REF_AVCC);
+
+  // prescaler 128 (125 kHz ADC clock at 16 MHz), conversion-complete interrupt on
+  ADCSRA = _BV(ADEN) | _BV(ADIF) | _BV(ADSC) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+/**
+ * Select a channel against AVcc and start converting it
+ */
+void Sampler::start(uint8_t index) {
+  selectAdcChannel(channels_[index].mux, ADC_REF_AVCC);
+  ADCSRA |= _BV(ADSC);
+}
+
+void Sampler::onConversion(uint16_t raw) {
+  uint8_t done = current_;
+  volatile Channel &c = channels_[done];
+  uint16_t previous = c.latest;
+  c.latest = raw;
+  conversions_++;
+  if (raw > c.peak) c.peak = raw;
+  if (c.window_open && c.window_count < 0xFFFF) {
+    c.window_sum += raw;
+    c.window_count++;
+  }
+
+  updateHealth(c, previous, raw);
+
+  if (done == trigger_.slot && !trigger_.fired) {
+    bool beyond = trigger_.below ? raw < trigger_.threshold : raw > trigger_.threshold;
+    trigger_.count = beyond ? trigger_.count + 1 : 0;
+    if (trigger_.count >= trigger_.debounce) {
+      trigger_.fired = true;
+      trigger_.time = micros();
+    }
+  }
+
+  current_ = (current_ + 1) % count_;
+  if (!suspended_) {
+    start(current_);
+  }
+
+  // the next conversion is already running, so the hook doesn't slow sampling
+  if (done == hook_slot_) {
+    hook_(raw);
+  }
+}
+
+/**
+ * Incremental health statistics; faults are latched here so nothing has to
+ * wait for the window to complete
+ */
+void Sampler::updateHealth(volatile Channel &c, uint16_t previous, uint16_t raw) {
+  volatile ChannelStats &s = c.stats;
+  if (raw < s.min) s.min = raw;
+  if (raw > s.max) s.max = raw;
+  s.sum += raw;
+  s.squares += (uint32_t)raw * raw;
+
+  if (raw < HEALTH_RAIL_LOW || raw > HEALTH_RAIL_HIGH) {
+    s.rail++;
+    if (c.rail_run < 0xFF && ++c.rail_run >= HEALTH_RAIL_SAMPLES) c.faulted = true;
+  } else {
+    c.rail_run = 0;
+  }
+
+  // the first sample of a channel has no meaningful previous reading
+  uint16_t step = raw > previous ? raw - previous : previous - raw;
+  if (c.stats_count > 0 && step > HEALTH_MAX_STEP && s.jumps < 0xFF) {
+    if (++s.jumps > HEALTH_MAX_JUMPS) c.faulted = true;
+  }
+
+  if (++c.stats_count >= HEALTH_WINDOW) {
+    c.completed.min = s.min;
+    c.completed.max = s.max;
+    c.completed.sum = s.sum;
+    c.completed.squares = s.squares;
+    c.completed.rail = s.rail;
+    c.completed.jumps = s.jumps;
+    c.completed_fresh = true;
+    clearStats(s);
+    c.stats_count = 0;
+  }
+}
+
+uint16_t Sampler::latest(uint8_t pin) const {
+  int i = slot(pin);
+  if (i < 0) return 0;
+  uint16_t value;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { value = channels_[i].latest; }
+  return value;
+}
+
+uint16_t Sampler::peak(uint8_t pin) const {
+  int i = slot(pin);
+  if (i < 0) return 0;
+  uint16_t value;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { value = channels_[i].peak; }
+  return value;
+}
+
+void Sampler::resetPeak(uint8_t pin) {
+  int i = slot(pin);
+  if (i < 0) return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { channels_[i].peak = 0; }
+}
+
+void Sampler::beginWindow(uint8_t pin) {
+  int i = slot(pin);
+  if (i < 0) return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    channels_[i].window_sum = 0;
+    channels_[i].window_count = 0;
+    channels_[i].window_open = true;
+  }
+}
+
+bool Sampler::windowMean(uint8_t pin, float &mean) const {
+  int i = slot(pin);
+  if (i < 0) return false;
+  uint32_t sum;
+  uint16_t count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sum = channels_[i].window_sum;
+    count = channels_[i].window_count;
+  }
+  if (count == 0) return false;
+  mean = (float)sum / count;
+  return true;
+}
+
+uint16_t Sampler::windowCount(uint8_t pin) const {
+  int i = slot(pin);
+  if (i < 0) return 0;
+  uint16_t count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { count = channels_[i].window_count; }
+  return count;
+}
+
+void Sampler::armTrigger(uint8_t pin, uint16_t threshold, bool below, uint8_t debounce) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    trigger_.slot = slot(pin);
+    trigger_.threshold = threshold;
+    trigger_.below = below;
+    trigger_.debounce = debounce;
+    trigger_.count = 0;
+    trigger_.fired = false;
+  }
+}
+
+void Sampler::disarmTrigger() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    trigger_.slot = -1;
+    trigger_.fired = false;
+  }
+}
+
+unsigned long Sampler::triggerTime() const {
+  unsigned long time;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { time = trigger_.time; }
+  return time;
+}
+
+void Sampler::attachHook(uint8_t pin, void (*hook)(uint16_t raw)) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    hook_ = hook;
+    hook_slot_ = slot(pin);
+  }
+}
+
+void Sampler::detachHook() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    hook_slot_ = -1;
+    hook_ = 0;
+  }
+}
+
+bool Sampler::stats(uint8_t pin, ChannelStats &stats) {
+  int i = slot(pin);
+  if (i < 0) return false;
+  bool fresh;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    volatile Channel &c = channels_[i];
+    fresh = c.completed_fresh;
+    if (fresh) {
+      stats.min = c.completed.min;
+      stats.max = c.completed.max;
+      stats.sum = c.completed.sum;
+      stats.squares = c.completed.squares;
+      stats.rail = c.completed.rail;
+      stats.jumps = c.completed.jumps;
+      c.completed_fresh = false;
+    }
+  }
+  return fresh;
+}
+
+bool Sampler::faulted(uint8_t pin) const {
+  int i = slot(pin);
+  return i >= 0 && channels_[i].faulted; // single byte, no atomic block needed
+}
+
+void Sampler::setFault(uint8_t pin, bool faulted) {
+  int i = slot(pin);
+  if (i < 0) return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    channels_[i].faulted = faulted;
+    channels_[i].rail_run = 0;
+  }
+}
+
+float Sampler::channelRate() const {
+  // 13 ADC clocks per conversion at F_CPU / 128
+  return count_ == 0 ? 0 : F_CPU / 128.0 / 13 / count_;
+}
+
+ISR(ADC_vect) {
+  sampler.onConversion(ADC);
+}
+
+Sampler sampler;
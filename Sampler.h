@@ -0,0 +1,144 @@
+/**
+ * Sampler.h
+ * Interrupt-driven sampling of the flow and pressure channels.
+ *
+ * The ADC runs back to back from its conversion-complete interrupt, cycling
+ * through the attached channels (about 9.6k conversions/s shared between
+ * them), so every channel is sampled far faster than the main loop runs. The
+ * interrupt keeps the latest raw reading of each channel plus running
+ * statistics that need the full-rate stream (peak, windowed mean, sensor
+ * health), so the loop
+ * only ever reads results and never waits on a conversion.
+ *
+ * All values are raw 10-bit ADC counts; the sensor classes convert them.
+ */
+
+#ifndef Sampler_h
+#define Sampler_h
+
+#include "Arduino.h"
+
+// Raw-stream statistics of one channel over a health window (see SensorHealth.h)
+struct ChannelStats {
+  uint16_t min, max;
+  uint32_t sum, squares;  // of raw readings, over HEALTH_WINDOW samples
+  uint16_t rail;          // samples outside the sensor output band
+  uint8_t  jumps;         // sample-to-sample steps larger than HEALTH_MAX_STEP
+};
+
+class Sampler {
+  public:
+    // start sampling the given analog pins (at most max_channels_)
+    void begin(const uint8_t *pins, uint8_t count);
+
+    /**
+     * Stop after the conversion in progress and hand the ADC back to
+     * analogRead() (e.g. for the O2 sensor's reference switch). Channels keep
+     * their last values until `resume`.
+     */
+    void suspend();
+    void resume();
+    bool suspended() const { return suspended_; }
+
+    // latest raw reading of `pin`
+    uint16_t latest(uint8_t pin) const;
+
+    // highest raw reading since the last `resetPeak`
+    uint16_t peak(uint8_t pin) const;
+    void resetPeak(uint8_t pin);
+
+    // mean raw reading since `beginWindow` (false if no samples arrived yet)
+    void beginWindow(uint8_t pin);
+    bool windowMean(uint8_t pin, float &mean) const;
+    uint16_t windowCount(uint8_t pin) const;
+
+    /**
+     * Watch `pin` from the interrupt for `debounce` consecutive samples beyond
+     * `threshold` (below it if `below`, else above it). Once that happens
+     * `triggered` stays true, with the detection time, until re-armed.
+     */
+    void armTrigger(uint8_t pin, uint16_t threshold, bool below, uint8_t debounce);
+    void disarmTrigger();
+    bool triggered() const { return trigger_.fired; }
+    unsigned long triggerTime() const; // micros() at detection
+
+    /**
+     * Call `hook` from the interrupt with every new sample of `pin`, for control
+     * loops that must run at the full sample rate. One hook at a time; it must
+     * return well within a conversion (~100 us).
+     */
+    void attachHook(uint8_t pin, void (*hook)(uint16_t raw));
+    void detachHook();
+
+    // wraps; changes as long as the interrupt is converting
+    uint8_t conversions() const { return conversions_; }
+
+    // samples per second of each attached channel
+    float channelRate() const;
+
+    // statistics of the last completed health window of `pin`; true once per window
+    bool stats(uint8_t pin, ChannelStats &stats);
+
+    /**
+     * Set from the interrupt the moment a channel saturates or jumps
+     * implausibly, so control loops can stop trusting it within milliseconds.
+     * Stays set until cleared with `setFault` (which can also set it for
+     * faults found outside the interrupt).
+     */
+    bool faulted(uint8_t pin) const;
+    void setFault(uint8_t pin, bool faulted);
+
+    // called from the ADC interrupt only
+    void onConversion(uint16_t raw);
+
+  private:
+    static const uint8_t max_channels_ = 8;
+
+    struct Channel {
+      uint8_t  mux;           // ADC channel number (0-15)
+      uint16_t latest;
+      uint16_t peak;
+      bool     window_open;
+      uint32_t window_sum;
+      uint16_t window_count;
+
+      // health statistics of the window in progress and the last completed one
+      ChannelStats stats;
+      uint16_t     stats_count;
+      uint8_t      rail_run;   // consecutive out-of-band samples
+      bool         faulted;
+      ChannelStats completed;
+      bool         completed_fresh;
+    };
+
+    struct Trigger {
+      int8_t   slot;          // channel watched (-1 = disarmed)
+      uint16_t threshold;
+      bool     below;
+      uint8_t  debounce;
+      uint8_t  count;         // consecutive samples beyond the threshold
+      bool     fired;
+      unsigned long time;
+    };
+
+    volatile Channel channels_[max_channels_];
+    uint8_t slot_of_mux_[16] = { 0 };  // channel slot + 1 of each ADC channel (0 = not sampled)
+    volatile Trigger trigger_ = { -1, 0, false, 0, 0, false, 0 };
+    volatile int8_t hook_slot_ = -1;
+    void (* volatile hook_)(uint16_t raw) = 0;
+    uint8_t count_ = 0;
+    volatile uint8_t current_ = 0;
+    volatile uint8_t conversions_ = 0;
+    volatile bool suspended_ = true;
+
+    int8_t slot(uint8_t pin) const {
+      uint8_t mux = pin - A0;
+      return mux < 16 ? (int8_t)slot_of_mux_[mux] - 1 : -1;
+    }
+    void start(uint8_t index);
+    void updateHealth(volatile Channel &c, uint16_t previous, uint16_t raw);
+};
+
+extern Sampler sampler;
+
+#endif
@@ -0,0 +1,97 @@
+#include "SensorHealth.h"
+#include "Constants.h"
+#include "Sampler.h"
+#include "Oxygen.h"
+
+SensorHealth::SensorHealth() : oxygen_failed_(false) {
+  static const uint8_t pins[channel_count_] = { PRESSURE_RESERVOIR, PRESSURE_INSP, PRESSURE_EXP, FLOW_INSP, FLOW_EXP };
+  static const alarmCode alarms[channel_count_] = {
+    ALARM_P1SENSOR_FAIL, ALARM_P2SENSOR_FAIL, ALARM_P3SENSOR_FAIL, ALARM_F1SENSOR_FAIL, ALARM_F2SENSOR_FAIL
+  };
+  for (int i = 0; i < channel_count_; i++) {
+    channels_[i].pin = pins[i];
+    channels_[i].alarm = alarms[i];
+    channels_[i].fault = SENSOR_OK;
+    channels_[i].expect_windows = 0;
+    channels_[i].stuck = false;
+    channels_[i].clean_windows = 0;
+    channels_[i].variance = -1;
+    channels_[i].noise = 0;
+  }
+}
+
+void SensorHealth::update() {
+  for (int i = 0; i < channel_count_; i++) {
+    Channel &c = channels_[i];
+
+    // a fault latched by the interrupt is acted on without waiting for the window
+    if (c.fault == SENSOR_OK && sampler.faulted(c.pin)) {
+      fail(c, SENSOR_SATURATED);
+    }
+    evaluate(c);
+  }
+
+  float o2 = oxygenReader.filtered();
+  bool implausible = !isnan(o2) && (o2 < O2_MIN_PLAUSIBLE || o2 > O2_MAX_PLAUSIBLE);
+  if (implausible != oxygen_failed_) {
+    oxygen_failed_ = implausible;
+    if (implausible) {
+      alarmMgr.activateAlarm(ALARM_O2SENSOR_FAIL);
+    } else {
+      alarmMgr.deactivateAlarm(ALARM_O2SENSOR_FAIL);
+    }
+  }
+}
+
+void SensorHealth::expectChange(uint8_t pin) {
+  for (int i = 0; i < channel_count_; i++) {
+    if (channels_[i].pin == pin) channels_[i].expect_windows = HEALTH_STUCK_WINDOWS;
+  }
+}
+
+void SensorHealth::evaluate(Channel &c) {
+  ChannelStats s;
+  if (!sampler.stats(c.pin, s)) return;
+
+  // rolling noise floor
+  float mean = (float)s.sum / HEALTH_WINDOW;
+  float variance = max((float)s.squares / HEALTH_WINDOW - mean * mean, 0.0f);
+  c.variance = c.variance < 0 ? variance : c.variance + (variance - c.variance) * HEALTH_NOISE_WEIGHT;
+  c.noise = sqrt(c.variance);
+
+  // steady is only suspicious when something should have moved the channel
+  if (s.max != s.min) {
+    c.stuck = false;
+    c.expect_windows = 0;
+  } else if (c.expect_windows > 0 && --c.expect_windows == 0) {
+    c.stuck = true;
+  }
+
+  SensorFault fault = SENSOR_OK;
+  if (s.rail >= HEALTH_RAIL_SAMPLES) {
+    fault = SENSOR_SATURATED;
+  } else if (s.jumps > HEALTH_MAX_JUMPS) {
+    fault = SENSOR_IMPLAUSIBLE;
+  } else if (c.stuck) {
+    fault = SENSOR_STUCK;
+  }
+
+  if (fault != SENSOR_OK) {
+    c.clean_windows = 0;
+    if (c.fault == SENSOR_OK) fail(c, fault);
+    else c.fault = fault; // the window tells us more than the interrupt's latch did
+  } else if (c.fault != SENSOR_OK && ++c.clean_windows >= HEALTH_RECOVER_WINDOWS) {
+    c.fault = SENSOR_OK;
+    sampler.setFault(c.pin, false);
+    alarmMgr.deactivateAlarm(c.alarm);
+  }
+}
+
+void SensorHealth::fail(Channel &c, SensorFault fault) {
+  c.fault = fault;
+  c.clean_windows = 0;
+  sampler.setFault(c.pin, true); // control loops stop using the channel
+  alarmMgr.activateAlarm(c.alarm);
+}
+
+SensorHealth sensorHealth;
@@ -0,0 +1,81 @@
+/**
+ * SensorHealth.h
+ * Detects failed flow, pressure and O2 sensors and raises their alarms.
+ *
+ * The Sampler keeps fixed-size statistics of each channel's raw stream
+ * (min/max, sum and sum of squares, out-of-band samples, large
+ * sample-to-sample jumps) and latches a fault from the interrupt as soon as a
+ * channel saturates or jumps implausibly. This monitor reads the completed
+ * windows from the loop and decides:
+ *
+ *    saturated   -- the latched fault, or too many samples at the rails
+ *    implausible -- too many jumps no real signal could make
+ *    stuck       -- no single count of change in the HEALTH_STUCK_WINDOWS
+ *                   windows after an event that must move the channel
+ *
+ * A channel can be legitimately steady (zero flow in standby, expiratory
+ * pressure through a long PEEP hold), so it is only judged stuck once the
+ * loop has said it should move (expectChange(), at each breath phase
+ * change); it is trusted again when it is next seen to move.
+ *
+ * A failed channel is trusted again after HEALTH_RECOVER_WINDOWS clean
+ * windows. The rolling noise floor (variance of each window, filtered) is
+ * kept for diagnostics.
+ *
+ * The O2 cell is sampled too slowly for this, so it is only checked for a
+ * plausible concentration.
+ */
+
+#ifndef Sensor_Health_h
+#define Sensor_Health_h
+
+#include "Arduino.h"
+#include "AlarmManager.h"
+
+enum SensorFault {
+  SENSOR_OK,
+  SENSOR_SATURATED,
+  SENSOR_IMPLAUSIBLE,
+  SENSOR_STUCK
+};
+
+class SensorHealth {
+  public:
+    SensorHealth();
+
+    // evaluate new windows and raise/clear alarms; call every loop
+    void update();
+
+    // the channel on `pin` must change in the next HEALTH_STUCK_WINDOWS windows
+    void expectChange(uint8_t pin);
+
+    // for diagnostics
+    int channels() const { return channel_count_; }
+    uint8_t pin(int i) const { return channels_[i].pin; }
+    SensorFault fault(int i) const { return channels_[i].fault; }
+    float noise(int i) const { return channels_[i].noise; }  // raw counts, standard deviation
+    bool oxygenFailed() const { return oxygen_failed_; }
+
+  private:
+    static const int channel_count_ = 5;
+
+    struct Channel {
+      uint8_t     pin;
+      alarmCode   alarm;
+      SensorFault fault;
+      int         expect_windows; // windows left for an expected change to show
+      bool        stuck;
+      int         clean_windows;
+      float       variance;      // filtered variance of a window, raw counts^2
+      float       noise;
+    } channels_[channel_count_];
+
+    bool oxygen_failed_;
+
+    void evaluate(Channel &c);
+    void fail(Channel &c, SensorFault fault);
+};
+
+extern SensorHealth sensorHealth;
+
+#endif
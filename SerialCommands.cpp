@@ -0,0 +1,34 @@
+#include "SerialCommands.h"
+
+bool SerialCommands::listen() {
+  count_ = 0;
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == '\n' || c == '\r') {
+      if (length_ == 0) continue; // ignore blank lines and CR/LF pairs
+      line_[length_] = '\0';
+      length_ = 0;
+      tokenize();
+      return count_ > 0;
+    }
+    // overlong lines are truncated rather than overflowing the buffer
+    if (length_ < max_line_ - 1) {
+      line_[length_++] = c;
+    }
+  }
+  return false;
+}
+
+/**
+ * Split the line in place on spaces
+ */
+void SerialCommands::tokenize() {
+  count_ = 0;
+  char *token = strtok(line_, " \t");
+  while (token != NULL && count_ <= max_arguments_) {
+    tokens_[count_++] = token;
+    token = strtok(NULL, " \t");
+  }
+}
+
+SerialCommands serialCommands;
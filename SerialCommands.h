@@ -0,0 +1,49 @@
+/**
+ * SerialCommands.h
+ * Collects newline-terminated commands from the debug serial port without blocking.
+ *
+ * A command is a word followed by up to `max_arguments_` numeric arguments,
+ * separated by spaces, e.g. "characterise" or "gains 0.2 1.1 0".
+ */
+
+#ifndef SerialCommands_h
+#define SerialCommands_h
+
+#include "Arduino.h"
+
+class SerialCommands {
+  public:
+    SerialCommands() : length_(0), count_(0) { }
+
+    // read whatever is waiting on Serial; returns true once a full command is ready
+    bool listen();
+
+    // true if the ready command is `name` (in flash, e.g. `is(F("gains"))`)
+    bool is(const __FlashStringHelper *name) const { return count_ > 0 && matches(tokens_[0], name); }
+
+    // number of arguments after the command word, and their values
+    int arguments() const { return count_ > 0 ? count_ - 1 : 0; }
+    float argument(int index) const { return index < arguments() ? atof(tokens_[index + 1]) : 0.0; }
+
+    // true if argument `index` is the word `name`
+    bool argumentIs(int index, const __FlashStringHelper *name) const { return index < arguments() && matches(tokens_[index + 1], name); }
+
+  private:
+    static const int max_line_      = 64;
+    static const int max_arguments_ = 16;
+
+    char  line_[max_line_];
+    int   length_;
+    char *tokens_[max_arguments_ + 1];
+    int   count_;
+
+    void tokenize();
+
+    static bool matches(const char *token, const __FlashStringHelper *name) {
+      return strcmp_P(token, reinterpret_cast<const char *>(name)) == 0;
+    }
+};
+
+extern SerialCommands serialCommands;
+
+#endif
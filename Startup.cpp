@@ -0,0 +1,146 @@
+#include "Startup.h"
+#include "Constants.h"
+#include "Display.h"
+#include "Flow.h"
+#include "Pressure.h"
+#include "Valve.h"
+#include "Sampler.h"
+#include "AlarmManager.h"
+#include "Recorder.h"
+
+void Startup::update() {
+  unsigned long now = millis();
+  switch (stage_) {
+    case BEGIN_STAGE:
+      beginTasks();
+
+      // the Nextion handshake is the one step that has to block; the flow
+      // zero windows fill from the ADC interrupt meanwhile
+      display.init();
+      display.start();
+      display.showStartup(F("self-test"), 30);
+      finishTask(DISPLAY_TASK, F("display"));
+      break;
+
+    case TASKS_STAGE:
+      updateTasks(now);
+      break;
+
+    case DONE_STAGE:
+      break;
+  }
+}
+
+void Startup::resume() {
+  display.resume();
+  stage_ = DONE_STAGE;
+  ready_time_ = millis();
+}
+
+void Startup::acknowledge() {
+  if (!holdingStandby()) return;
+  acknowledged_ = true;
+  alarmMgr.deactivateAlarm(ALARM_SELFTEST_FAIL);
+  Serial.println(F("startup: self-test failure acknowledged"));
+}
+
+void Startup::beginTasks() {
+  stage_ = TASKS_STAGE;
+  stage_timer_ = millis();
+
+  // pressure self-test: nothing is flowing yet, so both airway sensors should read ~0
+  inspPressureReader.read();
+  expPressureReader.read();
+  if (fabs(inspPressureReader.get()) > SELFTEST_REST_PRESSURE) fail(F("inspiratory pressure at rest"));
+  if (fabs(expPressureReader.get()) > SELFTEST_REST_PRESSURE) fail(F("expiratory pressure at rest"));
+
+  // SV3 and SV4 closed: neither limb has any flow, so both zeros can be taken at once
+  analogWrite(SV3_CONTROL, 0);
+  expValve.close();
+  expFlowReader.beginCalibration();
+  inspFlowReader.beginCalibration();
+}
+
+void Startup::updateTasks(unsigned long now) {
+  if (!(done_tasks_ & EXP_ZERO_TASK) && now - stage_timer_ >= ZERO_STARTUP_WINDOW) {
+    expFlowReader.finishCalibration();
+    finishTask(EXP_ZERO_TASK, F("expiratory zero"));
+  }
+  if (!(done_tasks_ & INSP_ZERO_TASK) && now - stage_timer_ >= ZERO_STARTUP_WINDOW) {
+    inspFlowReader.finishCalibration();
+    finishTask(INSP_ZERO_TASK, F("inspiratory zero"));
+  }
+
+  // warm up SV3 by opening it to unstick it, watching the flow it produces;
+  // the pulse flows through both limbs' sensors, so it waits for the zeros
+  if (!warmup_started_ && (done_tasks_ & (EXP_ZERO_TASK | INSP_ZERO_TASK)) == (EXP_ZERO_TASK | INSP_ZERO_TASK)) {
+    warmup_started_ = true;
+    warmup_timer_ = now;
+    inspFlowReader.resetPeak();
+    analogWrite(SV3_CONTROL, 255);
+    display.showStartup(F("valve warm-up"), 60);
+  } else if (warmup_started_ && !(done_tasks_ & WARMUP_TASK) && now - warmup_timer_ >= STARTUP_WARMUP) {
+    analogWrite(SV3_CONTROL, 0);
+    reservoirPressureReader.readReservoir();
+    if (reservoirPressureReader.get() >= SELFTEST_MIN_RESERVOIR && inspFlowReader.peak() < SELFTEST_PULSE_FLOW) {
+      fail(F("no flow through SV3"));
+    }
+    finishTask(WARMUP_TASK, F("valve warm-up"));
+  }
+
+  // the card's set-up blocks, so it keeps out of the way of the timed pulse
+  bool pulsing = warmup_started_ && !(done_tasks_ & WARMUP_TASK);
+  if (!(done_tasks_ & RECORDER_TASK) && !pulsing) {
+    recorder.manage();
+    if (recorder.prepared()) finishTask(RECORDER_TASK, F("SD card"));
+  }
+
+  if (done_tasks_ == ALL_TASKS) {
+    if (sampler.faulted(PRESSURE_RESERVOIR) || sampler.faulted(PRESSURE_INSP) || sampler.faulted(PRESSURE_EXP)) {
+      fail(F("pressure sensor out of range"));
+    }
+    if (sampler.faulted(FLOW_INSP) || sampler.faulted(FLOW_EXP)) fail(F("flow sensor out of range"));
+
+    logStage(F("tasks"), now);
+    stage_ = DONE_STAGE;
+    ready_time_ = now;
+    display.finishStartup(passed());
+
+    // the operator has to see the failure before the ventilator can be run
+    if (!passed()) {
+      display.setTurnedOff(true);
+      alarmMgr.activateAlarm(ALARM_SELFTEST_FAIL);
+    }
+
+    Serial.print(F("startup: "));
+    Serial.print(passed() ? F("self-test passed") : F("self-test FAILED, in standby until acknowledged"));
+    Serial.print(F(", ready at "));
+    Serial.print(ready_time_);
+    Serial.println(F(" ms"));
+  }
+}
+
+void Startup::finishTask(Task task, const __FlashStringHelper *name) {
+  done_tasks_ |= task;
+  Serial.print(F("startup: "));
+  Serial.print(name);
+  Serial.print(F(" done at +"));
+  Serial.print(millis() - stage_timer_);
+  Serial.println(F(" ms"));
+}
+
+void Startup::fail(const __FlashStringHelper *what) {
+  failures_++;
+  Serial.print(F("startup: self-test failed: "));
+  Serial.println(what);
+}
+
+void Startup::logStage(const __FlashStringHelper *name, unsigned long now) {
+  Serial.print(F("startup: "));
+  Serial.print(name);
+  Serial.print(F(" stage took "));
+  Serial.print(now - stage_timer_);
+  Serial.println(F(" ms"));
+}
+
+Startup startup;
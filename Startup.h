@@ -0,0 +1,89 @@
+/**
+ * Startup.h
+ * Staged, non-blocking power-up sequence.
+ *
+ *    TASKS    -- run concurrently, driven from the loop:
+ *                  - pressure self-test: insp/exp pressure near 0 at rest
+ *                  - flow zeros of both limbs, with SV3 and SV4 closed; the
+ *                    ADC interrupt fills their windows while the display
+ *                    task blocks
+ *                  - Nextion handshake and startup banner
+ *                  - SV3 warm-up pulse (STARTUP_WARMUP), once the zeros are
+ *                    taken, which doubles as the valve self-test: it must
+ *                    produce flow if the reservoir is charged
+ *                  - SD card set-up (Recorder::manage), a step per loop
+ *                    except while the pulse is timed; its slow steps are
+ *                    done here, before the watchdog is armed
+ *    DONE     -- ventilation can start
+ *
+ * A failed self-test raises ALARM_SELFTEST_FAIL and keeps the ventilator in
+ * standby until the operator acknowledges it (the alarm silence button, or
+ * `ack` on the debug port).
+ *
+ * Each task's completion and the time to ready are logged on the debug port
+ * so the time to first breath can be measured.
+ */
+
+#ifndef Startup_h
+#define Startup_h
+
+#include "Arduino.h"
+
+class Startup {
+  public:
+    Startup() : stage_(BEGIN_STAGE), ready_time_(0) { }
+
+    // advance the sequence; call every loop until `done`
+    void update();
+
+    // skip the sequence after a watchdog reset: the screen, valves and flow
+    // zeros are already set up (the zeros come back from the snapshot)
+    void resume();
+    bool done() const { return stage_ == DONE_STAGE; }
+
+    // millis() at which ventilation could start
+    unsigned long readyTime() const { return ready_time_; }
+
+    // self-test outcome (valid once done)
+    bool passed() const { return failures_ == 0; }
+
+    // a failed self-test holds the ventilator in standby until acknowledged
+    bool holdingStandby() const { return failures_ != 0 && !acknowledged_; }
+    void acknowledge();
+
+  private:
+    enum Stage {
+      BEGIN_STAGE,
+      TASKS_STAGE,
+      DONE_STAGE
+    };
+
+    // concurrent tasks
+    enum Task {
+      DISPLAY_TASK   = 0x01,
+      EXP_ZERO_TASK  = 0x02,
+      INSP_ZERO_TASK = 0x04,
+      WARMUP_TASK    = 0x08,
+      RECORDER_TASK  = 0x10,
+      ALL_TASKS      = 0x1F
+    };
+
+    Stage stage_;
+    unsigned long stage_timer_;   // start of the tasks
+    unsigned long ready_time_;
+    uint8_t done_tasks_ = 0;
+    bool warmup_started_ = false;
+    unsigned long warmup_timer_ = 0;
+    uint8_t failures_ = 0;
+    bool acknowledged_ = false;
+
+    void beginTasks();
+    void updateTasks(unsigned long now);
+    void finishTask(Task task, const __FlashStringHelper *name);
+    void fail(const __FlashStringHelper *what);
+    void logStage(const __FlashStringHelper *name, unsigned long now);
+};
+
+extern Startup startup;
+
+#endif
@@ -0,0 +1,46 @@
+#include "Storage.h"
+#include <EEPROM.h>
+
+uint8_t crc8Update(uint8_t crc, uint8_t in) {
+  for (int i = 0; i < 8; i++) {
+    uint8_t mix = (crc ^ in) & 0x01;
+    crc >>= 1;
+    if (mix) crc ^= 0x8C;
+    in >>= 1;
+  }
+  return crc;
+}
+
+bool loadBlock(int address, uint16_t magic, void *data, size_t length) {
+  uint16_t storedMagic = EEPROM.read(address) | (EEPROM.read(address + 1) << 8);
+  if (storedMagic != magic) {
+    return false;
+  }
+
+  // verify before copying so a corrupt block leaves the defaults in place
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++) {
+    crc = crc8Update(crc, EEPROM.read(address + STORAGE_HEADER_SIZE + i));
+  }
+  if (crc != EEPROM.read(address + 2)) {
+    return false;
+  }
+
+  uint8_t *bytes = (uint8_t *)data;
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] = EEPROM.read(address + STORAGE_HEADER_SIZE + i);
+  }
+  return true;
+}
+
+void saveBlock(int address, uint16_t magic, const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++) {
+    crc = crc8Update(crc, bytes[i]);
+    EEPROM.update(address + STORAGE_HEADER_SIZE + i, bytes[i]);
+  }
+  EEPROM.update(address, lowByte(magic));
+  EEPROM.update(address + 1, highByte(magic));
+  EEPROM.update(address + 2, crc);
+}
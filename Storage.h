@@ -0,0 +1,40 @@
+/**
+ * Storage.h
+ * Reads and writes checked blocks of persistent data in EEPROM.
+ *
+ * Each block is stored as a 2-byte magic number, a CRC-8 of the payload and
+ * then the payload itself, so a blank or stale EEPROM is never mistaken for
+ * calibration data. Bump a block's magic number whenever its layout changes.
+ */
+
+#ifndef Storage_h
+#define Storage_h
+
+#include "Arduino.h"
+
+// Size of the header written in front of every block
+const int STORAGE_HEADER_SIZE = 3;
+
+/**
+ * Copy a block from EEPROM into `data`
+ *
+ * @param address -- EEPROM address of the block header
+ * @param magic -- expected magic number for this block
+ * @param data -- destination, left untouched if the block is missing or corrupt
+ * @param length -- payload size in bytes
+ * @return true if a valid block was found and loaded
+ */
+bool loadBlock(int address, uint16_t magic, void *data, size_t length);
+
+/**
+ * Write `data` to EEPROM as a block. Only bytes that changed are rewritten.
+ */
+void saveBlock(int address, uint16_t magic, const void *data, size_t length);
+
+/**
+ * Fold one byte into a running Dallas/Maxim CRC-8 (start from 0).
+ * Also used to check telemetry frames.
+ */
+uint8_t crc8Update(uint8_t crc, uint8_t in);
+
+#endif
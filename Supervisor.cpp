@@ -0,0 +1,176 @@
+#include "Supervisor.h"
+#include "Storage.h"
+#include "Sampler.h"
+#include "AlarmManager.h"
+#include <avr/wdt.h>
+#include <stddef.h>
+
+static const uint16_t SNAPSHOT_MAGIC = 0x5A03;
+
+// survives a watchdog reset; validated by magic and CRC
+struct StoredSnapshot {
+  uint16_t magic;
+  uint8_t  crc;
+  uint16_t resets;
+  uint16_t counted;                               // resets that count towards resettingRepeatedly
+  unsigned long clock;                            // ms run since power-up, up to this boot
+  unsigned long resetClocks[WATCHDOG_MAX_RESETS]; // `clock` at the latest resets, newest first
+  unsigned long savedAt;                          // millis() when `data` was saved
+  Snapshot data;
+};
+static StoredSnapshot stored __attribute__((section(".noinit")));
+static uint8_t resetFlags __attribute__((section(".noinit")));
+
+// millis() at the last watchdog feed; written every loop, so kept out of the CRC
+static unsigned long lastFeed __attribute__((section(".noinit")));
+
+// the checks that were failing at the last update (see Supervisor::late), so
+// a reset can be put down to what starved the watchdog; also out of the CRC
+static uint8_t lateChecks __attribute__((section(".noinit")));
+
+/**
+ * After a watchdog reset the watchdog stays enabled at its shortest period,
+ * so it has to be turned off before the C runtime and setup() get a chance
+ * to run into it
+ */
+void disableWatchdogEarly() __attribute__((naked, used, section(".init3")));
+void disableWatchdogEarly() {
+  resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+// over everything after the CRC
+static uint8_t snapshotCrc() {
+  const uint8_t *bytes = (const uint8_t *)&stored.resets;
+  uint8_t crc = 0;
+  for (size_t i = 0; i < sizeof(stored) - offsetof(StoredSnapshot, resets); i++) {
+    crc = crc8Update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+void Supervisor::begin() {
+  bool valid = stored.magic == SNAPSHOT_MAGIC && stored.crc == snapshotCrc();
+  warm_ = (resetFlags & _BV(WDRF)) && valid;
+  if (warm_) {
+    // the last boot ran until a watchdog period after its last feed
+    unsigned long ran = max(lastFeed, stored.savedAt) + WATCHDOG_PERIOD;
+    since_snapshot_ = ran - stored.savedAt;
+    stored.clock += ran;
+    stored.resets++;
+
+    // a screen that stopped answering doesn't stop ventilation, so it is no
+    // reason to stay in standby: only other resets count towards that
+    if (lateChecks != _BV(DISPLAY_TASK)) {
+      for (int i = WATCHDOG_MAX_RESETS - 1; i > 0; i--) {
+        stored.resetClocks[i] = stored.resetClocks[i - 1];
+      }
+      stored.resetClocks[0] = stored.clock;
+      stored.counted++;
+    }
+    repeated_ = stored.counted >= WATCHDOG_MAX_RESETS &&
+                stored.clock - stored.resetClocks[WATCHDOG_MAX_RESETS - 1] <= WATCHDOG_RESET_WINDOW;
+  } else {
+    stored.resets = stored.counted = 0;
+    stored.clock = 0;
+    stored.magic = 0; // nothing to resume until the first save
+  }
+  stored.crc = snapshotCrc();
+  lastFeed = 0;
+  lateChecks = 0;
+
+  for (int i = 0; i < SUPERVISED_TASKS; i++) {
+    beats_[i] = millis();
+  }
+  last_loop_ = sampler_beat_ = millis();
+}
+
+const Snapshot &Supervisor::snapshot() const {
+  return stored.data;
+}
+
+uint16_t Supervisor::resets() const {
+  return stored.resets;
+}
+
+void Supervisor::acknowledge() {
+  if (!alarmMgr.alarmStatus(ALARM_WATCHDOG_RESET)) return;
+  acknowledged_ = true;
+  alarmMgr.deactivateAlarm(ALARM_WATCHDOG_RESET);
+  Serial.println(F("watchdog: reset acknowledged"));
+}
+
+void Supervisor::arm() {
+  unsigned long now = millis();
+  for (int i = 0; i < SUPERVISED_TASKS; i++) {
+    beats_[i] = now;
+  }
+  sampler_beat_ = last_loop_ = now;
+  wdt_enable(WDTO_250MS);
+  armed_ = true;
+}
+
+/**
+ * The longest a step may take is the card's 2 s initialisation timeout, so
+ * the watchdog is set to twice that; it is back to WDTO_250MS after the step
+ */
+void Supervisor::beginLongStep() {
+  if (!armed_) return;
+  wdt_enable(WDTO_4S);
+}
+
+void Supervisor::endLongStep() {
+  if (!armed_) return;
+  unsigned long now = millis();
+  for (int i = 0; i < SUPERVISED_TASKS; i++) {
+    beats_[i] = now;
+  }
+  sampler_beat_ = now;
+  wdt_enable(WDTO_250MS);
+  lastFeed = now;
+}
+
+void Supervisor::save(const Snapshot &snapshot) {
+  stored.data = snapshot;
+  stored.savedAt = millis();
+  stored.magic = SNAPSHOT_MAGIC;
+  stored.crc = snapshotCrc();
+}
+
+void Supervisor::update() {
+  unsigned long now = millis();
+
+  unsigned long period = now - last_loop_;
+  last_loop_ = now;
+  if (period > LOOP_PERIOD) overruns_++;
+  if (period > worst_loop_) worst_loop_ = period;
+
+  uint8_t conversions = sampler.conversions();
+  if (conversions != last_conversions_) {
+    last_conversions_ = conversions;
+    sampler_beat_ = now;
+  }
+
+  // starve the watchdog if any task has stopped making progress
+  lateChecks = late(now);
+  if (armed_ && lateChecks == 0) {
+    wdt_reset();
+    lastFeed = now;
+  }
+}
+
+/**
+ * One bit per SupervisedTask past its deadline, and bit SUPERVISED_TASKS
+ * for the Sampler
+ */
+uint8_t Supervisor::late(unsigned long now) const {
+  uint8_t checks = 0;
+  if (now - sampler_beat_ > HEARTBEAT_DEADLINE) checks |= _BV(SUPERVISED_TASKS);
+  for (int i = 0; i < SUPERVISED_TASKS; i++) {
+    if (now - beats_[i] > HEARTBEAT_DEADLINE) checks |= _BV(i);
+  }
+  return checks;
+}
+
+Supervisor supervisor;
@@ -0,0 +1,116 @@
+/**
+ * Supervisor.h
+ * Hardware watchdog, task heartbeats, loop overrun counters and the snapshot
+ * ventilation resumes from after a watchdog reset.
+ *
+ * The watchdog is only fed while every supervised task is making progress:
+ * the control state machine beats once per pass, the display each time one
+ * of its queued writes finishes (see Display::service), and the Sampler is
+ * checked for new conversions. A loop stuck in a display transaction, or
+ * spinning without reaching the state machine, or a stalled ADC interrupt
+ * therefore all end in a reset within HEARTBEAT_DEADLINE plus the watchdog
+ * period.
+ *
+ * The snapshot lives in SRAM that the C runtime doesn't clear (.noinit), so
+ * it survives a watchdog reset (not a power cycle) and costs no EEPROM wear.
+ * It is written on every state change, so it is never more than one breath
+ * phase old.
+ *
+ * Slow work that is only done in standby (the SD card's set-up and file
+ * handling) is bracketed by beginLongStep/endLongStep, which stretch the
+ * watchdog to 4 s for it and count it as progress.
+ *
+ * A warm restart latches ALARM_WATCHDOG_RESET until the operator
+ * acknowledges it. WATCHDOG_MAX_RESETS resets within WATCHDOG_RESET_WINDOW of
+ * running (counted across the resets) mean resuming isn't helping: the
+ * ventilator then comes back in standby and stays there until acknowledged.
+ * A reset that only the display's heartbeat missed is alarmed but not
+ * counted: the screen failing is no reason to stop ventilating.
+ */
+
+#ifndef Supervisor_h
+#define Supervisor_h
+
+#include "Arduino.h"
+#include "Constants.h"
+#include "Display.h"
+
+enum SupervisedTask {
+  CONTROL_TASK,
+  DISPLAY_TASK,
+  SUPERVISED_TASKS
+};
+
+// Everything needed to pick ventilation back up after a watchdog reset
+struct Snapshot {
+  Display::userSettings settings;
+  bool          turnedOff;
+  VentMode      ventMode;
+  VentMode      requestedMode;
+  TriggerMode   triggerMode;
+  float         flowTriggerThreshold;
+  bool          leakCompensation;
+  States        state;
+  unsigned long cycleElapsed;  // ms into the breath when the snapshot was taken
+  unsigned long cycleCount;
+  float         inspZero, expZero;
+  float         peep;
+};
+
+class Supervisor {
+  public:
+    // check the reset cause; call first thing in setup()
+    void begin();
+
+    // true if this boot is a watchdog reset with a valid snapshot to resume from
+    bool warmRestart() const { return warm_; }
+    const Snapshot &snapshot() const;
+
+    // ms from when the snapshot was saved to now, across the reset; the
+    // reset is taken to come WATCHDOG_PERIOD after the last feed
+    unsigned long sinceSnapshot() const { return since_snapshot_ + millis(); }
+
+    // too many resets too close together: don't resume ventilation
+    bool resettingRepeatedly() const { return repeated_; }
+    bool holdingStandby() const { return repeated_ && !acknowledged_; }
+
+    // the operator has seen the reset alarm
+    void acknowledge();
+
+    // start the hardware watchdog
+    void arm();
+
+    // call once per loop: times the loop and feeds the watchdog if all tasks are alive
+    void update();
+    void beat(SupervisedTask task) { beats_[task] = millis(); }
+
+    void save(const Snapshot &snapshot);
+
+    // around one slow step in standby: the watchdog period is stretched for it
+    void beginLongStep();
+    void endLongStep();
+
+    // diagnostics
+    unsigned long overruns() const { return overruns_; }       // loops longer than LOOP_PERIOD
+    unsigned long worstLoop() const { return worst_loop_; }    // ms
+    uint16_t resets() const;                                   // watchdog resets since power-up
+
+  private:
+    bool warm_ = false;
+    bool repeated_ = false;
+    bool acknowledged_ = false;
+    unsigned long since_snapshot_ = 0;
+    bool armed_ = false;
+    unsigned long beats_[SUPERVISED_TASKS];
+    unsigned long sampler_beat_ = 0;
+    uint8_t last_conversions_ = 0;
+    unsigned long last_loop_ = 0;
+    unsigned long overruns_ = 0;
+    unsigned long worst_loop_ = 0;
+
+    uint8_t late(unsigned long now) const;
+};
+
+extern Supervisor supervisor;
+
+#endif
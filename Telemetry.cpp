@@ -0,0 +1,34 @@
+#include "Telemetry.h"
+#include "Storage.h"
+
+int16_t Telemetry::fixed(float value, float scale) {
+  if (isnan(value)) return TELEMETRY_UNKNOWN;
+  float counts = value * scale;
+  if (counts >= 32767) return 32767;
+  if (counts <= -32767) return -32767;
+  return (int16_t)(counts + (counts < 0 ? -0.5 : 0.5));
+}
+
+uint8_t Telemetry::crc(uint8_t type, const void *payload, uint8_t length) {
+  const uint8_t *bytes = (const uint8_t *)payload;
+  uint8_t crc = crc8Update(crc8Update(0, type), length);
+  for (uint8_t i = 0; i < length; i++) {
+    crc = crc8Update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+/**
+ * Write one frame. Frames are small enough to fit the serial transmit buffer,
+ * so this normally returns without waiting for the wire.
+ */
+void Telemetry::send(uint8_t type, const void *payload, uint8_t length) {
+  if (!enabled_) return;
+
+  uint8_t header[4] = { TELEMETRY_SYNC_1, TELEMETRY_SYNC_2, type, length };
+  Serial.write(header, sizeof(header));
+  Serial.write((const uint8_t *)payload, length);
+  Serial.write(crc(type, payload, length));
+}
+
+Telemetry telemetry;
@@ -0,0 +1,128 @@
+/**
+ * Telemetry.h
+ * Binary telemetry frames sent over the debug serial port for monitoring hosts.
+ *
+ * Frame layout (all multi-byte fields little-endian):
+ *
+ *    0xA5 0x5A  sync
+ *    type       TelemetryType
+ *    length     payload length in bytes
+ *    payload
+ *    crc        CRC-8 of type, length and payload
+ *
+ * Text debug output may be interleaved on the same port; hosts resynchronise
+ * on the sync bytes and drop frames that fail the CRC. SD recordings (see
+ * Recorder.h) are made of the same frames.
+ */
+
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include "Arduino.h"
+
+enum TelemetryType {
+  TELEMETRY_BREATH = 1, // BreathSummary, once per breath
+  TELEMETRY_TREND  = 2, // TrendSummary, as each minute and 15-minute trend period closes
+  TELEMETRY_WAVE   = 3, // WaveBlock, every TELEMETRY_WAVE_SAMPLES control loops
+  TELEMETRY_SECTOR = 4, // SectorHeader, first frame of every 512-byte sector of an SD recording (never sent)
+  TELEMETRY_ALARM  = 5  // AlarmState, whenever the active alarms change and with every BreathSummary
+};
+
+const uint8_t TELEMETRY_SYNC_1         = 0xA5;
+const uint8_t TELEMETRY_SYNC_2         = 0x5A;
+const uint8_t TELEMETRY_FRAME_OVERHEAD = 5; // sync, type, length and crc bytes around the payload
+
+// Fixed-point value sent for anything not measured yet (NaN)
+const int16_t TELEMETRY_UNKNOWN = -32768;
+
+// Per-breath values, fixed point. Unknown values are sent as TELEMETRY_UNKNOWN.
+struct BreathSummary {
+  uint32_t breath;        // breath count
+  uint32_t time;          // ms since power-up at the start of the breath
+  int16_t  peak;          // PIP (0.1 cmH2O)
+  int16_t  plateau;       // plateau pressure (0.1 cmH2O)
+  int16_t  peep;          // PEEP (0.1 cmH2O)
+  int16_t  volumeInsp;    // inspired tidal volume (cc)
+  int16_t  volumeExp;     // expired tidal volume (cc)
+  int16_t  minuteVolume;  // minute volume (0.1 L/min)
+  int16_t  rate;          // respiratory rate (0.1 breaths/min)
+  int16_t  oxygen;        // FiO2 (0.1 %)
+  int16_t  compliance;    // static compliance estimate (0.1 mL/cmH2O)
+  int16_t  resistance;    // airway resistance estimate (0.1 cmH2O/(L/s))
+  int16_t  triggerDelay;  // patient trigger detection to valve response (0.1 ms), unknown if not triggered
+  int16_t  pressureError; // mean inspiratory pressure tracking error after the rise (0.1 cmH2O, PS only)
+  int16_t  leak;          // estimated circuit leak (0.1 SLPM)
+} __attribute__((packed));
+
+// Metrics in a TrendSummary, in this order: peak, plateau, peep, volumeInsp,
+// volumeExp, minuteVolume, rate (same units and scales as BreathSummary)
+const uint8_t TELEMETRY_TREND_METRICS = 7;
+
+// Min, mean and max of each metric over one trend period (see Trends.h)
+struct TrendSummary {
+  uint8_t  level;         // 1 = one minute, 2 = 15 minutes
+  uint32_t time;          // ms since power-up at the end of the period
+  uint16_t breaths;       // breaths in the period
+  int16_t  min[TELEMETRY_TREND_METRICS];
+  int16_t  mean[TELEMETRY_TREND_METRICS];
+  int16_t  max[TELEMETRY_TREND_METRICS];
+} __attribute__((packed));
+
+const uint8_t TELEMETRY_WAVE_SAMPLES = 12;
+
+// One control loop's sensor readings, fixed point
+struct WaveSample {
+  uint8_t  interval;      // ms since the previous sample (saturates at 255)
+  int16_t  inspFlow;      // inspiratory flow (0.1 SLPM)
+  int16_t  expFlow;       // expiratory flow (0.1 SLPM)
+  int16_t  inspPressure;  // inspiratory limb pressure (0.1 cmH2O)
+  int16_t  expPressure;   // expiratory limb pressure (0.1 cmH2O)
+} __attribute__((packed));
+
+// Consecutive samples of the waveforms
+struct WaveBlock {
+  uint32_t time;          // ms since power-up of the first sample
+  uint8_t  count;         // samples used
+  WaveSample samples[TELEMETRY_WAVE_SAMPLES];
+} __attribute__((packed));
+
+// Start of a sector of an SD recording
+struct SectorHeader {
+  uint32_t sequence;      // sector number, counting on across files and restarts
+  uint32_t time;          // ms since power-up when the sector was started
+  uint16_t dropped;       // frames dropped so far because the card fell behind
+} __attribute__((packed));
+
+// Alarms on at the unit
+struct AlarmState {
+  uint32_t time;          // ms since power-up
+  uint32_t active;        // bit per alarmCode (see AlarmManager.h) that is on, silenced or not
+} __attribute__((packed));
+
+class Telemetry {
+  public:
+    Telemetry() : enabled_(false) { }
+
+    void enable(bool on) { enabled_ = on; }
+    bool enabled() const { return enabled_; }
+
+    void sendBreath(const BreathSummary &summary) { send(TELEMETRY_BREATH, &summary, sizeof(summary)); }
+    void sendTrend(const TrendSummary &summary) { send(TELEMETRY_TREND, &summary, sizeof(summary)); }
+    void sendWave(const WaveBlock &block) { send(TELEMETRY_WAVE, &block, sizeof(block)); }
+    void sendAlarms(const AlarmState &state) { send(TELEMETRY_ALARM, &state, sizeof(state)); }
+
+    // convert a value to fixed point with `scale` counts per unit, saturating (NaN -> TELEMETRY_UNKNOWN)
+    static int16_t fixed(float value, float scale);
+
+    // CRC-8 of a frame's type, length and payload
+    static uint8_t crc(uint8_t type, const void *payload, uint8_t length);
+
+  private:
+    bool enabled_;
+
+    void send(uint8_t type, const void *payload, uint8_t length);
+};
+
+extern Telemetry telemetry;
+
+#endif
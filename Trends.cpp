@@ -0,0 +1,244 @@
+#include "Trends.h"
+#include "Storage.h"
+#include "Telemetry.h"
+#include <EEPROM.h>
+#include <avr/eeprom.h>
+#include <stddef.h>
+
+static const uint8_t STORED_MAGIC = 0xB7;  // change whenever StoredEntry's layout changes
+static const uint8_t UNKNOWN = 0xFF;       // stored for a metric with no values in the period
+
+// size of one stored step of each metric, in its own units
+static const float trendStep[N_TREND_METRICS] PROGMEM = {
+  0.5, 0.5, 0.5,  // pressures (cmH2O), up to 127 cmH2O
+  4, 4,           // volumes (cc), up to 1016 cc
+  0.1,            // minute volume (L/min), up to 25.4 L/min
+  0.5             // rate (breaths/min)
+};
+
+// telemetry counts per unit of each metric, as in BreathSummary
+static const float telemetryScale[N_TREND_METRICS] PROGMEM = { 10, 10, 10, 1, 1, 10, 10 };
+static_assert(N_TREND_METRICS == TELEMETRY_TREND_METRICS, "TrendSummary carries every trend metric");
+
+static uint8_t encode(uint8_t metric, float value) {
+  if (isnan(value)) return UNKNOWN;
+  float steps = value / pgm_read_float(&trendStep[metric]) + 0.5;
+  return constrain(steps, 0, UNKNOWN - 1);
+}
+
+static float decode(uint8_t metric, uint8_t code) {
+  return code == UNKNOWN ? 0.0/0.0 : code * pgm_read_float(&trendStep[metric]);
+}
+
+void Trends::clear(Accumulator &acc) {
+  acc.breaths = 0;
+  for (uint8_t m = 0; m < N_TREND_METRICS; m++) {
+    acc.min[m] = UNKNOWN;
+    acc.max[m] = 0;
+    acc.sum[m] = 0;
+    acc.count[m] = 0;
+  }
+}
+
+static void fold(uint8_t &min, uint8_t &max, uint32_t &sum, uint16_t &count, uint8_t code) {
+  if (code == UNKNOWN) return;
+  if (code < min) min = code;
+  if (code > max) max = code;
+  sum += code;
+  count++;
+}
+
+/**
+ * Store the period's statistics in `entry` and start a new period
+ */
+void Trends::close(Accumulator &acc, Entry &entry) {
+  entry.breaths = acc.breaths;
+  for (uint8_t m = 0; m < N_TREND_METRICS; m++) {
+    if (acc.count[m] == 0) {
+      entry.min[m] = entry.mean[m] = entry.max[m] = UNKNOWN;
+    } else {
+      entry.min[m] = acc.min[m];
+      entry.mean[m] = (acc.sum[m] + acc.count[m] / 2) / acc.count[m];
+      entry.max[m] = acc.max[m];
+    }
+  }
+  clear(acc);
+}
+
+uint8_t Trends::storedCrc(const StoredEntry &stored) {
+  const uint8_t *bytes = (const uint8_t *)&stored;
+  uint8_t crc = 0;
+  for (size_t i = 0; i < offsetof(StoredEntry, crc); i++) {
+    crc = crc8Update(crc, bytes[i]);
+  }
+  return crc;
+}
+
+int Trends::quarterAddress(uint8_t slot) {
+  return EEPROM_TRENDS + slot * sizeof(StoredEntry);
+}
+
+static void readStored(int address, void *stored, size_t length) {
+  uint8_t *bytes = (uint8_t *)stored;
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] = EEPROM.read(address + i);
+  }
+}
+
+/**
+ * Find the newest entry of the EEPROM ring: entries are written to
+ * consecutive slots with consecutive sequence numbers, so walk forward from
+ * any valid entry until the chain breaks, then count back from there
+ */
+void Trends::begin() {
+  clear(minute_);
+  clear(quarter_);
+  minute_start_ = millis();
+
+  StoredEntry stored;
+  int8_t newest = -1;
+  uint16_t sequence = 0;
+  for (uint8_t slot = 0; slot < TREND_QUARTERS && newest < 0; slot++) {
+    readStored(quarterAddress(slot), &stored, sizeof(stored));
+    if (stored.magic == STORED_MAGIC && stored.crc == storedCrc(stored)) {
+      newest = slot;
+      sequence = stored.sequence;
+    }
+  }
+  if (newest < 0) return; // blank or foreign EEPROM: start an empty ring
+
+  for (uint8_t steps = 0; steps < TREND_QUARTERS; steps++) {
+    uint8_t slot = (newest + 1) % TREND_QUARTERS;
+    readStored(quarterAddress(slot), &stored, sizeof(stored));
+    if (stored.magic != STORED_MAGIC || stored.crc != storedCrc(stored) || stored.sequence != (uint16_t)(sequence + 1)) break;
+    newest = slot;
+    sequence = stored.sequence;
+  }
+
+  quarter_next_ = (newest + 1) % TREND_QUARTERS;
+  quarter_sequence_ = sequence + 1;
+  quarter_count_ = 0;
+  Entry entry;
+  while (quarter_count_ < TREND_QUARTERS && loadQuarter(quarter_count_, entry)) {
+    quarter_count_++;
+  }
+}
+
+void Trends::addBreath(const float values[N_TREND_METRICS]) {
+  uint8_t *breath = breath_ring_[breath_next_];
+  for (uint8_t m = 0; m < N_TREND_METRICS; m++) {
+    uint8_t code = encode(m, values[m]);
+    breath[m] = code;
+    fold(minute_.min[m], minute_.max[m], minute_.sum[m], minute_.count[m], code);
+    fold(quarter_.min[m], quarter_.max[m], quarter_.sum[m], quarter_.count[m], code);
+  }
+  minute_.breaths++;
+  quarter_.breaths++;
+
+  breath_next_ = (breath_next_ + 1) % TREND_BREATHS;
+  if (breath_count_ < TREND_BREATHS) breath_count_++;
+}
+
+void Trends::update() {
+  unsigned long now = millis();
+  if (now - minute_start_ >= TREND_MINUTE) {
+    minute_start_ += TREND_MINUTE;
+    closeMinute();
+  }
+
+  // one byte of the pending EEPROM entry per loop, and only once the last write has finished
+  if (pending_written_ < sizeof(StoredEntry) && eeprom_is_ready()) {
+    EEPROM.update(quarterAddress(pending_slot_) + pending_written_, ((const uint8_t *)&pending_)[pending_written_]);
+    pending_written_++;
+  }
+}
+
+void Trends::closeMinute() {
+  Entry &minute = minute_ring_[minute_next_];
+  close(minute_, minute);
+  minute_next_ = (minute_next_ + 1) % TREND_MINUTES;
+  if (minute_count_ < TREND_MINUTES) minute_count_++;
+  sendTelemetry(TREND_MINUTE_LEVEL, minute);
+
+  if (++minutes_in_quarter_ < TREND_QUARTER_MINUTES) return;
+  minutes_in_quarter_ = 0;
+
+  pending_.magic = STORED_MAGIC;
+  pending_.sequence = quarter_sequence_++;
+  close(quarter_, pending_.entry);
+  pending_.crc = storedCrc(pending_);
+  pending_slot_ = quarter_next_;
+  pending_written_ = 0;
+  quarter_next_ = (quarter_next_ + 1) % TREND_QUARTERS;
+  if (quarter_count_ < TREND_QUARTERS) quarter_count_++;
+  sendTelemetry(TREND_QUARTER_LEVEL, pending_.entry);
+}
+
+/**
+ * Read the quarter-hour entry `age` back from EEPROM (the newest comes from
+ * SRAM while it is still being written)
+ */
+bool Trends::loadQuarter(uint8_t age, Entry &entry) const {
+  if (age == 0 && pending_written_ < sizeof(StoredEntry)) {
+    entry = pending_.entry;
+    return true;
+  }
+
+  uint8_t slot = (quarter_next_ + TREND_QUARTERS - 1 - age) % TREND_QUARTERS;
+  StoredEntry stored;
+  readStored(quarterAddress(slot), &stored, sizeof(stored));
+  if (stored.magic != STORED_MAGIC || stored.crc != storedCrc(stored) ||
+      stored.sequence != (uint16_t)(quarter_sequence_ - 1 - age)) {
+    return false;
+  }
+  entry = stored.entry;
+  return true;
+}
+
+uint8_t Trends::held(TrendLevel level) const {
+  switch (level) {
+    case TREND_BREATH_LEVEL:  return breath_count_;
+    case TREND_MINUTE_LEVEL:  return minute_count_;
+    case TREND_QUARTER_LEVEL: return quarter_count_;
+    default:                  return 0;
+  }
+}
+
+bool Trends::get(TrendLevel level, uint8_t age, TrendMetric metric, TrendPoint &point) const {
+  if (age >= held(level) || metric >= N_TREND_METRICS) return false;
+
+  if (level == TREND_BREATH_LEVEL) {
+    uint8_t code = breath_ring_[(breath_next_ + TREND_BREATHS - 1 - age) % TREND_BREATHS][metric];
+    point.min = point.mean = point.max = decode(metric, code);
+    point.breaths = 1;
+    return true;
+  }
+
+  Entry entry;
+  if (level == TREND_MINUTE_LEVEL) {
+    entry = minute_ring_[(minute_next_ + TREND_MINUTES - 1 - age) % TREND_MINUTES];
+  } else if (!loadQuarter(age, entry)) {
+    return false;
+  }
+  point.min = decode(metric, entry.min[metric]);
+  point.mean = decode(metric, entry.mean[metric]);
+  point.max = decode(metric, entry.max[metric]);
+  point.breaths = entry.breaths;
+  return true;
+}
+
+void Trends::sendTelemetry(TrendLevel level, const Entry &entry) const {
+  TrendSummary summary;
+  summary.level = level;
+  summary.time = millis();
+  summary.breaths = entry.breaths;
+  for (uint8_t m = 0; m < N_TREND_METRICS; m++) {
+    float scale = pgm_read_float(&telemetryScale[m]);
+    summary.min[m] = Telemetry::fixed(decode(m, entry.min[m]), scale);
+    summary.mean[m] = Telemetry::fixed(decode(m, entry.mean[m]), scale);
+    summary.max[m] = Telemetry::fixed(decode(m, entry.max[m]), scale);
+  }
+  telemetry.sendTrend(summary);
+}
+
+Trends trends;
@@ -0,0 +1,122 @@
+/**
+ * Trends.h
+ * Multi-resolution trends of the per-breath values, for a trend screen and
+ * for telemetry.
+ *
+ * Three fixed-size rings: the last TREND_BREATHS breaths, then the min, mean
+ * and max of each metric per minute for the last TREND_MINUTES minutes, and
+ * per 15 minutes for the last 24 hours. Each breath is folded into the running
+ * minute and quarter-hour accumulators as it ends, so adding a breath is O(1)
+ * whatever the history; a period's entry is stored when it closes.
+ *
+ * Values are stored as one byte each in a per-metric step (e.g. 0.5 cmH2O,
+ * 4 cc), which keeps the breath and minute rings to about 1 KB of SRAM. The
+ * 24-hour ring is kept in EEPROM, where it also survives a reset or power
+ * loss; each entry carries a sequence number and CRC, so the ring is found
+ * again at boot and a half-written entry is simply skipped. Its bytes are
+ * written one per loop so the control loop never waits on an EEPROM write.
+ */
+
+#ifndef Trends_h
+#define Trends_h
+
+#include "Arduino.h"
+#include "Constants.h"
+
+enum TrendMetric {
+  TREND_PEAK,           // PIP (cmH2O)
+  TREND_PLATEAU,        // plateau pressure (cmH2O)
+  TREND_PEEP,           // PEEP (cmH2O)
+  TREND_VOLUME_INSP,    // inspired tidal volume (cc)
+  TREND_VOLUME_EXP,     // expired tidal volume (cc)
+  TREND_MINUTE_VOLUME,  // L/min
+  TREND_RATE,           // breaths/min
+  N_TREND_METRICS
+};
+
+enum TrendLevel {
+  TREND_BREATH_LEVEL,   // one entry per breath
+  TREND_MINUTE_LEVEL,   // one entry per minute
+  TREND_QUARTER_LEVEL,  // one entry per 15 minutes
+  N_TREND_LEVELS
+};
+
+// One metric over one entry; NaN if the metric wasn't measured in that period
+struct TrendPoint {
+  float    min, mean, max;
+  uint16_t breaths;  // breaths in the period
+};
+
+class Trends {
+  public:
+    // find the 24-hour ring in EEPROM; call once from setup()
+    void begin();
+
+    // add the values of the breath that just ended (indexed by TrendMetric, NaN if not measured)
+    void addBreath(const float values[N_TREND_METRICS]);
+
+    // call every loop: closes periods on time and writes the EEPROM ring in the background
+    void update();
+
+    // entries held at `level`
+    uint8_t held(TrendLevel level) const;
+
+    // `metric` in the entry `age` back (0 = newest) at `level`; false if there is no such entry
+    bool get(TrendLevel level, uint8_t age, TrendMetric metric, TrendPoint &point) const;
+
+  private:
+    // one period: a byte per metric for each of min, mean and max
+    struct Entry {
+      uint16_t breaths;
+      uint8_t  min[N_TREND_METRICS];
+      uint8_t  mean[N_TREND_METRICS];
+      uint8_t  max[N_TREND_METRICS];
+    };
+
+    // as stored in EEPROM
+    struct StoredEntry {
+      uint8_t  magic;
+      uint16_t sequence;
+      Entry    entry;
+      uint8_t  crc;
+    };
+
+    struct Accumulator {
+      uint16_t breaths;
+      uint8_t  min[N_TREND_METRICS], max[N_TREND_METRICS];
+      uint32_t sum[N_TREND_METRICS];
+      uint16_t count[N_TREND_METRICS];
+    };
+
+    uint8_t  breath_ring_[TREND_BREATHS][N_TREND_METRICS];
+    uint8_t  breath_next_ = 0;
+    uint8_t  breath_count_ = 0;
+
+    Entry    minute_ring_[TREND_MINUTES];
+    uint8_t  minute_next_ = 0;
+    uint8_t  minute_count_ = 0;
+
+    Accumulator minute_, quarter_;
+    unsigned long minute_start_ = 0;
+    uint8_t  minutes_in_quarter_ = 0;
+
+    // the EEPROM ring
+    uint8_t  quarter_next_ = 0;      // slot the next entry goes to
+    uint8_t  quarter_count_ = 0;
+    uint16_t quarter_sequence_ = 0;  // sequence number of the next entry
+    StoredEntry pending_;            // entry being written
+    uint8_t  pending_slot_ = 0;
+    uint8_t  pending_written_ = sizeof(StoredEntry);  // bytes of it written so far
+
+    static void clear(Accumulator &acc);
+    static void close(Accumulator &acc, Entry &entry);
+    static uint8_t storedCrc(const StoredEntry &stored);
+    static int quarterAddress(uint8_t slot);
+    bool loadQuarter(uint8_t age, Entry &entry) const;
+    void closeMinute();
+    void sendTelemetry(TrendLevel level, const Entry &entry) const;
+};
+
+extern Trends trends;
+
+#endif
@@ -2,6 +2,6 @@
 #include "Constants.h"
 
 // Valves
-Valve oxygenValve(SV1_CONTROL, false);
-Valve airValve(SV2_CONTROL, false);
-Valve expValve(SV4_CONTROL, true);
+Valve<SV1_CONTROL, false> oxygenValve;
+Valve<SV2_CONTROL, false> airValve;
+Valve<SV4_CONTROL, true>  expValve;
@@ -1,6 +1,9 @@
 /**
- * Pressure.h
- * Calculates and stores the key pressure values of the breathing cycle.
+ * Valve.h
+ * On/off solenoid valves driven through relays.
+ *
+ * The pin and whether the valve is normally open are template arguments so
+ * each valve compiles to direct port writes (see FastPin.h).
  */
 
 #ifndef Valve_h
@@ -8,40 +11,37 @@
 
 #include "Arduino.h"
 #include "Constants.h"
+#include "FastPin.h"
 
 enum ValveState {
   CLOSED, // 0
   OPEN    // 1
 };
 
+template <uint8_t Pin, bool NormallyOpen>
 class Valve {
 public:
-  Valve(int pin, bool normallyOpen): 
-    valve_pin_(pin), 
-    is_normally_open_(normallyOpen), 
-    state_(normallyOpen ? OPEN:CLOSED) {}
+  Valve(): state_(NormallyOpen ? OPEN:CLOSED) {}
 
   void open() {
     state_ = OPEN;
-    is_normally_open_ ? digitalWrite(valve_pin_, LOW) : digitalWrite(valve_pin_, HIGH);
+    NormallyOpen ? FastPin<Pin>::low() : FastPin<Pin>::high();
   }
 
   void close() {
     state_ = CLOSED;
-    is_normally_open_ ? digitalWrite(valve_pin_, HIGH) : digitalWrite(valve_pin_, LOW);
+    NormallyOpen ? FastPin<Pin>::high() : FastPin<Pin>::low();
   }
 
   ValveState get() const { return state_; }
 
 private:
-  int valve_pin_;
-  bool is_normally_open_;
   ValveState state_;
 };
 
 // Valves
-extern Valve oxygenValve;
-extern Valve airValve;
-extern Valve expValve;
+extern Valve<SV1_CONTROL, false> oxygenValve;
+extern Valve<SV2_CONTROL, false> airValve;
+extern Valve<SV4_CONTROL, true>  expValve;
 
 #endif
@@ -0,0 +1,143 @@
+#include "WaveHistory.h"
+#include "Display.h"
+
+static const uint8_t ESCAPE = 0x8;  // delta nibble: the literal value follows
+
+// the 4-bit delta from `previous` to `value`, or ESCAPE if it is outside -7..7
+static uint8_t deltaNibble(uint8_t value, uint8_t previous) {
+  int delta = (int)value - previous;
+  return (delta < -7 || delta > 7) ? ESCAPE : (delta & 0x0F);
+}
+
+static uint8_t applyNibble(uint8_t nibble, uint8_t previous) {
+  return previous + ((int8_t)(nibble << 4) >> 4); // sign-extend the nibble
+}
+
+void WaveHistory::beginBreath() {
+  // with the index full, the oldest breath's entry is reused
+  if (count_ < WAVE_HISTORY_BREATHS) count_++;
+  Breath &b = entry(next_++);
+  b.start = written_;
+  b.samples = 0;
+  open_ = true;
+  last_record_ = millis() - WAVE_HISTORY_PERIOD; // keyframe straight away
+}
+
+void WaveHistory::record(uint8_t flow, uint8_t pressure) {
+  unsigned long now = millis();
+  if (!open_ || now - last_record_ < WAVE_HISTORY_PERIOD) return;
+  last_record_ = now;
+
+  Breath &b = entry(next_ - 1);
+  if (b.samples > 0) {
+    uint8_t f = deltaNibble(flow, last_flow_);
+    uint8_t p = deltaNibble(pressure, last_pressure_);
+    if (!write(f << 4 | p) || (f == ESCAPE && !write(flow)) || (p == ESCAPE && !write(pressure))) {
+      open_ = false; // this breath alone has filled the ring; the rest of it isn't kept
+      return;
+    }
+  } else {
+    b.flow = flow;
+    b.pressure = pressure;
+  }
+  b.samples++;
+  last_flow_ = flow;
+  last_pressure_ = pressure;
+}
+
+/**
+ * Append a byte, first dropping the oldest breath if its bytes are about to be
+ * overwritten. False if that would drop the breath being recorded.
+ */
+bool WaveHistory::write(uint8_t byte) {
+  while ((uint16_t)(written_ - entry(next_ - count_).start) >= WAVE_HISTORY_BYTES) {
+    if (count_ == 1) return false;
+    count_--;
+  }
+  data_[written_ % WAVE_HISTORY_BYTES] = byte;
+  written_++;
+  return true;
+}
+
+void WaveHistory::freeze() {
+  frozen_ = true;
+}
+
+void WaveHistory::live() {
+  replaying_ = false;
+  frozen_ = false;
+}
+
+bool WaveHistory::replay(uint8_t breathsBack, uint8_t speed) {
+  uint16_t end = open_ ? next_ - 1 : next_; // first breath not replayed
+  if (breathsBack == 0 || speed == 0 || breathsBack > count_ || !startReader(end - breathsBack)) {
+    return false;
+  }
+
+  freeze();
+  display.clearWaves();
+  replay_end_ = end;
+  replay_interval_ = WAVE_HISTORY_PERIOD * 1000UL * 100 / speed;
+  replay_due_ = micros();
+  replaying_ = true;
+  return true;
+}
+
+void WaveHistory::update() {
+  if (!replaying_) return;
+
+  unsigned long now = micros();
+  for (uint8_t i = 0; i < WAVE_REPLAY_BURST && (long)(now - replay_due_) >= 0; i++) {
+    uint8_t flow, pressure;
+    if (!read(flow, pressure)) {
+      replaying_ = false; // done (or overwritten); the screen stays frozen on the replay
+      return;
+    }
+    display.drawWaves(flow, pressure);
+    replay_due_ += replay_interval_;
+  }
+
+  // a loop too slow for the speed asked for replays slower rather than bunching up
+  if ((long)(now - replay_due_) > 0) {
+    replay_due_ = now;
+  }
+}
+
+bool WaveHistory::startReader(uint16_t number) {
+  if (!held(number)) return false;
+  Breath &b = entry(number);
+  reader_.breath = number;
+  reader_.pos = b.start;
+  reader_.left = b.samples;
+  reader_.flow = b.flow;
+  reader_.pressure = b.pressure;
+  reader_.keyframe = true;
+  return true;
+}
+
+/**
+ * Decode the next pair, moving on to the following breath at the end of one
+ */
+bool WaveHistory::read(uint8_t &flow, uint8_t &pressure) {
+  while (reader_.left == 0) {
+    uint16_t following = reader_.breath + 1;
+    if (following == replay_end_ || !startReader(following)) return false;
+  }
+  if (!held(reader_.breath)) return false; // dropped since the replay started
+
+  if (!reader_.keyframe) {
+    uint8_t pair = data_[reader_.pos++ % WAVE_HISTORY_BYTES];
+    uint8_t f = pair >> 4;
+    uint8_t p = pair & 0x0F;
+    reader_.flow = f == ESCAPE ? data_[reader_.pos++ % WAVE_HISTORY_BYTES] : applyNibble(f, reader_.flow);
+    reader_.pressure = p == ESCAPE ? data_[reader_.pos++ % WAVE_HISTORY_BYTES] : applyNibble(p, reader_.pressure);
+  }
+  reader_.keyframe = false;
+  reader_.left--;
+
+  flow = reader_.flow;
+  pressure = reader_.pressure;
+  return true;
+}
+
+WaveHistory waveHistory;
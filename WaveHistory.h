@@ -0,0 +1,97 @@
+/**
+ * WaveHistory.h
+ * The last few breaths of the flow and pressure waveforms, for freeze,
+ * scrollback and replay on the display.
+ *
+ * Samples are the 8-bit graph values drawn on the screen, one flow/pressure
+ * pair every WAVE_HISTORY_PERIOD. Each pair is stored as one byte holding two
+ * 4-bit deltas from the previous pair; a delta that doesn't fit is escaped and
+ * followed by the literal value. Waveforms are smooth at this rate, so most
+ * pairs take one byte instead of two (or eight as floats), and the history
+ * is lossless.
+ *
+ * Breaths are indexed by their start (`beginBreath`, from beginInspiration);
+ * each index entry holds the breath's first pair as a keyframe so a breath
+ * can be decoded on its own. The oldest breaths are dropped as the byte ring
+ * fills.
+ */
+
+#ifndef Wave_History_h
+#define Wave_History_h
+
+#include "Arduino.h"
+#include "Constants.h"
+
+class WaveHistory {
+  public:
+    // start a new breath (call at the start of every inspiration)
+    void beginBreath();
+
+    // offer the latest graph values; keeps one pair per WAVE_HISTORY_PERIOD
+    void record(uint8_t flow, uint8_t pressure);
+
+    // breaths held, including the one being recorded
+    uint8_t breaths() const { return count_; }
+
+    // stop drawing live waveforms, leaving the screen as it is
+    void freeze();
+
+    // back to live waveforms (stops any replay)
+    void live();
+
+    bool frozen() const { return frozen_; }
+
+    /**
+     * Freeze and redraw from `breathsBack` complete breaths ago (1 = the last
+     * complete breath) up to the last complete breath, at `speed` percent of
+     * real time. False if that breath is no longer held.
+     */
+    bool replay(uint8_t breathsBack, uint8_t speed);
+    bool replaying() const { return replaying_; }
+
+    // call every loop; draws replayed samples when they are due
+    void update();
+
+  private:
+    struct Breath {
+      uint16_t start;      // ring position of the first delta byte
+      uint16_t samples;    // pairs, including the keyframe
+      uint8_t  flow, pressure;  // keyframe
+    };
+
+    // a position in the history while decoding
+    struct Reader {
+      uint16_t breath;     // breath number
+      uint16_t pos;        // ring position of the next byte
+      uint16_t left;       // pairs left in the breath
+      uint8_t  flow, pressure;
+      bool     keyframe;   // the next pair is the breath's keyframe
+    };
+
+    uint8_t  data_[WAVE_HISTORY_BYTES];
+    Breath   index_[WAVE_HISTORY_BREATHS];
+    uint16_t written_ = 0;  // free-running ring position of the next byte
+    uint16_t next_ = 0;     // number of the next breath
+    uint8_t  count_ = 0;    // breaths held (the newest is number next_ - 1)
+    bool     open_ = false; // the newest breath is still being recorded
+
+    uint8_t  last_flow_, last_pressure_;
+    unsigned long last_record_ = 0;
+
+    bool     frozen_ = false;
+    bool     replaying_ = false;
+    Reader   reader_;
+    uint16_t replay_end_;   // breath number to stop before
+    unsigned long replay_interval_;  // us between replayed pairs
+    unsigned long replay_due_;
+
+    Breath &entry(uint16_t number) { return index_[number % WAVE_HISTORY_BREATHS]; }
+    bool held(uint16_t number) const { return (uint16_t)(next_ - 1 - number) < count_; }
+    bool write(uint8_t byte);
+    bool startReader(uint16_t number);
+    bool read(uint8_t &flow, uint8_t &pressure);
+};
+
+extern WaveHistory waveHistory;
+
+#endif
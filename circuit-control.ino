@@ -21,119 +21,298 @@
 #include "O2management.h"
 #include "AlarmManager.h"
 #include "Display.h"
+#include "SerialCommands.h"
+#include "Mechanics.h"
+#include "Telemetry.h"
+#include "Sampler.h"
+#include "PressureController.h"
+#include "LeakDetector.h"
+#include "SensorHealth.h"
+#include "Startup.h"
+#include "Supervisor.h"
+#include "MemoryMonitor.h"
+#include "WaveHistory.h"
+#include "Trends.h"
+#include "Recorder.h"
+#include "FixedPoint.h"
+#include "Circuit.h"
+#include "HardwareIO.h"
+#include "LoadBenchmark.h"
 
 
 //--------------Initialize Variables--------------
-unsigned long cycleCount = 0; // number of breaths (including current breath)
-float targetExpVolume    = 0; // minimum target volume for expiration
-
-// Calculated target time parameters (in ms)
-unsigned long targetCycleEndTime;     // desired time at end of breath (at end of HOLD_EXP_STATE)
-unsigned long targetInspEndTime;      // desired time for end of INSP_STATE
-unsigned long targetExpDuration;      // desired length of EXP_STATE (VC mode only)
-unsigned long targetExpEndTime;       // desired time at end of EXP_STATE (VC mode only)
-unsigned long targetInspDuration;     // desired duration of inspiration
-
-// Timers (in ms)
-unsigned long cycleTimer;        // start time of start of current breathing cycle
-unsigned long inspHoldTimer;     // start time of inpsiratory hold state
-unsigned long expTimer;          // start time of expiration cycle (including exp hold & peep pause)
-unsigned long peepPauseTimer;    // start time of peep pause
-
-// Measured timer intervals (in ms)
-unsigned long cycleDuration;      // measured length of a whole inspiration-expiration cycle
-unsigned long inspDuration;       // measured length of inspiration (not including inspiratory hold)
-unsigned long expDuration;        // measured length of expiration (including peep pause and expiratory hold)
-
-// breathing circuit values to keep track of
-float desiredInspFlow; // desired inspiratory flowrate
-bool onButton = true;  // should be set to true when user indicates so on screen
-
-float tidalVolumeInsp = 0.0; // measured inspiratory tidal volume
-float tidalVolumeExp = 0.0;  // measured expiratory tidal volume
-
-float lastPeep = 0.0/0.0; // PEEP from last breath
-float lastPeak = 0.0/0.0; // peak pressure from last breath
-
 // Flags
 bool DEBUG = false;          // for debugging mode
-VentMode ventMode = VC_MODE; //set the default ventilation mode to volume control 
+
+// The patient circuit wired to this board (see Circuit.h)
+HardwareIO hardwareIO;
+Circuit<HardwareIO> circuit(hardwareIO);
 
 //--------------Declare Functions--------------
 /**
- * function to set the current state in the state machine 
+ * Watchdog snapshot (defined after setup)
  */
-void setState(States newState);
+void saveSnapshot();
+void resumeFromSnapshot();
 
 /**
  * helper function that reads all sensors and updates values 
  */
 void readSensors(){
-  //inspiratory sensors
-  inspFlowReader.read();                   // inspiratory flow (SLPM)
-  inspPressureReader.read();               // inspiratory pressure (cmH2O)
+  // low-rate O2 sampling; the other channels hold their last values while it has the ADC reference switched.
+  // It only starts in expiration, before the trigger is armed, and the PEEP pause waits for it to finish,
+  // so no trigger is armed and no breath starts while the sampling interrupt is stopped.
+  oxygenReader.update(circuit.state() == EXP_STATE || circuit.state() == PEEP_PAUSE_STATE);
+  if (oxygenReader.masking()) {
+    return;
+  }
+
   reservoirPressureReader.readReservoir(); // gas reservoir pressure (cmH2O)
+  circuit.readSensors();                   // inspiratory and expiratory flow (SLPM) and pressure (cmH2O)
+}
 
-  //expiratory sensors
-  expFlowReader.read();                   // expiratory flow (SLPM)
-  expPressureReader.read();               // expiratory pressure (cmH2O)
+/**
+ * Print the newest entries of one trend level for the `trend` command
+ */
+void printTrend() {
+  static const char levels[][8] PROGMEM = { "breath", "minute", "quarter" };
+  static const char names[][5] PROGMEM = { "pip", "plat", "peep", "vti", "vte", "mv", "rr" };
+
+  int level = 0;
+  while (level < N_TREND_LEVELS && !serialCommands.argumentIs(0, (const __FlashStringHelper *)levels[level])) {
+    level++;
+  }
+  if (level == N_TREND_LEVELS) {
+    Serial.println(F("trend: expected 'breath', 'minute' or 'quarter' [entries]"));
+    return;
+  }
+
+  int entries = serialCommands.arguments() > 1 ? serialCommands.argument(1) : 10;
+  for (int age = 0; age < entries && age < trends.held((TrendLevel)level); age++) {
+    Serial.print(age);
+    TrendPoint point;
+    for (int m = 0; m < N_TREND_METRICS; m++) {
+      if (!trends.get((TrendLevel)level, age, (TrendMetric)m, point)) break;
+      if (m == 0) {
+        Serial.print(F(" ("));
+        Serial.print(point.breaths);
+        Serial.print(F(" breaths)"));
+      }
+      Serial.print(' ');
+      Serial.print((const __FlashStringHelper *)names[m]);
+      Serial.print('=');
+      printFixed(Serial, toFixed(point.mean, 1), 1);
+      if (level != TREND_BREATH_LEVEL) {
+        Serial.print('(');
+        printFixed(Serial, toFixed(point.min, 1), 1);
+        Serial.print('-');
+        printFixed(Serial, toFixed(point.max, 1), 1);
+        Serial.print(')');
+      }
+    }
+    Serial.println();
+  }
 }
 
-/** 
- * function to check if sensor readings are within acceptable ranges
- * activate an alarm if they are not and deactivate the alarm once they are again
- * 
- * @param reading -- sensor reading
- * @param compareValue -- value to compare reading to
- * @param sensitivity -- the range of error
- * @param highAlarmCode -- the high alarm code for a specific sensor
- * @param lowAlarmCode -- the low alarm code for a specific sensor
- */ 
-void checkAlarmRangeWithUpdate(float reading, float &compareValue, float sensitivity, alarmCode highAlarmCode, alarmCode lowAlarmCode) { 
-  // if not the first reading, compare and alarm if abnormal
-  if (!isnan(compareValue)) {
-    if (reading > compareValue + sensitivity) { 
-      alarmMgr.activateAlarm(highAlarmCode);
-    } else if (reading < compareValue - sensitivity) { 
-      alarmMgr.activateAlarm(lowAlarmCode);
+/**
+ * Act on a command received over the debug serial port
+ *
+ *    standby       -- stop ventilation (as the standby button would)
+ *    run           -- resume ventilation
+ *    ack           -- acknowledge a failed startup self-test or a watchdog reset (as the alarm silence button would)
+ *    characterise  -- sweep SV3 to rebuild the valve feed-forward table (standby only)
+ *    autotune      -- identify the SV3/flow plant and retune the PID (standby only)
+ *    gains         -- print the fixed inspiratory PID gains
+ *    schedule      -- print the gain schedule
+ *    schedule-set <flow> <kp> <ki> <kd> -- add/replace a gain schedule point and save it
+ *    schedule-clear                     -- remove the gain schedule (fixed gains are used)
+ *    telemetry <0|1> -- stop/start binary telemetry frames on this port
+ *    trigger pressure        -- patient trigger on PEEP - sensitivity (default)
+ *    trigger flow <SLPM>     -- patient trigger on that much flow drawn from the expiratory bias flow
+ *    mode vc|ps              -- volume control or pressure support, from the next breath
+ *    ps <cmH2O> <rise s> <cycle-off %> <apnea s> -- pressure support settings
+ *    leak-comp <0|1>         -- stop/start adding the estimated inspiratory leak to VC breaths
+ *    health                  -- print the health and noise floor of each sensor channel
+ *    watchdog                -- print watchdog resets and loop overruns
+ *    memory                  -- print static, heap and stack SRAM use and the untouched headroom
+ *    waves freeze            -- stop drawing live waveforms
+ *    waves replay <breaths> <speed %> -- freeze and redraw the last <breaths> complete breaths
+ *    waves live              -- back to live waveforms
+ *    trend breath|minute|quarter [entries] -- print the newest trend entries (mean and min-max of each value)
+ *    record                  -- print the SD recording's file, sectors written and frames dropped
+ *    load <circuits>         -- run that many simulated circuits alongside this one (standby only; 0 stops)
+ *    load                    -- print the simulated circuits' cost, the loop time and the estimated capacity
+ */
+void handleSerialCommand() {
+  if (serialCommands.is(F("standby"))) {
+    display.setTurnedOff(true);
+  } else if (serialCommands.is(F("run"))) {
+    if (startup.holdingStandby() || supervisor.holdingStandby()) {
+      Serial.println(F("run: acknowledge the alarm first (ack)"));
+    } else {
+      display.setTurnedOff(false);
+    }
+  } else if (serialCommands.is(F("ack"))) {
+    startup.acknowledge();
+    supervisor.acknowledge();
+  } else if (serialCommands.is(F("characterise"))) {
+    if (circuit.state() != OFF_STATE) {
+      Serial.println(F("characterise: put the ventilator in standby first"));
+    } else if (inspValve.autoTuning()) {
+      Serial.println(F("characterise: wait for autotune to finish"));
+    } else {
+      expValve.open(); // flow must be able to leave the circuit
+      inspFlowReader.trackZero(false);
+      inspValve.beginCharacterisation();
+      Serial.println(F("characterise: started"));
+    }
+  } else if (serialCommands.is(F("autotune"))) {
+    if (circuit.state() != OFF_STATE) {
+      Serial.println(F("autotune: put the ventilator in standby first"));
+    } else if (inspValve.characterising()) {
+      Serial.println(F("autotune: wait for characterise to finish"));
+    } else {
+      expValve.open(); // flow must be able to leave the circuit
+      inspFlowReader.trackZero(false);
+      inspValve.beginAutoTune();
+      Serial.println(F("autotune: started"));
+    }
+  } else if (serialCommands.is(F("gains"))) {
+    Serial.print(F("kp=")); Serial.print(inspValve.kp(), 3);
+    Serial.print(F(" ki=")); Serial.print(inspValve.ki(), 3);
+    Serial.print(F(" kd=")); Serial.println(inspValve.kd(), 3);
+  } else if (serialCommands.is(F("schedule"))) {
+    GainSchedule &schedule = inspValve.schedule();
+    for (int i = 0; i < schedule.points(); i++) {
+      const GainPoint &p = schedule.point(i);
+      Serial.print(F("flow=")); Serial.print(p.flow, 1);
+      Serial.print(F(" kp="));  Serial.print(p.kp, 3);
+      Serial.print(F(" ki="));  Serial.print(p.ki, 3);
+      Serial.print(F(" kd="));  Serial.println(p.kd, 3);
+    }
+    if (!schedule.active()) {
+      Serial.println(F("schedule: none (fixed gains)"));
+    }
+  } else if (serialCommands.is(F("schedule-set"))) {
+    GainSchedule &schedule = inspValve.schedule();
+    if (serialCommands.arguments() != 4 ||
+        !schedule.set(serialCommands.argument(0), serialCommands.argument(1), serialCommands.argument(2), serialCommands.argument(3))) {
+      Serial.println(F("schedule-set: expected <flow> <kp> <ki> <kd> (schedule may be full)"));
+    } else {
+      schedule.save();
+    }
+  } else if (serialCommands.is(F("schedule-clear"))) {
+    inspValve.schedule().clear();
+    inspValve.schedule().save();
+  } else if (serialCommands.is(F("telemetry"))) {
+    telemetry.enable(serialCommands.argument(0) != 0);
+  } else if (serialCommands.is(F("trigger"))) {
+    if (serialCommands.argumentIs(0, F("pressure"))) {
+      circuit.triggerMode = PRESSURE_TRIGGER;
+    } else if (serialCommands.argumentIs(0, F("flow")) && serialCommands.argument(1) > 0 &&
+               serialCommands.argument(1) < FLOW_TRIGGER_BIAS) {
+      circuit.triggerMode = FLOW_TRIGGER;
+      circuit.flowTriggerThreshold = serialCommands.argument(1);
+    } else {
+      Serial.print(F("trigger: expected 'pressure' or 'flow <SLPM>' (below the "));
+      Serial.print(FLOW_TRIGGER_BIAS, 0);
+      Serial.println(F(" SLPM bias flow)"));
+    }
+  } else if (serialCommands.is(F("watchdog"))) {
+    Serial.print(F("resets=")); Serial.print(supervisor.resets());
+    Serial.print(F(" overruns=")); Serial.print(supervisor.overruns());
+    Serial.print(F(" worst loop (ms)=")); Serial.println(supervisor.worstLoop());
+  } else if (serialCommands.is(F("memory"))) {
+    Serial.print(F("data="));    Serial.print(memoryMonitor.dataSize());
+    Serial.print(F(" bss="));    Serial.print(memoryMonitor.bssSize());
+    Serial.print(F(" noinit=")); Serial.print(memoryMonitor.noinitSize());
+    Serial.print(F(" heap="));   Serial.print(memoryMonitor.heapSize());
+    Serial.print(F(" (peak "));  Serial.print(memoryMonitor.heapPeak());
+    Serial.print(F(") stack=")); Serial.print(memoryMonitor.stackSize());
+    Serial.print(F(" (peak "));  Serial.print(memoryMonitor.stackPeak());
+    Serial.print(F(") headroom=")); Serial.println(memoryMonitor.headroom());
+  } else if (serialCommands.is(F("waves"))) {
+    if (serialCommands.argumentIs(0, F("freeze"))) {
+      waveHistory.freeze();
+    } else if (serialCommands.argumentIs(0, F("live"))) {
+      waveHistory.live();
+    } else if (serialCommands.argumentIs(0, F("replay"))) {
+      if (!waveHistory.replay(serialCommands.argument(1), serialCommands.argument(2))) {
+        Serial.print(F("waves: breaths held: "));
+        Serial.println(waveHistory.breaths());
+      }
     } else {
-      alarmMgr.deactivateAlarm(lowAlarmCode); 
-      compareValue = reading; // update to remember value for next comparison
+      Serial.println(F("waves: expected 'freeze', 'live' or 'replay <breaths> <speed %>'"));
+    }
+  } else if (serialCommands.is(F("trend"))) {
+    printTrend();
+  } else if (serialCommands.is(F("record"))) {
+    if (!recorder.active()) {
+      Serial.println(F("record: not recording"));
+    } else {
+      Serial.print(F("file="));      Serial.print(recorder.file());
+      Serial.print(F(" sectors="));  Serial.print(recorder.sectors());
+      Serial.print(F(" dropped="));  Serial.println(recorder.dropped());
+    }
+  } else if (serialCommands.is(F("load"))) {
+    if (serialCommands.arguments() > 0) {
+      int circuits = serialCommands.argument(0);
+      if (circuits > 0 && circuit.state() != OFF_STATE) {
+        Serial.println(F("load: put the ventilator in standby first"));
+      } else if (circuits < 0 || circuits > LOAD_MAX_CIRCUITS || !loadBenchmark.start(circuits)) {
+        Serial.print(F("load: expected 0-"));
+        Serial.print(LOAD_MAX_CIRCUITS);
+        Serial.print(F(" circuits that fit in the SRAM headroom ("));
+        Serial.print(LoadBenchmark::bytesPerCircuit());
+        Serial.println(F(" bytes each)"));
+      }
+    } else {
+      Serial.print(F("circuits="));        Serial.print(loadBenchmark.circuits());
+      Serial.print(F(" bytes each="));     Serial.print(LoadBenchmark::bytesPerCircuit());
+      Serial.print(F(" breaths="));        Serial.println(loadBenchmark.breaths());
+      Serial.print(F("per circuit (us) mean=")); Serial.print(loadBenchmark.meanCircuit());
+      Serial.print(F(" max="));            Serial.println(loadBenchmark.maxCircuit());
+      Serial.print(F("loop (us) mean="));  Serial.print(loadBenchmark.meanLoop());
+      Serial.print(F(" max="));            Serial.print(loadBenchmark.maxLoop());
+      Serial.print(F(" overruns="));       Serial.println(loadBenchmark.overruns());
+      Serial.print(F("capacity="));        Serial.println(loadBenchmark.capacity());
+    }
+  } else if (serialCommands.is(F("health"))) {
+    static const char faults[][12] PROGMEM = { "ok", "saturated", "implausible", "stuck" };
+    for (int i = 0; i < sensorHealth.channels(); i++) {
+      Serial.print(F("pin A")); Serial.print(sensorHealth.pin(i) - A0);
+      Serial.print(F(": "));    Serial.print((const __FlashStringHelper *)faults[sensorHealth.fault(i)]);
+      Serial.print(F(" noise=")); Serial.println(sensorHealth.noise(i), 2);
+    }
+    Serial.print(F("O2: ")); Serial.println(sensorHealth.oxygenFailed() ? F("implausible") : F("ok"));
+  } else if (serialCommands.is(F("leak-comp"))) {
+    leakDetector.setCompensation(serialCommands.argument(0) != 0);
+  } else if (serialCommands.is(F("mode"))) {
+    if (serialCommands.argumentIs(0, F("vc"))) {
+      circuit.requestedMode = VC_MODE;
+    } else if (serialCommands.argumentIs(0, F("ps"))) {
+      circuit.requestedMode = PS_MODE;
+    } else {
+      Serial.println(F("mode: expected 'vc' or 'ps'"));
+    }
+  } else if (serialCommands.is(F("ps"))) {
+    if (serialCommands.arguments() != 4 || serialCommands.argument(0) <= 0 || serialCommands.argument(1) <= 0 ||
+        serialCommands.argument(2) <= 0 || serialCommands.argument(2) >= 100 || serialCommands.argument(3) <= 0) {
+      Serial.println(F("ps: expected <cmH2O> <rise s> <cycle-off %> <apnea s>"));
+    } else {
+      display.setPressureSupport(serialCommands.argument(0), serialCommands.argument(1),
+                                 serialCommands.argument(2), serialCommands.argument(3));
     }
   } else {
-    compareValue = reading; // update to remember value for next comparison
+    Serial.println(F("unknown command"));
   }
 }
 
-/** 
- * check against a value that doesn't need to be stored -- call above with dummy variable
- */ 
-void checkAlarmRange(float reading, float compareValue, float sensitivity, alarmCode highAlarmCode, alarmCode lowAlarmCode){ 
-  float dummyCompareValue = compareValue;
-  checkAlarmRangeWithUpdate(reading, dummyCompareValue, sensitivity, highAlarmCode, lowAlarmCode);
-}
-
-/** 
- * check for errors in sensor readings and take appropriate action
- */ 
-void checkSensorReadings() {
-  checkAlarmRangeWithUpdate(inspPressureReader.peak(), lastPeak, INSP_PRESSURE_SENSITIVITY, ALARM_INSP_HIGH, ALARM_INSP_LOW);
-  checkAlarmRange(tidalVolumeInsp, display.volume(), display.volume()/TIDAL_VOLUME_SENSITVITY, ALARM_TIDAL_HIGH, ALARM_TIDAL_LOW);
-}
-
-// PS algorithm
-void pressureSupportStateMachine();
-
-// VC algorithm
-void volumeControlStateMachine();
-
 //-------------------Set Up--------------------
 void setup() {
+  supervisor.begin();     // find out whether this is a watchdog reset before anything else
   Serial.begin(115200);   // open serial port for debugging
 
-  // initialize screen
-  display.init();
-
   // initialize pins with pinMode command
   pinMode(SV1_CONTROL, OUTPUT);
   pinMode(SV2_CONTROL, OUTPUT);
@@ -151,259 +330,295 @@ void setup() {
   pinMode(FLOW_INSP, INPUT);
   pinMode(FLOW_EXP, INPUT);
 
-  // setup PID controller (for VC mode, the default mode)
-  inspValve.initializePID(OUTPUT_MIN, OUTPUT_MAX, SAMPLE_TIME); 
-  inspValve.previousPosition = DEFAULT_VALVE_POSITION;     
+  // sample flow and pressure channels continuously from the ADC interrupt
+  static const uint8_t sampledPins[] = { FLOW_INSP, FLOW_EXP, PRESSURE_RESERVOIR, PRESSURE_INSP, PRESSURE_EXP };
+  sampler.begin(sampledPins, sizeof(sampledPins));
 
-  // warm up SV3 valve by opening it to unstick it
-  analogWrite(SV3_CONTROL, 255);
-  delay(35);
-  analogWrite(SV3_CONTROL, 0);
+  // setup PID controller (for VC mode, the default mode) and its learned feed-forward table
+  inspValve.initializePID(OUTPUT_MIN, OUTPUT_MAX, SAMPLE_TIME); 
+  inspValve.restoreFeedForward();
+  inspValve.restoreGains();
+
+  // the 24-hour trend ring is kept in EEPROM
+  trends.begin();
+
+  // After a watchdog reset all of the startup sequence is skipped and
+  // ventilation picks up from the snapshot straight away; the SD card is
+  // set up again at the next standby (see Recorder.h).
+  if (supervisor.warmRestart()) {
+    resumeFromSnapshot();
+    alarmMgr.activateAlarm(ALARM_WATCHDOG_RESET); // latched until acknowledged
+    Serial.print(F("watchdog reset #"));
+    Serial.print(supervisor.resets());
+    Serial.print(supervisor.resettingRepeatedly() ? F(", too many: in standby at ") : F(", resumed at "));
+    Serial.print(millis());
+    Serial.println(F(" ms"));
+    supervisor.arm(); // only once nothing in setup() is left to wait on
+    return;
+  }
 
-  // set to VC_MODE (@FutureWork: ideally this would be indicated through the UI startup sequence)
-  ventMode = VC_MODE;   // for testing VC mode only
+  // the circuit starts in VC_MODE (@FutureWork: ideally this would be indicated through the UI startup sequence)
   expValve.close();     // close exp valve initially
-  setState(OFF_STATE);  // start in OFF_STATE
+  circuit.turnOff();    // start in OFF_STATE
 
-  // calibrate flow meters -- seems to change when SV4 closes
-  inspFlowReader.calibrateToZero(); // set non-flow analog readings as the 0 in the flow reading functions
-  expFlowReader.calibrateToZero();  
+  // display init, flow zeroing, SV3 warm-up and the self-test run from loop()
+  // side by side (see Startup.h). The flow zeros are then also tracked
+  // during every no-flow period while running (see Circuit::trackFlowZeros).
+}
 
-  // @FutureWork: implement startup sequence on display
-  // display.start();
+/**
+ * Restore settings and breath phase after a watchdog reset. An interrupted
+ * inspiration's delivered volume is unknown, so the breath resumes in
+ * expiration and the next one starts when it was due: the breath is dated
+ * from the snapshot's time into it plus the estimated time since the
+ * snapshot, across the reset (see Supervisor::sinceSnapshot).
+ */
+void resumeFromSnapshot() {
+  const Snapshot &saved = supervisor.snapshot();
+  display.restoreSettings(saved.settings);
+  display.setTurnedOff(saved.turnedOff);
+  circuit.restoreMode(saved.ventMode);
+  circuit.requestedMode = saved.requestedMode;
+  circuit.triggerMode = saved.triggerMode;
+  circuit.flowTriggerThreshold = saved.flowTriggerThreshold;
+  leakDetector.setCompensation(saved.leakCompensation);
+  circuit.restoreCount(saved.cycleCount);
+  inspFlowReader.setZero(saved.inspZero);
+  expFlowReader.setZero(saved.expZero);
+  expPressureReader.restorePeep(saved.peep);
+  startup.resume();
+
+  // resets in quick succession: resuming isn't helping, so stay in standby
+  if (supervisor.resettingRepeatedly()) {
+    display.setTurnedOff(true);
+  }
+  circuit.resume(display.isTurnedOff() ? OFF_STATE : saved.state, saved.cycleElapsed + supervisor.sinceSnapshot());
+}
 
-  cycleTimer = millis(); // begin breath cycle timer
+/**
+ * Snapshot what `resumeFromSnapshot` needs; runs on every state change
+ */
+void saveSnapshot() {
+  Snapshot snapshot;
+  snapshot.settings = display.currentSettings();
+  snapshot.turnedOff = display.isTurnedOff();
+  snapshot.ventMode = circuit.ventMode();
+  snapshot.requestedMode = circuit.requestedMode;
+  snapshot.triggerMode = circuit.triggerMode;
+  snapshot.flowTriggerThreshold = circuit.flowTriggerThreshold;
+  snapshot.leakCompensation = leakDetector.compensating();
+  snapshot.state = circuit.state();
+  snapshot.cycleElapsed = circuit.cycleElapsed();
+  snapshot.cycleCount = circuit.cycleCount();
+  snapshot.inspZero = inspFlowReader.zero();
+  snapshot.expZero = expFlowReader.zero();
+  snapshot.peep = expPressureReader.peep();
+  supervisor.save(snapshot);
 }
 
 
 //-------------------Run Forever--------------------
 void loop() {
-  display.listen(); // listen for interactions with display
+  supervisor.update(); // feeds the watchdog while every task is alive
+
+  if (!startup.done()) {
+    startup.update();
+    if (startup.done()) {
+      circuit.begin(); // begin breath cycle timer
+      supervisor.arm();
+    }
+    return;
+  }
+
+  // a patient trigger is acted on before anything that can stall on the display
+  circuit.checkTrigger();
+
+  display.listen();  // listen for interactions with display
+  display.service(); // one queued write to the screen
+
+  if (serialCommands.listen()) {
+    handleSerialCommand();
+  }
+
+  // a failed self-test, or repeated watchdog resets, keep the ventilator in standby until acknowledged
+  if (startup.holdingStandby() || supervisor.holdingStandby()) {
+    display.setTurnedOff(true);
+  }
 
   // check if the user has indicated standby mode (to turn ventilator off)
   if (display.isTurnedOff()) {
-    setState(OFF_STATE);
+    circuit.turnOff();
     alarmMgr.activateAlarm(ALARM_SHUTDOWN); // activate shutdown alarm
   }
 
   readSensors(); 
-
-  // @FutureWork: We only alarm after first 5 breaths (this is a "warm up" issue where it takes time to stabilize)
-  if (cycleCount > 5){  
-    checkSensorReadings();     
-    alarmMgr.maintainAlarms(); // maintain onging alarms 
+  sensorHealth.update(); // failed sensors are alarmed from the first breath
+  trends.update();
+  memoryMonitor.update();
+  if (memoryMonitor.low()) {
+    alarmMgr.activateAlarm(ALARM_LOW_MEMORY);
   }
+  circuit.trackFlowZeros(inspValve.characterising() || inspValve.autoTuning());
+  circuit.checkReadings();
   
   display.updatePressureWave(inspPressureReader.get()); 
 
-  // manage reservoir refilling based on FIO2 concentration set by user on the display
+  // manage reservoir refilling based on FIO2 concentration set by user on the display,
+  // planning for the coming breath until it starts
+  bool inspiring = circuit.state() == INSP_STATE || circuit.state() == HOLD_INSP_STATE;
+  o2PlanBreath(inspiring ? 0 : circuit.nextBreathVolume());
   o2Management(display.oxygen());
 
-  // go to VC State machine
-  volumeControlStateMachine();
-}
-
+  // simulated circuits only run in standby too
+  if (loadBenchmark.circuits() > 0 && !display.isTurnedOff()) {
+    loadBenchmark.start(0);
+    Serial.println(F("load: stopped, ventilation resumed"));
+  }
 
-//////////////////////////////////////////////////////////////////////////////////////
-// VOLUME CONTROL STATE MACHINE
-//////////////////////////////////////////////////////////////////////////////////////
+  // valve calibration routines only run in standby; abandon them if ventilation resumes
+  if (inspValve.characterising() || inspValve.autoTuning()) {
+    if (!display.isTurnedOff()) {
+      inspValve.stopCharacterisation();
+      inspValve.stopAutoTune();
+    } else if (inspValve.characterising()) {
+      if (inspValve.maintainCharacterisation()) {
+        Serial.println(F("characterise: done"));
+      }
+    } else {
+      inspValve.maintainAutoTune();
+    }
+    supervisor.beat(CONTROL_TASK);
+    return;
+  }
 
-// States
-States state;
+  circuit.tick();
+  supervisor.beat(CONTROL_TASK);
 
-void setState(States newState) {
-  state = newState;
-}
+  // simulated circuits, when the load benchmark is running
+  loadBenchmark.tick();
 
-/**
- * This is normally the first state
- * @FutureWork: implement a turnOffAll method in AlarmManager class to be used here
- */ 
-void beginOff() {
-  inspValve.endBreath(); // close the inspiratory valve
-  expValve.open();       // keep expiratory valve open for safety (also does not use as much power)
-}
+  waveHistory.record(display.flowGraph(), display.pressureGraph());
+  waveHistory.update();
 
-/**
- * Runs during any transition to the INSP_STATE from any other state
- */  
-void beginInspiration() {
-  cycleDuration = millis() - cycleTimer;   // calculate the length of the last breath
-  cycleTimer = millis();                   // reset the cycle timer at the start of inspiration
+  recorder.sample(inspFlowReader.get(), expFlowReader.get(), inspPressureReader.get(), expPressureReader.get());
+  recorder.service(); // at most one sector, and only once the card has programmed the last
 
-  // record values from last breath
-  expDuration = cycleTimer - expTimer;        // measured duration of last expiration (EXP_STATE + PEEP_PAUSE + EXP_HOLD)
-  tidalVolumeExp = expFlowReader.getVolume(); // set current inspired volume as the measured inspiratory tidal volume for the last breath
-
-  // calculate actual minute volume from last breath
-  const float minuteVolume = inspFlowReader.getVolume() * CC_PER_MS_TO_LPM / cycleDuration;
-
-  // Update patient data on display to reflect values from last breath
-  display.writePeak(inspPressureReader.peak());        // measured pip cmH2O
-  display.writePlateau(inspPressureReader.plateau());  // measured plateau (only measured if HOLD_INSP_STATE is activated) cmH2O
-  display.writePeep(expPressureReader.peep());         // measured PEEP cmH2O
-  display.writeVolumeExp(expFlowReader.getVolume());   // measured expired volume
-  display.writeMinuteVolume(minuteVolume);             // measured minute volume
-  display.writeBPM(60000.0/cycleDuration);             // measured respiratory rate (seconds)
-  display.writeO2(O2);                                 // measured FIO2 concentration (@FutureWork: pending addition of O2 sensor)  
-
-  // close expiratory valve
-  expValve.close();
-
-  // Compute intervals at current settings
-  unsigned long targetCycleDuration = 60000UL / display.bpm(); // ms from start of cycle to end of inspiration
-  targetInspDuration = 105 * targetCycleDuration * display.inspPercent() / 10000; // allowing a bit more time to complete tidal volume inhailation
-  targetCycleEndTime = cycleTimer + targetCycleDuration;                          // target time for breath to end (for HOLD_EXP_STATE to end)
-  targetInspEndTime  = cycleTimer + targetInspDuration;                           // target time for INSP_STATE to end
-  targetExpDuration  = targetCycleDuration - targetInspDuration - MIN_PEEP_PAUSE; // target time for EXP_STATE to end
-  desiredInspFlow = display.volume() * CC_PER_MS_TO_LPM / targetInspDuration;     // desired inspiratory flowrate cc/ms
-
-  // begin PID control based on desired flow and reset tidal volume
-  inspValve.beginBreath(desiredInspFlow); 
-  inspFlowReader.resetVolume();           
-  cycleCount++;                           
+  // the card's set-up after a watchdog reset, the next file and removing the
+  // oldest can block for seconds, so they wait for standby
+  if (circuit.state() == OFF_STATE && recorder.managing()) {
+    supervisor.beginLongStep();
+    recorder.manage();
+    supervisor.endLongStep();
+  }
 }
 
-/**
- * Run every time we transition to HOLD_INSP state
- */ 
-void beginHoldInspiration() {
-  // close inspiratory valve, turn off PID control and reset timer                 
-  inspValve.endBreath();
-  inspHoldTimer = millis();
-
-  // Perform inspiration hold only once per button press on the UI
-  display.resetInspHold();
-}
 
-/**
- * Run every time we enter EXP_STATE from any other state
- */ 
-void beginExpiration() {
-  inspPressureReader.setPeakAndReset(); // reset pip, cmH2O
+//////////////////////////////////////////////////////////////////////////////////////
+// HARDWARE CIRCUIT HOOKS (see HardwareIO.h)
+//////////////////////////////////////////////////////////////////////////////////////
 
-  // record and display inspiratory tidal volume
-  tidalVolumeInsp = inspFlowReader.getVolume(); 
-  display.writeVolumeInsp(tidalVolumeInsp);     
+void HardwareIO::armTrigger(bool flow, uint16_t raw) {
+  // flow triggers on expiratory flow falling below `raw`, pressure on airway pressure falling below it
+  sampler.armTrigger(flow ? FLOW_EXP : PRESSURE_EXP, raw, true, TRIGGER_DEBOUNCE_SAMPLES);
+}
 
-  inspValve.endBreath(); // close insp valve and turn off PID control
-  expValve.open();       // open expiration valve
-  expTimer = millis();   // reset  timer
+bool HardwareIO::triggered() { return sampler.triggered(); }
+unsigned long HardwareIO::triggerTime() { return sampler.triggerTime(); }
+void HardwareIO::disarmTrigger() { sampler.disarmTrigger(); }
+bool HardwareIO::samplingSuspended() { return sampler.suspended(); }
 
-  // calculate 80% of inspired volume, whic is the condition to leave this state
-  targetExpVolume = inspFlowReader.getVolume() * 8 / 10; 
-  targetExpEndTime = expTimer + targetExpDuration;       
+void HardwareIO::beginInspiration(float) {
+  waveHistory.beginBreath();
+  o2BeginInspiration();
+}
 
-  expFlowReader.resetVolume();
+void HardwareIO::endInspiration(float volume) {
+  o2EndInspiration(volume);
 }
 
-/**
- * run every time we enter PEEP_PAUSE state
- */ 
-void beginPeepPause() {
-  peepPauseTimer = millis(); // reset timer
+void HardwareIO::showFlow(float flow) { display.updateFlowWave(flow); }
+void HardwareIO::showVolumeInsp(float volume) { display.writeVolumeInsp(volume); }
+
+void HardwareIO::stateChanged() {
+  saveSnapshot();
+
+  // a breath phase change must move these channels; one that doesn't is stuck
+  if (circuit.state() == INSP_STATE) {
+    sensorHealth.expectChange(PRESSURE_RESERVOIR);
+    sensorHealth.expectChange(PRESSURE_INSP);
+    sensorHealth.expectChange(PRESSURE_EXP);
+    sensorHealth.expectChange(FLOW_INSP);
+  } else if (circuit.state() == EXP_STATE) {
+    sensorHealth.expectChange(PRESSURE_INSP);
+    sensorHealth.expectChange(PRESSURE_EXP);
+    sensorHealth.expectChange(FLOW_EXP);
+  }
 }
 
 /**
- * Volume Control state machine
- */ 
-void volumeControlStateMachine(){
-  switch (state) {
-    case OFF_STATE:
-      if (!display.isTurnedOff()) { 
-        setState(INSP_STATE);
-        beginInspiration();  // beging inspiration!
-      }
-      break;
-
-    case INSP_STATE:     
-      display.updateFlowWave(inspFlowReader.get());                           
-      inspFlowReader.updateVolume();                                          
-
-      // calculate if the INSP_STATE should time out
-      bool timeout = (millis() >= targetInspEndTime + INSP_TIME_SENSITIVITY); 
-
-      // transition out of INSP_STATE if we either the desired tidal volume or state timed out
-      if (inspFlowReader.getVolume() >= display.volume() || timeout) { 
-        if (timeout) {
-          // this means we didn't reach tidal volume so trigger alarm
-          alarmMgr.activateAlarm(ALARM_TIDAL_LOW); 
-        } else if(alarmMgr.alarmStatus(ALARM_TIDAL_LOW)){
-          alarmMgr.deactivateAlarm(ALARM_TIDAL_LOW);      //otherwise deactivate a low tidal volume alarm if one is currently on
-        }
-
-        // if user turned on inspiratory hold, transition to INSP_HOLD_STATE
-        if (display.inspHold()) { 
-          setState(HOLD_INSP_STATE); 
-          beginHoldInspiration(); 
-        } else {
-          // otherwise, transition to EXP_STATE
-          setState(EXP_STATE);
-          beginExpiration();
-        }
-
-        inspDuration = millis() - cycleTimer; // Record length of inspiration
-      } else {
-        // if transition criteria is not met, keep adjusting inspiratory valve
-        inspValve.maintainBreath(cycleTimer);
-      }
-      break;
-
-    case HOLD_INSP_STATE:
-      display.updateFlowWave(inspFlowReader.get()); 
-
-      // if we reached the end time for HOLD_INSP_STATE
-      if (HOLD_INSP_DURATION <= millis() - inspHoldTimer) {
-        inspPressureReader.setPlateau();
-        // check plateau pressure range and alarm if abnormal  
-        if (inspPressureReader.plateau() > PPLAT_MAX) { 
-         alarmMgr.activateAlarm(ALARM_PPLAT_HIGH);
-        } else if (alarmMgr.alarmStatus(ALARM_PPLAT_HIGH)) {
-          alarmMgr.deactivateAlarm(ALARM_PPLAT_HIGH);
-        }
-
-        setState(EXP_STATE); // switch to EXP_STATE
-        beginExpiration();   
-      }
-      break;
-
-    case EXP_STATE:
-      // To update flow graph, flip sign of expiratory flow sensor to show flow out of lungs 
-      display.updateFlowWave(expFlowReader.get() * -1); 
-      expFlowReader.updateVolume();                     
-      
-      // if 80% of inspired volume has been expired, transition to PEEP_PAUSE_STATE 
-      if (expFlowReader.getVolume() >= targetExpVolume || millis() > targetExpEndTime + EXP_TIME_SENSITIVITY){ 
-        setState(PEEP_PAUSE_STATE); 
-        beginPeepPause();
-      }
-      break;
-
-    case PEEP_PAUSE_STATE:
-      // To update flow graph, flip sign of expiratory flow sensor to show flow out of lungs 
-      display.updateFlowWave(expFlowReader.get() * -1); 
-      expFlowReader.updateVolume();                     
-      
-      // if the PEEP pause time has run out, transition to HOLD_EXP_STATE
-      if (millis() - peepPauseTimer >= MIN_PEEP_PAUSE) {
-        expPressureReader.setPeep(); 
-        setState(HOLD_EXP_STATE);    
-      }
-      break;
-
-    case HOLD_EXP_STATE: {
-      display.updateFlowWave(expFlowReader.get() * -1); //update flow waveform on display
-      expFlowReader.updateVolume();                     //update expiratory flow counter
-
-      // Check if patient triggers inhale or state timed out 
-      bool patientTriggered = expPressureReader.get() < expPressureReader.peep() - display.sensitivity();
-      bool timeout = (millis()  > targetCycleEndTime); 
-
-      if (patientTriggered || timeout) { 
-        beginInspiration();   
-        setState(INSP_STATE);
-      }
+ * Update the display and telemetry with values from the breath that just ended
+ */
+void HardwareIO::reportBreath(const BreathReport &report) {
+  // Update patient data on display to reflect values from last breath
+  display.writePeak(report.peak);                 // measured pip cmH2O
+  display.writePlateau(report.plateau);           // measured plateau (only measured if HOLD_INSP_STATE is activated) cmH2O
+  display.writePeep(report.peep);                 // measured PEEP cmH2O
+  display.writeVolumeExp(report.volumeExp);       // measured expired volume
+  display.writeMinuteVolume(report.minuteVolume); // measured minute volume
+  display.writeBPM(report.rate);                  // measured respiratory rate (seconds)
+  display.writeO2(oxygenReader.filtered());       // measured FIO2 concentration
+  display.writeCompliance(report.compliance);     // estimated compliance mL/cmH2O
+  display.writeResistance(report.resistance);     // estimated resistance cmH2O/(L/s)
+
+  // send the same values to any monitoring host
+  BreathSummary summary;
+  summary.breath       = report.breath;
+  summary.time         = report.time;
+  summary.peak         = Telemetry::fixed(report.peak, 10);
+  summary.plateau      = Telemetry::fixed(report.plateau, 10);
+  summary.peep         = Telemetry::fixed(report.peep, 10);
+  summary.volumeInsp   = Telemetry::fixed(report.volumeInsp, 1);
+  summary.volumeExp    = Telemetry::fixed(report.volumeExp, 1);
+  summary.minuteVolume = Telemetry::fixed(report.minuteVolume, 10);
+  summary.rate         = Telemetry::fixed(report.rate, 10);
+  summary.oxygen       = Telemetry::fixed(oxygenReader.filtered(), 10);
+  summary.compliance   = Telemetry::fixed(report.compliance, 10);
+  summary.resistance   = Telemetry::fixed(report.resistance, 10);
+  summary.triggerDelay = report.triggerDelay < 0 ? TELEMETRY_UNKNOWN : Telemetry::fixed(report.triggerDelay / 1000.0, 10);
+  summary.pressureError = Telemetry::fixed(report.pressureError, 10);
+  summary.leak         = Telemetry::fixed(report.leak, 10);
+  telemetry.sendBreath(summary);
+  recorder.record(TELEMETRY_BREATH, &summary, sizeof(summary));
+  alarmMgr.sendState(); // so a host that joins mid-stream has the alarms within a breath
+
+  float trendValues[N_TREND_METRICS];
+  trendValues[TREND_PEAK]          = report.peak;
+  trendValues[TREND_PLATEAU]       = report.plateau;
+  trendValues[TREND_PEEP]          = report.peep;
+  trendValues[TREND_VOLUME_INSP]   = report.volumeInsp;
+  trendValues[TREND_VOLUME_EXP]    = report.volumeExp;
+  trendValues[TREND_MINUTE_VOLUME] = report.minuteVolume;
+  trendValues[TREND_RATE]          = report.rate;
+  trends.addBreath(trendValues);
+
+  if (DEBUG && report.triggerDelay >= 0) {
+    Serial.print(F("trigger delay (us): "));
+    Serial.println(report.triggerDelay);
+  }
+  if (DEBUG) {
+    Serial.print(F("leak (SLPM): "));
+    Serial.print(report.leak);
+    Serial.print(F(" fraction: "));
+    Serial.println(report.leakFraction);
+  }
+  if (DEBUG && !isnan(report.pressureError)) {
+    Serial.print(F("pressure tracking error (cmH2O): "));
+    Serial.println(report.pressureError);
+  }
 
-    } break;
-  } // End switch
+  if (report.breath == 0) {
+    Serial.print(F("first breath at "));
+    Serial.print(report.time + report.duration);
+    Serial.println(F(" ms"));
+  }
 }
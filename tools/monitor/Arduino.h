@@ -0,0 +1,14 @@
+/**
+ * Arduino.h
+ * Host stand-in for the Arduino core, so the firmware's Telemetry.h (the
+ * frame layout) compiles here unchanged. The frames' packed little-endian
+ * structs are used as is, so the tools need a little-endian host.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#endif
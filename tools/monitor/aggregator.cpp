@@ -0,0 +1,685 @@
+#include "aggregator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ventmon {
+
+namespace {
+
+// in alarmCode order (AlarmManager.h)
+const char *const alarmNames[FIRMWARE_ALARMS] = {
+  "Ventilation Shutdown", "Apnea Detected", "Power Failure", "Air Supply Disconnected",
+  "Oxygen Supply Disconnected", "Low Battery", "Pressure Sensor Failure (Reservoir)",
+  "Pressure Sensor Failure (Inspiration)", "Pressure Sensor Failure (Expiration)",
+  "Flow Sensor Failure (Inspiration)", "Flow Sensor Failure (Expiration)", "Startup Self-Test Failed",
+  "Controller Reset", "Circuit Disconnected",
+  "Excess Inspiratory Pressure", "High PEEP", "Low PEEP", "Low Inspiratory Pressure", "Circuit Leak",
+  "Tidal Volume High", "Plateau Pressure High", "Tidal Volume Low", "Oxygen Sensor Failure", "Low Memory"
+};
+
+// last code of each priority (ALARM_MAX_*_PRIORITY in AlarmManager.h)
+const unsigned MAX_HIGH_PRIORITY = 14;
+const unsigned MAX_MED_PRIORITY  = 19;
+
+const size_t HTTP_REQUEST_LIMIT = 8192;
+
+struct CrcTable {
+  uint8_t table[256];
+  CrcTable() {
+    // crc8Update (Storage.cpp), one byte at a time
+    for (int byte = 0; byte < 256; byte++) {
+      uint8_t crc = 0, in = byte;
+      for (int i = 0; i < 8; i++) {
+        uint8_t mix = (crc ^ in) & 0x01;
+        crc >>= 1;
+        if (mix) crc ^= 0x8C;
+        in >>= 1;
+      }
+      table[byte] = crc;
+    }
+  }
+};
+
+const CrcTable crcTable;
+
+speed_t baudConstant(unsigned baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B115200;
+  }
+}
+
+void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// fixed-point telemetry value as JSON (null if unknown)
+void appendFixed(std::string &out, int16_t value, int scale) {
+  char text[16];
+  if (value == TELEMETRY_UNKNOWN) {
+    out += "null";
+  } else if (scale == 1) {
+    snprintf(text, sizeof(text), "%d", value);
+    out += text;
+  } else {
+    snprintf(text, sizeof(text), "%s%d.%d", value < 0 ? "-" : "", abs(value) / 10, abs(value) % 10);
+    out += text;
+  }
+}
+
+void appendString(std::string &out, const std::string &s) {
+  out += '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    if ((unsigned char)c >= 0x20) out += c;
+  }
+  out += '"';
+}
+
+void appendNumber(std::string &out, double value) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.0f", value);
+  out += text;
+}
+
+void appendBreath(std::string &out, const BreathSummary &b) {
+  out += "{\"breath\":"; appendNumber(out, b.breath);
+  out += ",\"time\":"; appendNumber(out, b.time);
+  out += ",\"peak\":"; appendFixed(out, b.peak, 10);
+  out += ",\"plateau\":"; appendFixed(out, b.plateau, 10);
+  out += ",\"peep\":"; appendFixed(out, b.peep, 10);
+  out += ",\"volumeInsp\":"; appendFixed(out, b.volumeInsp, 1);
+  out += ",\"volumeExp\":"; appendFixed(out, b.volumeExp, 1);
+  out += ",\"minuteVolume\":"; appendFixed(out, b.minuteVolume, 10);
+  out += ",\"rate\":"; appendFixed(out, b.rate, 10);
+  out += ",\"oxygen\":"; appendFixed(out, b.oxygen, 10);
+  out += ",\"compliance\":"; appendFixed(out, b.compliance, 10);
+  out += ",\"resistance\":"; appendFixed(out, b.resistance, 10);
+  out += ",\"triggerDelay\":"; appendFixed(out, b.triggerDelay, 10);
+  out += ",\"pressureError\":"; appendFixed(out, b.pressureError, 10);
+  out += ",\"leak\":"; appendFixed(out, b.leak, 10);
+  out += '}';
+}
+
+void appendWave(std::string &out, const WavePoint &p) {
+  out += "{\"time\":"; appendNumber(out, p.time);
+  out += ",\"inspFlow\":"; appendFixed(out, p.inspFlow, 10);
+  out += ",\"expFlow\":"; appendFixed(out, p.expFlow, 10);
+  out += ",\"inspPressure\":"; appendFixed(out, p.inspPressure, 10);
+  out += ",\"expPressure\":"; appendFixed(out, p.expPressure, 10);
+  out += '}';
+}
+
+// "12.5" or "--"
+std::string cell(int16_t value, int scale) {
+  if (value == TELEMETRY_UNKNOWN) return "--";
+  std::string text;
+  appendFixed(text, value, scale);
+  return text;
+}
+
+struct AlarmEntry {
+  size_t   unit;
+  unsigned code;
+  double   since;
+};
+
+std::vector<AlarmEntry> activeAlarms(const std::vector<std::unique_ptr<Unit>> &units, double now) {
+  std::vector<AlarmEntry> list;
+  for (size_t i = 0; i < units.size(); i++) {
+    const Unit &unit = *units[i];
+    if (unit.stale(now)) {
+      list.push_back({ i, ALARM_NO_DATA, unit.lastFrame() });
+    }
+    for (unsigned code = 0; code < FIRMWARE_ALARMS; code++) {
+      if (unit.alarms() & (1UL << code)) {
+        list.push_back({ i, code, unit.alarmSince(code) });
+      }
+    }
+  }
+  std::sort(list.begin(), list.end(), [](const AlarmEntry &a, const AlarmEntry &b) {
+    if (alarmPriority(a.code) != alarmPriority(b.code)) return alarmPriority(a.code) < alarmPriority(b.code);
+    if (a.since != b.since) return a.since < b.since;
+    return a.unit < b.unit;
+  });
+  return list;
+}
+
+}  // namespace
+
+const char *alarmName(unsigned code) {
+  if (code < FIRMWARE_ALARMS) return alarmNames[code];
+  if (code == ALARM_NO_DATA) return "No Data";
+  return "Unknown";
+}
+
+Priority alarmPriority(unsigned code) {
+  if (code <= MAX_HIGH_PRIORITY || code == ALARM_NO_DATA) return HIGH_PRIORITY;
+  if (code <= MAX_MED_PRIORITY) return MED_PRIORITY;
+  return LOW_PRIORITY;
+}
+
+uint8_t crc8(const uint8_t *bytes, size_t length) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++) {
+    crc = crcTable.table[crc ^ bytes[i]];
+  }
+  return crc;
+}
+
+size_t encodeFrame(uint8_t type, const void *payload, uint8_t length, uint8_t *out) {
+  out[0] = TELEMETRY_SYNC_1;
+  out[1] = TELEMETRY_SYNC_2;
+  out[2] = type;
+  out[3] = length;
+  memcpy(out + 4, payload, length);
+  out[4 + length] = crc8(out + 2, length + 2);
+  return TELEMETRY_FRAME_OVERHEAD + length;
+}
+
+double nowUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+//------------------------------------------------------------------------------
+// Units
+
+Unit::Unit(Aggregator &owner, const std::string &name, const std::string &device, unsigned baud) :
+  owner_(owner), name_(name), device_(device), baud_(baud) { }
+
+Unit::~Unit() {
+  close();
+}
+
+bool Unit::open() {
+  if (fd_ >= 0) return true;
+  last_open_ = nowUs();
+  int fd = ::open(device_.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return false;
+  termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baudConstant(baud_));
+    cfsetospeed(&tio, baudConstant(baud_));
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  attach(fd);
+  return true;
+}
+
+void Unit::attach(int fd) {
+  close();
+  setNonBlocking(fd);
+  fd_ = fd;
+  used_ = 0;
+  owner_.watch(fd_, this, EPOLLIN);
+}
+
+void Unit::close() {
+  if (fd_ < 0) return;
+  owner_.unwatch(fd_);
+  ::close(fd_);
+  fd_ = -1;
+}
+
+void Unit::handle(uint32_t events) {
+  ssize_t n = read(fd_, input_ + used_, INPUT_BUFFER);
+  if (n > 0) {
+    stats_.bytes += n;
+    used_ += n;
+    size_t consumed = parse();
+    // keep the partial frame at the front (at most MAX_FRAME - 1 bytes)
+    memmove(input_, input_ + consumed, used_ - consumed);
+    used_ -= consumed;
+  } else if (n == 0 || (errno != EAGAIN && errno != EINTR) || (events & (EPOLLHUP | EPOLLERR))) {
+    close();  // reopened by the aggregator
+  }
+}
+
+void Unit::decode(const uint8_t *bytes, size_t length) {
+  while (length > 0) {
+    size_t chunk = std::min(length, INPUT_BUFFER);
+    memcpy(input_ + used_, bytes, chunk);
+    stats_.bytes += chunk;
+    used_ += chunk;
+    size_t consumed = parse();
+    memmove(input_, input_ + consumed, used_ - consumed);
+    used_ -= consumed;
+    bytes += chunk;
+    length -= chunk;
+  }
+}
+
+/**
+ * Decode the frames in the buffer in place; returns the bytes consumed (all
+ * but a trailing partial frame)
+ */
+size_t Unit::parse() {
+  double now = nowUs();
+  size_t pos = 0;
+  while (used_ - pos >= TELEMETRY_FRAME_OVERHEAD) {
+    const uint8_t *sync = (const uint8_t *)memchr(input_ + pos, TELEMETRY_SYNC_1, used_ - pos);
+    if (!sync) {
+      stats_.skipped += used_ - pos;
+      return used_;
+    }
+    size_t start = sync - input_;
+    stats_.skipped += start - pos;
+    pos = start;
+    if (used_ - pos < TELEMETRY_FRAME_OVERHEAD) break;
+    if (input_[pos + 1] != TELEMETRY_SYNC_2) {
+      stats_.skipped++;
+      pos++;
+      continue;
+    }
+
+    uint8_t length = input_[pos + 3];
+    if (used_ - pos < size_t(TELEMETRY_FRAME_OVERHEAD) + length) break;
+    const uint8_t *frame = input_ + pos;
+    if (crc8(frame + 2, length + 2) != frame[4 + length]) {
+      // a sync pair in text or noise, or a damaged frame: resynchronise on the next one
+      stats_.crcErrors++;
+      stats_.skipped++;
+      pos++;
+      continue;
+    }
+    dispatch(frame[2], frame + 4, length, now);
+    pos += TELEMETRY_FRAME_OVERHEAD + length;
+  }
+  return pos;
+}
+
+void Unit::dispatch(uint8_t type, const uint8_t *payload, uint8_t length, double now) {
+  if (owner_.hook_) owner_.hook_(owner_.hook_context_, *this, type, payload, length);
+
+  switch (type) {
+    case TELEMETRY_BREATH: {
+      if (length != sizeof(BreathSummary)) break;
+      BreathSummary summary;
+      memcpy(&summary, payload, sizeof(summary));
+      breaths_.push(summary);
+      stats_.frames++;
+      last_frame_ = now;
+      return;
+    }
+
+    case TELEMETRY_TREND: {
+      if (length != sizeof(TrendSummary) || payload[0] < 1 || payload[0] > 2) break;
+      memcpy(&trends_[payload[0] - 1], payload, sizeof(TrendSummary));
+      has_trend_[payload[0] - 1] = true;
+      stats_.frames++;
+      last_frame_ = now;
+      return;
+    }
+
+    case TELEMETRY_WAVE: {
+      if (length != sizeof(WaveBlock) || payload[4] > TELEMETRY_WAVE_SAMPLES) break;
+      uint32_t time;
+      memcpy(&time, payload, sizeof(time));
+      const uint8_t *sample = payload + offsetof(WaveBlock, samples);
+      for (uint8_t i = 0; i < payload[4]; i++, sample += sizeof(WaveSample)) {
+        WaveSample s;
+        memcpy(&s, sample, sizeof(s));
+        time += s.interval;
+        waves_.push({ time, s.inspFlow, s.expFlow, s.inspPressure, s.expPressure });
+      }
+      stats_.frames++;
+      last_frame_ = now;
+      return;
+    }
+
+    case TELEMETRY_ALARM: {
+      if (length != sizeof(AlarmState)) break;
+      AlarmState state;
+      memcpy(&state, payload, sizeof(state));
+      uint32_t raised = state.active & ~alarms_;
+      for (unsigned code = 0; code < 32; code++) {
+        if (raised & (1UL << code)) alarm_since_[code] = now;
+      }
+      alarms_ = state.active;
+      stats_.frames++;
+      last_frame_ = now;
+      return;
+    }
+  }
+  stats_.badFrames++;
+}
+
+//------------------------------------------------------------------------------
+// HTTP
+
+class Aggregator::Client : public Source {
+  public:
+    Client(Aggregator &owner, int fd) : owner_(owner), fd_(fd) { }
+    ~Client() { ::close(fd_); }
+
+    void handle(uint32_t events) override {
+      if (events & (EPOLLHUP | EPOLLERR)) {
+        finish();
+      } else if (!responding_) {
+        receive();
+      } else {
+        send();
+      }
+    }
+
+  private:
+    Aggregator &owner_;
+    int fd_;
+    std::string request_, response_;
+    size_t sent_ = 0;
+    bool responding_ = false;
+    bool finished_ = false;
+
+    void receive() {
+      char bytes[1024];
+      ssize_t n = read(fd_, bytes, sizeof(bytes));
+      if (n <= 0) {
+        if (n == 0 || errno != EAGAIN) finish();
+        return;
+      }
+      request_.append(bytes, n);
+      if (request_.find("\r\n\r\n") == std::string::npos && request_.find("\n\n") == std::string::npos) {
+        if (request_.size() > HTTP_REQUEST_LIMIT) finish();
+        return;
+      }
+
+      // "GET <path> HTTP/1.x"
+      size_t space = request_.find(' ');
+      size_t end = request_.find(' ', space + 1);
+      if (request_.compare(0, 4, "GET ") != 0 || end == std::string::npos) {
+        response_ = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      } else {
+        response_ = owner_.respond(request_.substr(space + 1, end - space - 1));
+      }
+      responding_ = true;
+      epoll_event event = { EPOLLOUT, { this } };
+      epoll_ctl(owner_.epoll_, EPOLL_CTL_MOD, fd_, &event);
+      send();
+    }
+
+    void send() {
+      ssize_t n = write(fd_, response_.data() + sent_, response_.size() - sent_);
+      if (n < 0 && errno == EAGAIN) return;
+      if (n < 0) {
+        finish();
+        return;
+      }
+      sent_ += n;
+      if (sent_ == response_.size()) finish();
+    }
+
+    void finish() {
+      if (finished_) return;
+      finished_ = true;
+      owner_.unwatch(fd_);
+      owner_.closing_.push_back(this);
+    }
+};
+
+class Aggregator::Listener : public Source {
+  public:
+    Listener(Aggregator &owner, int fd) : owner_(owner), fd_(fd) { }
+    ~Listener() { ::close(fd_); }
+
+    void handle(uint32_t) override {
+      for (;;) {
+        int fd = accept(fd_, nullptr, nullptr);
+        if (fd < 0) return;
+        setNonBlocking(fd);
+        owner_.watch(fd, new Client(owner_, fd), EPOLLIN);
+      }
+    }
+
+  private:
+    Aggregator &owner_;
+    int fd_;
+};
+
+std::string Aggregator::respond(const std::string &path) const {
+  std::string body, type = "application/json";
+  const char *status = "200 OK";
+
+  size_t query = path.find('?');
+  std::string route = path.substr(0, query);
+  size_t count = 0;
+  if (query != std::string::npos) {
+    size_t n = path.find("n=", query);
+    if (n != std::string::npos) count = strtoul(path.c_str() + n + 2, nullptr, 10);
+  }
+
+  unsigned long unit;
+  char kind[16];
+  if (route == "/") {
+    body = table();
+    type = "text/plain";
+  } else if (route == "/units") {
+    body = unitsJson();
+  } else if (route == "/alarms") {
+    body = alarmsJson();
+  } else if (sscanf(route.c_str(), "/units/%lu/%15s", &unit, kind) == 2 && unit < units_.size() &&
+             (strcmp(kind, "breaths") == 0 || strcmp(kind, "waves") == 0)) {
+    body = kind[0] == 'b' ? breathsJson(unit, count ? count : 20) : wavesJson(unit, count ? count : 200);
+  } else {
+    status = "404 Not Found";
+    body = "{\"error\":\"routes: / /units /alarms /units/<n>/breaths?n= /units/<n>/waves?n=\"}";
+  }
+
+  char header[160];
+  snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+           status, type.c_str(), body.size());
+  return header + body;
+}
+
+//------------------------------------------------------------------------------
+// Views
+
+std::string Aggregator::table() const {
+  double now = nowUs();
+  std::string out;
+  char line[256];
+  snprintf(line, sizeof(line), "%-16s %-7s %6s %6s %6s %6s %6s %6s %6s %6s %s\n",
+           "unit", "state", "breath", "PIP", "PEEP", "VTi", "VTe", "MV", "RR", "FiO2", "alarms");
+  out += line;
+  for (const auto &u : units_) {
+    const Unit &unit = *u;
+    std::string values[8] = { "--", "--", "--", "--", "--", "--", "--", "--" };
+    if (unit.breaths().size() > 0) {
+      const BreathSummary &b = unit.breaths().at(0);
+      values[0] = std::to_string(b.breath);
+      values[1] = cell(b.peak, 10);
+      values[2] = cell(b.peep, 10);
+      values[3] = cell(b.volumeInsp, 1);
+      values[4] = cell(b.volumeExp, 1);
+      values[5] = cell(b.minuteVolume, 10);
+      values[6] = cell(b.rate, 10);
+      values[7] = cell(b.oxygen, 10);
+    }
+    std::string alarms;
+    for (unsigned code = 0; code < FIRMWARE_ALARMS; code++) {
+      if (unit.alarms() & (1UL << code)) {
+        if (!alarms.empty()) alarms += ", ";
+        alarms += alarmName(code);
+      }
+    }
+    snprintf(line, sizeof(line), "%-16.16s %-7s %6s %6s %6s %6s %6s %6s %6s %6s %s\n",
+             unit.name().c_str(), !unit.connected() ? "gone" : unit.stale(now) ? "no data" : "ok",
+             values[0].c_str(), values[1].c_str(), values[2].c_str(), values[3].c_str(),
+             values[4].c_str(), values[5].c_str(), values[6].c_str(), values[7].c_str(), alarms.c_str());
+    out += line;
+  }
+  return out;
+}
+
+std::string Aggregator::unitsJson() const {
+  double now = nowUs();
+  std::string out = "[";
+  for (size_t i = 0; i < units_.size(); i++) {
+    const Unit &unit = *units_[i];
+    if (i > 0) out += ',';
+    out += "{\"id\":"; appendNumber(out, i);
+    out += ",\"name\":"; appendString(out, unit.name());
+    out += ",\"device\":"; appendString(out, unit.device());
+    out += ",\"connected\":"; out += unit.connected() ? "true" : "false";
+    out += ",\"stale\":"; out += unit.stale(now) ? "true" : "false";
+    out += ",\"lastFrameAgeMs\":";
+    if (unit.lastFrame() > 0) appendNumber(out, (now - unit.lastFrame()) / 1000); else out += "null";
+    out += ",\"bytes\":"; appendNumber(out, unit.stats().bytes);
+    out += ",\"frames\":"; appendNumber(out, unit.stats().frames);
+    out += ",\"crcErrors\":"; appendNumber(out, unit.stats().crcErrors);
+    out += ",\"alarms\":"; appendNumber(out, unit.alarms());
+    out += ",\"breath\":";
+    if (unit.breaths().size() > 0) appendBreath(out, unit.breaths().at(0)); else out += "null";
+    out += ",\"wave\":";
+    if (unit.waves().size() > 0) appendWave(out, unit.waves().at(0)); else out += "null";
+    out += '}';
+  }
+  return out + "]";
+}
+
+std::string Aggregator::alarmsJson() const {
+  static const char *const priorities[] = { "high", "medium", "low" };
+  double now = nowUs();
+  std::string out = "[";
+  bool first = true;
+  for (const AlarmEntry &alarm : activeAlarms(units_, now)) {
+    if (!first) out += ',';
+    first = false;
+    out += "{\"unit\":"; appendNumber(out, alarm.unit);
+    out += ",\"name\":"; appendString(out, units_[alarm.unit]->name());
+    out += ",\"code\":"; appendNumber(out, alarm.code);
+    out += ",\"alarm\":"; appendString(out, alarmName(alarm.code));
+    out += ",\"priority\":"; appendString(out, priorities[alarmPriority(alarm.code)]);
+    out += ",\"ageMs\":";
+    if (alarm.since > 0) appendNumber(out, (now - alarm.since) / 1000); else out += "null";
+    out += '}';
+  }
+  return out + "]";
+}
+
+std::string Aggregator::breathsJson(size_t unit, size_t count) const {
+  const auto &ring = units_[unit]->breaths();
+  std::string out = "[";
+  for (size_t age = std::min(count, ring.size()); age-- > 0; ) {
+    appendBreath(out, ring.at(age));
+    if (age > 0) out += ',';
+  }
+  return out + "]";
+}
+
+std::string Aggregator::wavesJson(size_t unit, size_t count) const {
+  const auto &ring = units_[unit]->waves();
+  std::string out = "[";
+  for (size_t age = std::min(count, ring.size()); age-- > 0; ) {
+    appendWave(out, ring.at(age));
+    if (age > 0) out += ',';
+  }
+  return out + "]";
+}
+
+//------------------------------------------------------------------------------
+// Event loop
+
+Aggregator::Aggregator() : epoll_(epoll_create1(EPOLL_CLOEXEC)) {
+  if (epoll_ < 0) {
+    perror("ventmon: epoll_create1");
+    exit(1);
+  }
+}
+
+Aggregator::~Aggregator() {
+  units_.clear();
+  listen_source_.reset();
+  for (Source *client : closing_) delete client;
+  ::close(epoll_);
+}
+
+Unit &Aggregator::addDevice(const std::string &device, unsigned baud) {
+  // named by the device's last path component (ttyUSB0, or a link's name)
+  units_.emplace_back(new Unit(*this, device.substr(device.rfind('/') + 1), device, baud));
+  Unit &unit = *units_.back();
+  if (!unit.open()) {
+    fprintf(stderr, "ventmon: %s: %s (will retry)\n", device.c_str(), strerror(errno));
+  }
+  return unit;
+}
+
+Unit &Aggregator::addFd(int fd, const std::string &name) {
+  units_.emplace_back(new Unit(*this, name, name, 0));
+  units_.back()->attach(fd);
+  return *units_.back();
+}
+
+bool Aggregator::listen(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in address = { };
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (fd < 0 || bind(fd, (sockaddr *)&address, sizeof(address)) < 0 || ::listen(fd, 64) < 0) {
+    if (fd >= 0) ::close(fd);
+    return false;
+  }
+  listener_ = fd;
+  listen_source_.reset(new Listener(*this, fd));
+  watch(fd, listen_source_.get(), EPOLLIN);
+  return true;
+}
+
+void Aggregator::watch(int fd, Source *source, uint32_t events) {
+  epoll_event event = { events, { source } };
+  epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+}
+
+void Aggregator::unwatch(int fd) {
+  epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Aggregator::poll(int timeoutMs) {
+  const int MAX_EVENTS = 256;
+  epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(epoll_, events, MAX_EVENTS, timeoutMs);
+  for (int i = 0; i < n; i++) {
+    static_cast<Source *>(events[i].data.ptr)->handle(events[i].events);
+  }
+
+  // clients are freed once no event of this wakeup can refer to them
+  for (Source *client : closing_) delete client;
+  closing_.clear();
+
+  double now = nowUs();
+  if (now - last_reopen_ >= REOPEN_INTERVAL) {
+    last_reopen_ = now;
+    for (auto &unit : units_) {
+      if (!unit->connected() && unit->baud_ != 0 && now - unit->last_open_ >= REOPEN_INTERVAL) {
+        unit->open();
+      }
+    }
+  }
+}
+
+}  // namespace ventmon
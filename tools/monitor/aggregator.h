@@ -0,0 +1,207 @@
+/**
+ * aggregator.h
+ * Telemetry from many ventilators, gathered on one thread by an epoll loop.
+ *
+ * Each unit is a serial port (or pseudo-terminal) carrying the firmware's
+ * telemetry frames (see Telemetry.h), with its debug text interleaved. Bytes
+ * are read straight into the unit's input buffer and frames are decoded in
+ * place: the parser skips to the next sync pair, checks the CRC over the
+ * buffer and hands the payload out as a pointer into it. The only copies are
+ * into the unit's rings (waveform samples, breath summaries) and the latest
+ * trend and alarm state. Every unit gets one read per wakeup, so a busy unit
+ * can't starve the others.
+ *
+ * The same loop serves the views over HTTP (see `listen`): a text table of
+ * every unit, and JSON for the units, the consolidated alarm list (highest
+ * priority first, then oldest) and each unit's recent breaths and waveforms.
+ * A unit that has sent no valid frame for STALE_AFTER, or whose device has
+ * gone away, is on the alarm list as "No Data"; devices are reopened every
+ * REOPEN_INTERVAL.
+ */
+
+#ifndef Aggregator_h
+#define Aggregator_h
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../../Telemetry.h"
+
+namespace ventmon {
+
+const size_t   INPUT_BUFFER    = 4096;   // bytes read per unit per wakeup, plus a partial frame
+const size_t   WAVE_RING       = 4096;   // samples per unit (about two minutes at the 30 ms loop)
+const size_t   BREATH_RING     = 256;    // breath summaries per unit
+const double   STALE_AFTER     = 5e6;    // us without a valid frame before a unit is "No Data"
+const double   REOPEN_INTERVAL = 2e6;    // us between attempts to reopen a device that has gone away
+const size_t   MAX_FRAME       = TELEMETRY_FRAME_OVERHEAD + 255;
+
+// firmware alarm codes (alarmCode in AlarmManager.h) and the host's own
+const unsigned FIRMWARE_ALARMS = 24;
+const unsigned ALARM_NO_DATA   = 31;
+
+enum Priority { HIGH_PRIORITY, MED_PRIORITY, LOW_PRIORITY };
+
+const char *alarmName(unsigned code);
+Priority alarmPriority(unsigned code);
+
+uint8_t crc8(const uint8_t *bytes, size_t length);
+
+// write one frame into `out` (at least MAX_FRAME bytes); returns its length
+size_t encodeFrame(uint8_t type, const void *payload, uint8_t length, uint8_t *out);
+
+double nowUs();  // CLOCK_MONOTONIC
+
+template <class T, size_t N>
+class Ring {
+  public:
+    void push(const T &value) { items_[head_++ % N] = value; }
+    size_t size() const { return head_ < N ? head_ : N; }
+    size_t total() const { return head_; }
+    // age 0 is the newest
+    const T &at(size_t age) const { return items_[(head_ - 1 - age) % N]; }
+
+  private:
+    T items_[N];
+    size_t head_ = 0;
+};
+
+struct WavePoint {
+  uint32_t time;          // unit ms
+  int16_t  inspFlow, expFlow, inspPressure, expPressure;  // as WaveSample
+};
+
+struct UnitStats {
+  unsigned long bytes = 0;
+  unsigned long frames = 0;
+  unsigned long crcErrors = 0;
+  unsigned long skipped = 0;      // bytes outside frames (debug text, noise)
+  unsigned long badFrames = 0;    // valid CRC but unknown type or wrong length
+};
+
+class Aggregator;
+
+// epoll callbacks
+class Source {
+  public:
+    virtual ~Source() { }
+    virtual void handle(uint32_t events) = 0;
+};
+
+class Unit : public Source {
+  public:
+    Unit(Aggregator &owner, const std::string &name, const std::string &device, unsigned baud);
+    ~Unit();
+
+    const std::string &name() const { return name_; }
+    const std::string &device() const { return device_; }
+    bool connected() const { return fd_ >= 0; }
+    const UnitStats &stats() const { return stats_; }
+
+    // host time of the last valid frame (us, 0 if none)
+    double lastFrame() const { return last_frame_; }
+    bool stale(double now) const { return !connected() || now - last_frame_ > STALE_AFTER; }
+
+    const Ring<WavePoint, WAVE_RING> &waves() const { return waves_; }
+    const Ring<BreathSummary, BREATH_RING> &breaths() const { return breaths_; }
+    bool hasTrend(uint8_t level) const { return level >= 1 && level <= 2 && has_trend_[level - 1]; }
+    const TrendSummary &trend(uint8_t level) const { return trends_[level - 1]; }
+
+    // firmware alarms on (bit per code) and host time each came on (us)
+    uint32_t alarms() const { return alarms_; }
+    double alarmSince(unsigned code) const { return alarm_since_[code]; }
+
+    // open the device (raw, at the baud rate) if it isn't; false if that fails
+    bool open();
+    // use an fd that is already open (a pty from a benchmark); the unit closes it
+    void attach(int fd);
+
+    void handle(uint32_t events) override;
+
+    // decode the frames in `bytes` (for tests and replay); `handle` uses the same path
+    void decode(const uint8_t *bytes, size_t length);
+
+  private:
+    Aggregator &owner_;
+    std::string name_, device_;
+    unsigned baud_;
+    int fd_ = -1;
+    double last_open_ = 0;
+
+    uint8_t input_[INPUT_BUFFER + MAX_FRAME];
+    size_t  used_ = 0;
+
+    UnitStats stats_;
+    double last_frame_ = 0;
+    Ring<WavePoint, WAVE_RING> waves_;
+    Ring<BreathSummary, BREATH_RING> breaths_;
+    TrendSummary trends_[2];
+    bool has_trend_[2] = { false, false };
+    uint32_t alarms_ = 0;
+    double alarm_since_[32] = { };
+
+    void close();
+    size_t parse();
+    void dispatch(uint8_t type, const uint8_t *payload, uint8_t length, double now);
+
+    friend class Aggregator;
+};
+
+// called with every decoded frame, before it is stored (e.g. to time it)
+typedef void (*FrameHook)(void *context, Unit &unit, uint8_t type, const uint8_t *payload, uint8_t length);
+
+class Aggregator {
+  public:
+    Aggregator();
+    ~Aggregator();
+
+    Unit &addDevice(const std::string &device, unsigned baud);
+    Unit &addFd(int fd, const std::string &name);
+
+    // serve the views over HTTP on `port` (all interfaces); false if it can't bind
+    bool listen(uint16_t port);
+
+    // wait up to `timeoutMs` for input and handle what arrives
+    void poll(int timeoutMs);
+
+    void setFrameHook(FrameHook hook, void *context) { hook_ = hook; hook_context_ = context; }
+
+    const std::vector<std::unique_ptr<Unit>> &units() const { return units_; }
+
+    // the views
+    std::string table() const;
+    std::string unitsJson() const;
+    std::string alarmsJson() const;
+    std::string breathsJson(size_t unit, size_t count) const;
+    std::string wavesJson(size_t unit, size_t count) const;
+
+    // the HTTP response to a GET of `path`
+    std::string respond(const std::string &path) const;
+
+  private:
+    int epoll_;
+    int listener_ = -1;
+    std::vector<std::unique_ptr<Unit>> units_;
+    std::vector<Source *> closing_;  // HTTP clients finished this wakeup
+    FrameHook hook_ = nullptr;
+    void *hook_context_ = nullptr;
+    double last_reopen_ = 0;
+
+    class Listener;
+    class Client;
+    std::unique_ptr<Listener> listen_source_;
+
+    void watch(int fd, Source *source, uint32_t events);
+    void unwatch(int fd);
+
+    friend class Unit;
+    friend class Client;
+    friend class Listener;
+};
+
+}  // namespace ventmon
+
+#endif
@@ -0,0 +1,163 @@
+/**
+ * sim-unit.h
+ * The telemetry of one ventilator, generated at the firmware's cadence for
+ * ventmon-sim and ventmon-bench: a WaveBlock every TELEMETRY_WAVE_SAMPLES
+ * 30 ms loops, a BreathSummary then an AlarmState every breath, a TrendSummary
+ * every minute and 15 minutes, and a line of debug text between frames now
+ * and then, as the firmware prints with DEBUG on. Now and then an alarm comes
+ * on or goes off (tidal volume low, circuit leak).
+ *
+ * Times are the unit's own milliseconds; the caller decides how fast they pass.
+ */
+
+#ifndef Sim_Unit_h
+#define Sim_Unit_h
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "aggregator.h"
+
+namespace ventmon {
+
+class SimUnit {
+  public:
+    static const uint32_t LOOP_MS   = 30;      // LOOP_PERIOD
+    static const uint32_t BREATH_MS = 3000;    // 20 breaths/min
+    static const uint32_t INSP_MS   = 1000;    // I:E 1:2
+    static const uint32_t TREND_MS  = 60000;
+
+    explicit SimUnit(unsigned seed, bool text = true) : random_(seed), text_(text) {
+      // units don't breathe in step
+      time_ = random_() % BREATH_MS;
+      breath_start_ = time_ - time_ % BREATH_MS;
+    }
+
+    uint32_t time() const { return time_; }
+
+    /**
+     * Append what the unit sends up to its time `until` (ms) to `out`;
+     * returns the frames appended
+     */
+    unsigned run(uint32_t until, std::vector<uint8_t> &out) {
+      unsigned frames = 0;
+      while (time_ + LOOP_MS <= until) {
+        time_ += LOOP_MS;
+        frames += loop(out);
+      }
+      return frames;
+    }
+
+  private:
+    std::mt19937 random_;
+    bool text_;
+    uint32_t time_ = 0, breath_start_ = 0, breath_ = 0;
+    uint32_t last_trend_ = 0, trend_periods_ = 0;
+    uint32_t alarms_ = 0;
+    WaveBlock block_ = { };
+    float volume_ = 0, tidal_ = 500;
+
+    unsigned loop(std::vector<uint8_t> &out) {
+      unsigned frames = 0;
+      if (time_ - breath_start_ >= BREATH_MS) {
+        breath_start_ += BREATH_MS;
+        frames += endBreath(out);
+      }
+      sample();
+      if (block_.count == TELEMETRY_WAVE_SAMPLES) {
+        frames += frame(TELEMETRY_WAVE, &block_, sizeof(block_), out);
+        block_.count = 0;
+      }
+      if (time_ - last_trend_ >= TREND_MS) {
+        last_trend_ = time_;
+        frames += trend(1, out);
+        if (++trend_periods_ % 15 == 0) frames += trend(2, out);
+      }
+      return frames;
+    }
+
+    void sample() {
+      uint32_t phase = time_ - breath_start_;
+      float inspFlow = 0, expFlow = 0, pressure;
+      if (phase < INSP_MS) {
+        inspFlow = tidal_ * 60 / INSP_MS;                  // cc/ms to SLPM
+        volume_ += inspFlow * LOOP_MS / 60;
+        pressure = 5 + volume_ / 30 + inspFlow / 10;
+      } else {
+        expFlow = volume_ / 300 * 60;                       // tau 0.3 s
+        volume_ -= expFlow * LOOP_MS / 60;
+        pressure = 5 + volume_ / 30;
+      }
+      if (block_.count == 0) block_.time = time_;
+      WaveSample &s = block_.samples[block_.count++];
+      s.interval = block_.count == 1 ? 0 : LOOP_MS;
+      s.inspFlow = lround(inspFlow * 10);
+      s.expFlow = lround(expFlow * 10);
+      s.inspPressure = lround(pressure * 10);
+      s.expPressure = lround((pressure - 0.4f) * 10);
+    }
+
+    unsigned endBreath(std::vector<uint8_t> &out) {
+      unsigned frames = 0;
+      float jitter = std::uniform_real_distribution<float>(-1, 1)(random_);
+      BreathSummary b;
+      b.breath = breath_++;
+      b.time = breath_start_ - BREATH_MS;
+      b.peak = lround((5 + tidal_ / 30 + tidal_ * 6 / INSP_MS + jitter) * 10);
+      b.plateau = lround((5 + tidal_ / 30 + jitter / 2) * 10);
+      b.peep = lround((5 + jitter / 10) * 10);
+      b.volumeInsp = lround(tidal_ + 5 * jitter);
+      b.volumeExp = lround(tidal_ - 10 + 5 * jitter);
+      b.minuteVolume = lround(tidal_ * 20 / 100);
+      b.rate = 200;
+      b.oxygen = breath_ < 10 ? TELEMETRY_UNKNOWN : 210 + lround(jitter * 5);
+      b.compliance = 300;
+      b.resistance = 100;
+      b.triggerDelay = TELEMETRY_UNKNOWN;
+      b.pressureError = TELEMETRY_UNKNOWN;
+      b.leak = lround(20 + jitter * 10);
+      frames += frame(TELEMETRY_BREATH, &b, sizeof(b), out);
+
+      // about one alarm change every 200 breaths
+      if (random_() % 200 == 0) alarms_ ^= 1UL << (random_() % 2 ? 21 : 18);  // ALARM_TIDAL_LOW, ALARM_LEAK
+      AlarmState state = { time_, alarms_ };
+      frames += frame(TELEMETRY_ALARM, &state, sizeof(state), out);
+
+      if (text_ && random_() % 4 == 0) {
+        char line[64];
+        int n = snprintf(line, sizeof(line), "VTi %d VTe %d PIP %d.%d\n",
+                         b.volumeInsp, b.volumeExp, b.peak / 10, b.peak % 10);
+        out.insert(out.end(), line, line + n);
+      }
+      return frames;
+    }
+
+    unsigned trend(uint8_t level, std::vector<uint8_t> &out) {
+      TrendSummary t;
+      memset(&t, 0, sizeof(t));
+      t.level = level;
+      t.time = time_;
+      t.breaths = level == 1 ? 20 : 300;
+      const int16_t means[TELEMETRY_TREND_METRICS] = { 232, 217, 50, 500, 490, 100, 200 };
+      for (int i = 0; i < TELEMETRY_TREND_METRICS; i++) {
+        t.min[i] = means[i] - means[i] / 20;
+        t.mean[i] = means[i];
+        t.max[i] = means[i] + means[i] / 20;
+      }
+      return frame(TELEMETRY_TREND, &t, sizeof(t), out);
+    }
+
+    static unsigned frame(uint8_t type, const void *payload, uint8_t length, std::vector<uint8_t> &out) {
+      uint8_t bytes[MAX_FRAME];
+      size_t n = encodeFrame(type, payload, length, bytes);
+      out.insert(out.end(), bytes, bytes + n);
+      return 1;
+    }
+};
+
+}  // namespace ventmon
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * ventmon-bench.cpp
+ * How many units can one ventmon thread keep up with, and how late are their
+ * frames?
+ *
+ *   ventmon-bench [-n units] [-x speed] [-d seconds]
+ *
+ * A writer thread plays `units` SimUnits (sim-unit.h) at `speed` times real
+ * time into pseudo-terminals, as ventmon-sim does; this thread runs the
+ * Aggregator on the other ends, exactly as ventmon does, and nothing else.
+ * Each frame is timed from when the writer made it to when the aggregator
+ * decoded it (the per-unit FIFOs of send times are matched in order, as the
+ * pty neither loses nor reorders bytes). Reported: frames and bytes per
+ * second, latency percentiles, the aggregator thread's CPU time as a share
+ * of one core, and how often a pty was full (the aggregator falling behind).
+ *
+ * Before that, the decoder alone is timed on a buffer of recorded telemetry,
+ * which bounds the units one core could take at 1x.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim-unit.h"
+
+namespace {
+
+using ventmon::nowUs;
+
+const size_t FIFO_SIZE = 1 << 16;  // frames in flight per unit
+const double WARMUP    = 1e6;      // us before latencies count
+
+// send times of one unit's frames, from the writer thread to this one
+struct SendTimes {
+  double times[FIFO_SIZE];
+  std::atomic<size_t> head{0}, tail{0};
+
+  bool push(double time) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == FIFO_SIZE) return false;
+    times[h % FIFO_SIZE] = time;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(double &time) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    time = times[t % FIFO_SIZE];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+struct BenchUnit {
+  int master = -1;
+  ventmon::SimUnit sim;
+  uint32_t origin;
+  std::vector<uint8_t> pending;
+  SendTimes sent;
+  explicit BenchUnit(unsigned seed) : sim(seed), origin(sim.time()) { }
+};
+
+struct Bench {
+  std::vector<std::unique_ptr<BenchUnit>> units;
+  std::unordered_map<const ventmon::Unit *, BenchUnit *> byUnit;
+  std::vector<float> latencies;     // us
+  double measureFrom = 0;
+  unsigned long unmatched = 0;
+
+  std::atomic<bool> stopping{false};
+  unsigned long stalls = 0;         // writes that found a pty full
+  unsigned long overflows = 0;      // send times lost to a full FIFO
+  unsigned long bytesWritten = 0;
+};
+
+void onFrame(void *context, ventmon::Unit &unit, uint8_t, const uint8_t *, uint8_t) {
+  Bench &bench = *static_cast<Bench *>(context);
+  double sent, now = nowUs();
+  if (!bench.byUnit[&unit]->sent.pop(sent)) {
+    bench.unmatched++;
+  } else if (sent >= bench.measureFrom) {
+    bench.latencies.push_back(now - sent);
+  }
+}
+
+void writer(Bench &bench, double speed) {
+  double start = nowUs();
+  while (!bench.stopping.load()) {
+    usleep(ventmon::SimUnit::LOOP_MS * 1000 / speed);
+    uint32_t elapsed = (nowUs() - start) / 1000 * speed;
+    for (auto &u : bench.units) {
+      BenchUnit &unit = *u;
+      unsigned frames = unit.sim.run(unit.origin + elapsed, unit.pending);
+      double now = nowUs();
+      for (unsigned i = 0; i < frames; i++) {
+        if (!unit.sent.push(now)) bench.overflows++;
+      }
+      if (unit.pending.empty()) continue;
+      ssize_t n = write(unit.master, unit.pending.data(), unit.pending.size());
+      if (n > 0) {
+        bench.bytesWritten += n;
+        unit.pending.erase(unit.pending.begin(), unit.pending.begin() + n);
+      }
+      if (!unit.pending.empty()) bench.stalls++;
+    }
+  }
+}
+
+double threadCpuUs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// the decoder alone, on a few minutes of one unit's telemetry
+void benchDecode() {
+  std::vector<uint8_t> bytes;
+  ventmon::SimUnit sim(1);
+  unsigned frames = sim.run(sim.time() + 10 * 60 * 1000, bytes);
+  double perUnitPerSecond = bytes.size() / 600.0;
+
+  ventmon::Aggregator aggregator;
+  ventmon::Unit unit(aggregator, "decode", "", 0);
+  const int PASSES = 50;
+  double start = threadCpuUs();
+  for (int i = 0; i < PASSES; i++) {
+    unit.decode(bytes.data(), bytes.size());
+  }
+  double us = threadCpuUs() - start;
+  double rate = bytes.size() * PASSES / us * 1e6;
+  printf("decode:  %.1f MB/s, %.2f M frames/s (%.0f B/s per unit at 1x: %.0f units per core)\n",
+         rate / 1e6, frames * PASSES / us, perUnitPerSecond, rate / perUnitPerSecond);
+  if (unit.stats().frames != frames * PASSES || unit.stats().crcErrors) {
+    printf("decode:  %lu of %u frames, %lu CRC errors\n", unit.stats().frames, frames * PASSES, unit.stats().crcErrors);
+  }
+}
+
+float percentile(std::vector<float> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: ventmon-bench [-n units] [-x speed] [-d seconds]\n"
+          "  -n  units (default 100)\n"
+          "  -x  times real time (default 1)\n"
+          "  -d  seconds to run (default 10)\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  unsigned count = 100;
+  double speed = 1, seconds = 10;
+  int c;
+  while ((c = getopt(argc, argv, "n:x:d:h")) != -1) {
+    switch (c) {
+      case 'n': count = atoi(optarg); break;
+      case 'x': speed = atof(optarg); break;
+      case 'd': seconds = atof(optarg); break;
+      default:  usage(); return 2;
+    }
+  }
+  if (count == 0 || speed <= 0 || seconds <= 0) {
+    usage();
+    return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  benchDecode();
+
+  Bench bench;
+  ventmon::Aggregator aggregator;
+  for (unsigned i = 0; i < count; i++) {
+    std::unique_ptr<BenchUnit> unit(new BenchUnit(i + 1));
+    unit->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (unit->master < 0 || grantpt(unit->master) < 0 || unlockpt(unit->master) < 0) {
+      perror("ventmon-bench: pty");
+      return 1;
+    }
+    int slave = open(ptsname(unit->master), O_RDWR | O_NOCTTY);
+    termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) < 0) {
+      perror("ventmon-bench: pty");
+      return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    char name[16];
+    snprintf(name, sizeof(name), "unit%03u", i);
+    bench.byUnit[&aggregator.addFd(slave, name)] = unit.get();
+    bench.units.push_back(std::move(unit));
+  }
+  aggregator.setFrameHook(onFrame, &bench);
+
+  double start = nowUs();
+  bench.measureFrom = start + WARMUP;
+  std::thread feeding(writer, std::ref(bench), speed);
+
+  double cpuStart = 0, end = start + WARMUP + seconds * 1e6;
+  unsigned long bytesStart = 0, framesStart = 0;
+  for (;;) {
+    double now = nowUs();
+    if (now >= end) break;
+    if (cpuStart == 0 && now >= bench.measureFrom) {
+      cpuStart = threadCpuUs();
+      for (const auto &unit : aggregator.units()) {
+        bytesStart += unit->stats().bytes;
+        framesStart += unit->stats().frames;
+      }
+    }
+    aggregator.poll(10);
+  }
+  double cpu = threadCpuUs() - cpuStart;
+  bench.stopping.store(true);
+  feeding.join();
+
+  unsigned long bytes = 0, frames = 0, crcErrors = 0, badFrames = 0;
+  for (const auto &unit : aggregator.units()) {
+    bytes += unit->stats().bytes;
+    frames += unit->stats().frames;
+    crcErrors += unit->stats().crcErrors;
+    badFrames += unit->stats().badFrames;
+  }
+  bytes -= bytesStart;
+  frames -= framesStart;
+
+  double viewStart = nowUs();
+  size_t viewBytes = aggregator.respond("/").size() + aggregator.respond("/units").size() +
+                     aggregator.respond("/alarms").size();
+  double viewUs = nowUs() - viewStart;
+
+  std::sort(bench.latencies.begin(), bench.latencies.end());
+  printf("units:   %u at %gx for %g s\n", count, speed, seconds);
+  printf("input:   %.0f frames/s, %.1f kB/s\n", frames / seconds, bytes / seconds / 1e3);
+  printf("latency: p50 %.0f us, p99 %.0f us, max %.0f us (%zu frames)\n",
+         percentile(bench.latencies, 0.5), percentile(bench.latencies, 0.99),
+         bench.latencies.empty() ? 0 : bench.latencies.back(), bench.latencies.size());
+  printf("cpu:     %.1f%% of one core\n", cpu / (seconds * 1e6) * 100);
+  printf("views:   %.0f us for /, /units and /alarms (%zu bytes)\n", viewUs, viewBytes);
+  printf("errors:  %lu CRC, %lu bad frames, %lu unmatched, %lu pty full, %lu send times lost\n",
+         crcErrors, badFrames, bench.unmatched, bench.stalls, bench.overflows);
+  return crcErrors || badFrames || bench.unmatched ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+/**
+ * ventmon-sim.cpp
+ * Simulated units for trying ventmon without a ward of ventilators.
+ *
+ *   ventmon-sim [-n units] [-x speed] [-d dir] [-c corrupt]
+ *
+ * Each unit is a pseudo-terminal, linked as <dir>/unitNNN, carrying the
+ * telemetry of a SimUnit (sim-unit.h) at `speed` times real time. With -c,
+ * one write in that many has a byte flipped, to exercise resynchronisation.
+ * Stop a unit with `kill -STOP` to see it go "No Data".
+ *
+ *   ventmon-sim -n 100 -d /tmp/ventmon-sim &
+ *   ventmon /tmp/ventmon-sim/unit*
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sim-unit.h"
+
+namespace {
+
+volatile sig_atomic_t stopping = 0;
+
+void onSignal(int) {
+  stopping = 1;
+}
+
+struct Pty {
+  int master = -1;
+  std::string link;
+  std::vector<uint8_t> pending;
+};
+
+bool openPty(Pty &pty) {
+  pty.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (pty.master < 0 || grantpt(pty.master) < 0 || unlockpt(pty.master) < 0) {
+    perror("ventmon-sim: pty");
+    return false;
+  }
+  const char *slave = ptsname(pty.master);
+
+  // raw bytes, as on a UART
+  int fd = open(slave, O_RDWR | O_NOCTTY);
+  termios tio;
+  if (fd >= 0 && tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  if (fd >= 0) close(fd);
+
+  unlink(pty.link.c_str());
+  if (symlink(slave, pty.link.c_str()) < 0) {
+    perror("ventmon-sim: link");
+    return false;
+  }
+  return true;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: ventmon-sim [-n units] [-x speed] [-d dir] [-c corrupt]\n"
+          "  -n  units (default 10)\n"
+          "  -x  times real time (default 1)\n"
+          "  -d  directory for the unitNNN links (default /tmp/ventmon-sim)\n"
+          "  -c  flip a byte in one write in that many\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  unsigned units = 10, corrupt = 0;
+  double speed = 1;
+  std::string dir = "/tmp/ventmon-sim";
+  int c;
+  while ((c = getopt(argc, argv, "n:x:d:c:h")) != -1) {
+    switch (c) {
+      case 'n': units = atoi(optarg); break;
+      case 'x': speed = atof(optarg); break;
+      case 'd': dir = optarg; break;
+      case 'c': corrupt = atoi(optarg); break;
+      default:  usage(); return 2;
+    }
+  }
+  if (units == 0 || speed <= 0) {
+    usage();
+    return 2;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  mkdir(dir.c_str(), 0755);
+
+  std::vector<Pty> ptys(units);
+  std::vector<ventmon::SimUnit> sims;
+  std::vector<uint32_t> origins;  // each unit's time at the start
+  for (unsigned i = 0; i < units; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "/unit%03u", i);
+    ptys[i].link = dir + name;
+    if (!openPty(ptys[i])) return 1;
+    sims.emplace_back(i + 1);
+    origins.push_back(sims.back().time());
+  }
+  printf("%u units in %s\n", units, dir.c_str());
+  fflush(stdout);
+
+  std::mt19937 random(1);
+  double start = ventmon::nowUs();
+  unsigned long dropped = 0;
+  while (!stopping) {
+    usleep(ventmon::SimUnit::LOOP_MS * 1000 / speed);
+    double elapsed = (ventmon::nowUs() - start) / 1000 * speed;
+    for (unsigned i = 0; i < units; i++) {
+      Pty &pty = ptys[i];
+      size_t before = pty.pending.size();
+      sims[i].run(origins[i] + (uint32_t)elapsed, pty.pending);
+      if (corrupt && pty.pending.size() > before && random() % corrupt == 0) {
+        pty.pending[before + random() % (pty.pending.size() - before)] ^= 0x10;
+      }
+      if (pty.pending.empty()) continue;
+
+      // nobody reading: the pty fills up and the unit's output is lost, as on a serial line
+      ssize_t n = write(pty.master, pty.pending.data(), pty.pending.size());
+      if (n > 0) {
+        pty.pending.erase(pty.pending.begin(), pty.pending.begin() + n);
+      } else if (n < 0 && errno != EAGAIN && errno != EIO) {
+        perror("ventmon-sim: write");
+        return 1;
+      }
+      if (pty.pending.size() > 65536) {
+        dropped += pty.pending.size();
+        pty.pending.clear();
+      }
+    }
+  }
+
+  for (Pty &pty : ptys) unlink(pty.link.c_str());
+  if (dropped) fprintf(stderr, "ventmon-sim: %lu bytes dropped with nobody reading\n", dropped);
+  return 0;
+}
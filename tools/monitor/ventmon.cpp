@@ -0,0 +1,80 @@
+/**
+ * ventmon.cpp
+ * Central monitor: gathers the telemetry of many ventilators and serves the
+ * consolidated view (see aggregator.h).
+ *
+ *   ventmon [-p port] [-b baud] [-s seconds] <tty>...
+ *
+ * Each tty is a unit's debug serial port with telemetry on (`telemetry on`).
+ * With -s the text table is printed every that many seconds as well.
+ */
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "aggregator.h"
+
+namespace {
+
+volatile sig_atomic_t stopping = 0;
+
+void onSignal(int) {
+  stopping = 1;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: ventmon [-p port] [-b baud] [-s seconds] <tty>...\n"
+          "  -p  HTTP port for the views (default 8080, 0 for none)\n"
+          "  -b  baud rate of the ttys (default 115200)\n"
+          "  -s  print the table every that many seconds\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  unsigned port = 8080, baud = 115200;
+  double status = 0;
+  int c;
+  while ((c = getopt(argc, argv, "p:b:s:h")) != -1) {
+    switch (c) {
+      case 'p': port = atoi(optarg); break;
+      case 'b': baud = atoi(optarg); break;
+      case 's': status = atof(optarg); break;
+      default:  usage(); return 2;
+    }
+  }
+  if (optind == argc) {
+    usage();
+    return 2;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  ventmon::Aggregator aggregator;
+  for (int i = optind; i < argc; i++) {
+    aggregator.addDevice(argv[i], baud);
+  }
+  if (port && !aggregator.listen(port)) {
+    perror("ventmon: listen");
+    return 1;
+  }
+  fprintf(stderr, "ventmon: %zu units%s", aggregator.units().size(), port ? "" : "\n");
+  if (port) fprintf(stderr, ", http://localhost:%u/\n", port);
+
+  double next_status = ventmon::nowUs() + status * 1e6;
+  while (!stopping) {
+    aggregator.poll(100);
+    if (status > 0 && ventmon::nowUs() >= next_status) {
+      next_status += status * 1e6;
+      printf("%s\n", aggregator.table().c_str());
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,207 @@
+/**
+ * nextion-bench.cpp
+ * Drives a Nextion (or nextion-emu) with the firmware's display traffic and
+ * measures what it costs the control loop.
+ *
+ *   nextion-bench [-d seconds] [-p loop ms] [-B breath ms] [-n] <tty>
+ *
+ * Every loop period the two waveform points are sent with `add`, without
+ * waiting, as Display::updateFlowWave/updatePressureWave do. Every breath the
+ * ten patient-data fields are written as reportLastBreath does, each waiting
+ * for its 0x01 like FlashText (100 ms timeout): as text (`t12.txt=" 12.5"`),
+ * or with -n as numbers (`x12.val=125`). The time a breath's writes take is
+ * time the control loop is stalled.
+ *
+ * With bkcmd=1 the panel also answers every `add` with 0x01. The library
+ * drops whatever has arrived before each command, so a late one can be taken
+ * for the reply to a field write; here the replies still owed are counted
+ * and skipped so that each write is timed to its own reply.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+const int    REPLY_TIMEOUT = 100;  // ms, as recvRetCommandFinished
+const int    FLOW_WAVE = 12, PRESSURE_WAVE = 37;
+const int    FIELDS = 10;
+const char  *fieldIds[FIELDS] = { "12", "13", "14", "16", "18", "19", "28", "17", "20", "21" };
+const int    fieldTenths[FIELDS] = { 253, 198, 51, 4990, 4870, 74, 200, 210, 251, 123 };
+
+int tty = -1;
+unsigned long bytesSent = 0;
+unsigned long owed = 0;  // replies to fire-and-forget commands not read yet
+
+double nowUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void send(const std::string &command) {
+  std::string bytes = command + "\xFF\xFF\xFF";
+  if (write(tty, bytes.data(), bytes.size()) < 0) {
+    perror("nextion-bench: write");
+    exit(1);
+  }
+  bytesSent += bytes.size();
+}
+
+void drain() {
+  uint8_t junk[256];
+  while (read(tty, junk, sizeof(junk)) > 0) { }
+}
+
+// read one 4-byte return code; false on timeout or anything but success
+bool finished() {
+  uint8_t ret[4];
+  size_t got = 0;
+  double deadline = nowUs() + REPLY_TIMEOUT * 1000.0;
+  while (got < sizeof(ret)) {
+    int left = int((deadline - nowUs()) / 1000);
+    pollfd p = { tty, POLLIN, 0 };
+    if (left <= 0 || poll(&p, 1, left) <= 0) return false;
+    ssize_t n = read(tty, ret + got, sizeof(ret) - got);
+    if (n > 0) got += n;
+  }
+  return ret[0] == 0x01 && ret[1] == 0xFF && ret[2] == 0xFF && ret[3] == 0xFF;
+}
+
+// wait for the reply to the last command, after any still owed
+bool replied() {
+  for (; owed > 0; owed--) {
+    if (!finished()) {
+      owed = 0;
+      return false;
+    }
+  }
+  return finished();
+}
+
+std::string fixedText(int tenths, int width) {
+  char text[16];
+  snprintf(text, sizeof(text), "%*d.%d", width - 2, tenths / 10, tenths % 10);
+  return text;
+}
+
+struct Summary {
+  std::vector<double> v;
+  void add(double x) { v.push_back(x); }
+  double at(double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, size_t(p * v.size()))];
+  }
+  double mean() const {
+    double sum = 0;
+    for (double x : v) sum += x;
+    return v.empty() ? 0 : sum / v.size();
+  }
+};
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  double seconds = 30, loopMs = 30, breathMs = 3000;
+  bool numeric = false;
+  int c;
+  while ((c = getopt(argc, argv, "d:p:B:n")) != -1) {
+    switch (c) {
+      case 'd': seconds = atof(optarg); break;
+      case 'p': loopMs = atof(optarg); break;
+      case 'B': breathMs = atof(optarg); break;
+      case 'n': numeric = true; break;
+      default:
+        fprintf(stderr, "usage: nextion-bench [-d seconds] [-p loop ms] [-B breath ms] [-n] <tty>\n");
+        return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: nextion-bench [-d seconds] [-p loop ms] [-B breath ms] [-n] <tty>\n");
+    return 2;
+  }
+
+  tty = open(argv[optind], O_RDWR | O_NOCTTY | O_NONBLOCK);
+  termios tio;
+  if (tty < 0 || tcgetattr(tty, &tio) < 0) {
+    perror("nextion-bench: open");
+    return 1;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(tty, TCSANOW, &tio);
+
+  // as nexInit
+  send("");
+  usleep(50000);
+  drain();
+  send("bkcmd=1");
+  bool ok = replied();
+  send("page 0");
+  ok = replied() && ok;
+  if (!ok) {
+    fprintf(stderr, "nextion-bench: no reply to bkcmd/page\n");
+    return 1;
+  }
+
+  Summary writes, breaths, loops;
+  unsigned long timeouts = 0, breathCount = 0;
+  double start = nowUs(), end = start + seconds * 1e6;
+  double nextLoop = start, nextBreath = start + breathMs * 1000;
+  unsigned long step = 0;
+  bytesSent = 0;
+
+  while (nowUs() < end) {
+    double wait = nextLoop - nowUs();
+    if (wait > 0) usleep(useconds_t(wait));
+    double loopStart = nowUs();
+    nextLoop += loopMs * 1000;
+
+    step++;
+    send("add " + std::to_string(FLOW_WAVE) + ",0," + std::to_string(128 + int(100 * (step % 100 < 30))));
+    send("add " + std::to_string(PRESSURE_WAVE) + ",0," + std::to_string(30 + int(step % 50)));
+    owed += 2;
+
+    if (loopStart >= nextBreath) {
+      nextBreath += breathMs * 1000;
+      breathCount++;
+      double breathStart = nowUs();
+      for (int i = 0; i < FIELDS; i++) {
+        double t = nowUs();
+        if (numeric) {
+          send(std::string("x") + fieldIds[i] + ".val=" + std::to_string(fieldTenths[i]));
+        } else {
+          send(std::string("t") + fieldIds[i] + ".txt=\"" + fixedText(fieldTenths[i], 5) + "\"");
+        }
+        if (!replied()) timeouts++;
+        writes.add(nowUs() - t);
+      }
+      breaths.add(nowUs() - breathStart);
+    }
+    loops.add(nowUs() - loopStart);
+  }
+
+  double elapsed = (nowUs() - start) / 1e6;
+  printf("%s fields, %.0f s, %lu breaths, %lu loops\n", numeric ? "numeric" : "text", elapsed, breathCount, step);
+  printf("sent %.0f B/s\n", bytesSent / elapsed);
+  printf("field write:  mean %7.0f us  p50 %7.0f  p99 %7.0f  max %7.0f  timeouts %lu\n",
+         writes.mean(), writes.at(0.5), writes.at(0.99), writes.at(1), timeouts);
+  printf("breath stall: mean %7.0f us  p50 %7.0f  p99 %7.0f  max %7.0f\n",
+         breaths.mean(), breaths.at(0.5), breaths.at(0.99), breaths.at(1));
+  printf("loop:         mean %7.0f us  p50 %7.0f  p99 %7.0f  max %7.0f\n",
+         loops.mean(), loops.at(0.5), loops.at(0.99), loops.at(1));
+  close(tty);
+  return timeouts > 0;
+}
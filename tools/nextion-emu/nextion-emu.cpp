@@ -0,0 +1,559 @@
+/**
+ * nextion-emu.cpp
+ * A Nextion HMI protocol emulator behind a Linux pseudo-terminal, for
+ * measuring the display path without a panel.
+ *
+ *   nextion-emu [-b baud] [-l latency us] [-r redraw us] [-k bkcmd] [-L link] [-o csv] [-v] [-1]
+ *
+ * Commands are read as the panel reads them (terminated by 0xFF 0xFF 0xFF):
+ * add, addt (with its transparent data), cle, get, vis, ref, page, sendme,
+ * bkcmd=, and <object>.<attribute>=<value> assignments. Replies and return
+ * codes follow the Nextion instruction set, including the bkcmd reporting
+ * level (2, failures only, at power-up).
+ *
+ * Timing is simulated on a virtual clock: bytes in each direction take 10 bit
+ * times at the baud rate, each command takes `latency` to process (plus
+ * `redraw` for the ones that redraw something), and commands queue behind
+ * each other as on the panel, which drops input with 0x24 once its 1 KB
+ * serial buffer is full. Replies are written to the pty when the simulated
+ * panel would have finished sending them.
+ *
+ * Every command is timed from its first byte arriving to the panel being done
+ * with it (its reply sent, if any). A table of count, bytes and latency per
+ * command is printed on exit (SIGINT/SIGTERM, or hangup with -1); -o also
+ * writes one CSV line per command.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+// return codes
+const uint8_t INVALID_INSTRUCTION = 0x00;
+const uint8_t SUCCESS             = 0x01;
+const uint8_t INVALID_PAGE        = 0x03;
+const uint8_t INVALID_WAVEFORM    = 0x12;
+const uint8_t INVALID_VARIABLE    = 0x1A;
+const uint8_t INVALID_OPERATION   = 0x1B;
+const uint8_t INVALID_PARAMETERS  = 0x1E;
+const uint8_t BUFFER_OVERFLOW     = 0x24;
+const uint8_t STRING_DATA         = 0x70;
+const uint8_t NUMERIC_DATA        = 0x71;
+const uint8_t CURRENT_PAGE        = 0x66;
+const uint8_t TRANSPARENT_DONE    = 0xFD;
+const uint8_t TRANSPARENT_READY   = 0xFE;
+
+const size_t  INPUT_BUFFER = 1024;  // the panel's serial buffer
+const size_t  MAX_COMMAND  = 1024;
+const uint8_t PAGES        = 10;
+
+struct Options {
+  unsigned    baud = 115200;
+  unsigned    latency = 200;   // us to process any command
+  unsigned    redraw = 2000;   // extra us for commands that redraw
+  int         bkcmd = 2;
+  const char *link = nullptr;
+  const char *csv = nullptr;
+  bool        verbose = false;
+  bool        once = false;
+};
+
+struct Object {
+  std::string text;
+  std::map<std::string, int32_t> numbers;  // val, bco, pco, ...
+  bool visible = true;
+};
+
+struct Stats {
+  unsigned long count = 0;
+  unsigned long errors = 0;
+  unsigned long bytesIn = 0;
+  unsigned long bytesOut = 0;
+  std::vector<double> latency;  // us
+};
+
+struct Pending {
+  double due;                   // virtual time the last byte is sent (us)
+  std::vector<uint8_t> bytes;
+};
+
+volatile sig_atomic_t stopping = 0;
+
+void onSignal(int) { stopping = 1; }
+
+double nowUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+std::string trim(const std::string &s) {
+  size_t begin = s.find_first_not_of(' ');
+  if (begin == std::string::npos) return "";
+  return s.substr(begin, s.find_last_not_of(' ') - begin + 1);
+}
+
+std::vector<std::string> split(const std::string &s, char sep) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  for (;;) {
+    size_t end = s.find(sep, start);
+    parts.push_back(trim(s.substr(start, end - start)));
+    if (end == std::string::npos) return parts;
+    start = end + 1;
+  }
+}
+
+bool parseNumber(const std::string &s, long &value) {
+  if (s.empty()) return false;
+  char *end;
+  value = strtol(s.c_str(), &end, 10);
+  return *end == '\0';
+}
+
+class Panel {
+  public:
+    explicit Panel(const Options &options) : opt_(options), byteUs_(10e6 / options.baud), bkcmd_(options.bkcmd) { }
+
+    bool open();
+    int fd() const { return master_; }
+
+    // feed bytes read from the pty
+    void receive(const uint8_t *bytes, size_t length, double now);
+
+    // write replies that are due; returns ms until the next one (-1 if none)
+    int flush(double now);
+
+    void report(FILE *out) const;
+
+  private:
+    Options opt_;
+    double  byteUs_;
+    int     master_ = -1;
+    FILE   *csv_ = nullptr;
+    double  start_ = nowUs();
+
+    // receive side
+    std::vector<uint8_t> command_;
+    uint8_t terminators_ = 0;
+    double  firstByte_ = 0;     // real time the command's first byte arrived
+    double  inClock_ = 0;       // virtual time the last byte finished arriving
+    size_t  transparent_ = 0;   // addt data bytes still expected
+
+    // processing and send side
+    double  busyUntil_ = 0;
+    double  outClock_ = 0;
+    std::deque<std::pair<double, size_t>> queued_;  // virtual start of processing, bytes, for the input buffer
+    std::deque<Pending> pending_;
+
+    int     bkcmd_;
+    uint8_t page_ = 0;
+    std::map<std::string, Object> objects_;
+    std::map<std::string, Stats> stats_;
+
+    void execute(const std::string &command, size_t bytes, double received);
+    uint8_t run(const std::string &command, std::string &key, std::vector<uint8_t> &data, bool &redraws);
+    uint8_t assign(const std::string &command, std::string &key);
+    uint8_t get(const std::string &target, std::vector<uint8_t> &data);
+    void reply(std::vector<uint8_t> bytes, double at);
+    static void terminate(std::vector<uint8_t> &bytes);
+};
+
+bool Panel::open() {
+  master_ = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_ < 0 || grantpt(master_) < 0 || unlockpt(master_) < 0) {
+    perror("nextion-emu: pty");
+    return false;
+  }
+  const char *slave = ptsname(master_);
+
+  // raw bytes in both directions, as on a UART
+  int fd = ::open(slave, O_RDWR | O_NOCTTY);
+  termios tio;
+  if (fd >= 0 && tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  if (fd >= 0) close(fd);
+
+  if (opt_.link) {
+    unlink(opt_.link);
+    if (symlink(slave, opt_.link) < 0) {
+      perror("nextion-emu: link");
+      return false;
+    }
+  }
+  if (opt_.csv) {
+    csv_ = fopen(opt_.csv, "w");
+    if (!csv_) {
+      perror("nextion-emu: csv");
+      return false;
+    }
+    fprintf(csv_, "time_us,command,bytes_in,bytes_out,code,latency_us\n");
+  }
+  printf("%s\n", opt_.link ? opt_.link : slave);
+  fflush(stdout);
+  return true;
+}
+
+void Panel::receive(const uint8_t *bytes, size_t length, double now) {
+  for (size_t i = 0; i < length; i++) {
+    inClock_ = std::max(inClock_, now) + byteUs_;
+
+    if (transparent_ > 0) {
+      if (--transparent_ == 0) {
+        std::vector<uint8_t> done = { TRANSPARENT_DONE };
+        terminate(done);
+        reply(done, std::max(busyUntil_, inClock_));
+      }
+      continue;
+    }
+
+    if (command_.empty() && terminators_ == 0) firstByte_ = now;
+    if (bytes[i] == 0xFF) {
+      if (++terminators_ < 3) continue;
+      std::string command(command_.begin(), command_.end());
+      size_t total = command_.size() + 3;
+      command_.clear();
+      terminators_ = 0;
+      execute(command, total, inClock_);
+      continue;
+    }
+    // a lone 0xFF inside a command is data
+    while (terminators_ > 0) {
+      command_.push_back(0xFF);
+      terminators_--;
+    }
+    if (command_.size() < MAX_COMMAND) command_.push_back(bytes[i]);
+  }
+}
+
+void Panel::execute(const std::string &command, size_t bytes, double received) {
+  // bytes still waiting in the panel's buffer when this command arrived
+  while (!queued_.empty() && queued_.front().first <= received) queued_.pop_front();
+  size_t buffered = 0;
+  for (auto &q : queued_) buffered += q.second;
+
+  std::string key;
+  std::vector<uint8_t> data;
+  bool redraws = false;
+  bool always = false;  // the code is sent whatever bkcmd says
+  uint8_t code;
+  double begin = std::max(busyUntil_, received);
+
+  if (buffered + bytes > INPUT_BUFFER) {
+    key = "(overflow)";
+    code = BUFFER_OVERFLOW;
+    always = true;
+  } else {
+    code = run(command, key, data, redraws);
+    busyUntil_ = begin + opt_.latency + (redraws ? opt_.redraw : 0);
+    queued_.push_back(std::make_pair(begin, bytes));
+  }
+
+  size_t sent = 0;
+  bool success = code == SUCCESS;
+  if (!data.empty()) {
+    sent = data.size();
+    reply(data, busyUntil_);
+  } else if (always || (success && (bkcmd_ == 1 || bkcmd_ == 3)) || (!success && bkcmd_ >= 2)) {
+    std::vector<uint8_t> ret = { code };
+    terminate(ret);
+    sent = ret.size();
+    reply(ret, std::max(busyUntil_, received));
+  }
+  double done = sent > 0 ? outClock_ : std::max(busyUntil_, received);
+
+  Stats &s = stats_[key];
+  s.count++;
+  s.errors += !success;
+  s.bytesIn += bytes;
+  s.bytesOut += sent;
+  s.latency.push_back(done - firstByte_);
+
+  if (csv_) {
+    fprintf(csv_, "%.0f,%s,%zu,%zu,0x%02X,%.0f\n", firstByte_ - start_, key.c_str(), bytes, sent, code, done - firstByte_);
+  }
+  if (opt_.verbose) {
+    fprintf(stderr, "%-24.24s -> 0x%02X %8.0f us\n", command.c_str(), code, done - firstByte_);
+  }
+}
+
+/**
+ * Carry out one command. `key` names it in the statistics and `data` is
+ * filled for commands that always answer (get, sendme, addt).
+ */
+uint8_t Panel::run(const std::string &command, std::string &key, std::vector<uint8_t> &data, bool &redraws) {
+  size_t space = command.find(' ');
+  std::string name = command.substr(0, space);
+  std::string args = space == std::string::npos ? "" : command.substr(space + 1);
+  std::vector<std::string> params = split(args, ',');
+  key = name;
+
+  if (command.empty()) {
+    key = "(empty)";
+    return INVALID_INSTRUCTION;
+  }
+
+  if (name == "add" || name == "addt" || name == "cle") {
+    long cid, channel, value = 0;
+    size_t expected = name == "cle" ? 2 : 3;
+    if (params.size() != expected) return INVALID_PARAMETERS;
+    if (!parseNumber(params[0], cid) || !parseNumber(params[1], channel) ||
+        (expected == 3 && !parseNumber(params[2], value))) {
+      return INVALID_OPERATION;
+    }
+    bool allChannels = name == "cle" && channel == 255;
+    if (cid < 0 || cid > 255 || ((channel < 0 || channel > 3) && !allChannels)) return INVALID_WAVEFORM;
+    if (name == "add" && (value < 0 || value > 255)) return INVALID_OPERATION;
+    if (name == "addt") {
+      if (value <= 0 || value > 1024) return INVALID_OPERATION;
+      transparent_ = value;
+      data = { TRANSPARENT_READY };
+      terminate(data);
+    }
+    return SUCCESS;
+  }
+
+  if (name == "get") {
+    return get(args, data);
+  }
+
+  if (name == "vis") {
+    if (params.size() != 2) return INVALID_PARAMETERS;
+    long on;
+    if (!parseNumber(params[1], on)) return INVALID_OPERATION;
+    redraws = true;
+    if (params[0] == "255") {
+      for (auto &o : objects_) o.second.visible = on != 0;
+    } else {
+      objects_[params[0]].visible = on != 0;
+    }
+    return SUCCESS;
+  }
+
+  if (name == "ref") {
+    if (params.size() != 1 || params[0].empty()) return INVALID_PARAMETERS;
+    redraws = true;
+    return SUCCESS;
+  }
+
+  if (name == "page") {
+    long page;
+    if (params.size() != 1) return INVALID_PARAMETERS;
+    if (!parseNumber(params[0], page) || page < 0 || page >= PAGES) return INVALID_PAGE;
+    page_ = page;
+    redraws = true;
+    return SUCCESS;
+  }
+
+  if (name == "sendme") {
+    data = { CURRENT_PAGE, page_ };
+    terminate(data);
+    return SUCCESS;
+  }
+
+  if (command.find('=') != std::string::npos) {
+    return assign(command, key);
+  }
+
+  key = "(unknown)";
+  return INVALID_INSTRUCTION;
+}
+
+/**
+ * <object>.<attribute>=<value>, or a system variable such as bkcmd=1
+ */
+uint8_t Panel::assign(const std::string &command, std::string &key) {
+  size_t equals = command.find('=');
+  std::string target = trim(command.substr(0, equals));
+  std::string value = trim(command.substr(equals + 1));
+  size_t dot = target.find('.');
+
+  if (dot == std::string::npos) {
+    key = target + "=";
+    long number;
+    if (!parseNumber(value, number)) return INVALID_OPERATION;
+    if (target == "bkcmd") {
+      if (number < 0 || number > 3) return INVALID_OPERATION;
+      bkcmd_ = number;
+    }
+    return SUCCESS;  // dim, sleep, baud, ... are accepted without effect
+  }
+
+  std::string object = target.substr(0, dot);
+  std::string attribute = target.substr(dot + 1);
+  key = "." + attribute + "=";
+  if (object.empty() || attribute.empty()) return INVALID_VARIABLE;
+
+  if (attribute == "txt") {
+    if (value.size() < 2 || value.front() != '"' || value.back() != '"') return INVALID_OPERATION;
+    objects_[object].text = value.substr(1, value.size() - 2);
+    return SUCCESS;
+  }
+
+  long number;
+  if (!parseNumber(value, number)) return INVALID_OPERATION;
+  objects_[object].numbers[attribute] = number;
+  return SUCCESS;
+}
+
+uint8_t Panel::get(const std::string &target, std::vector<uint8_t> &data) {
+  std::string t = trim(target);
+  size_t dot = t.find('.');
+  auto found = dot == std::string::npos ? objects_.end() : objects_.find(t.substr(0, dot));
+  if (found == objects_.end()) return INVALID_VARIABLE;
+
+  std::string attribute = t.substr(dot + 1);
+  if (attribute == "txt") {
+    data.push_back(STRING_DATA);
+    data.insert(data.end(), found->second.text.begin(), found->second.text.end());
+  } else {
+    auto number = found->second.numbers.find(attribute);
+    if (number == found->second.numbers.end()) return INVALID_VARIABLE;
+    uint32_t v = number->second;
+    data = { NUMERIC_DATA, uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) };
+  }
+  terminate(data);
+  return SUCCESS;
+}
+
+void Panel::terminate(std::vector<uint8_t> &bytes) {
+  bytes.insert(bytes.end(), 3, 0xFF);
+}
+
+/**
+ * Queue `bytes` to go out once the panel is ready at `at` and the previous
+ * reply has been sent
+ */
+void Panel::reply(std::vector<uint8_t> bytes, double at) {
+  outClock_ = std::max(outClock_, at) + bytes.size() * byteUs_;
+  pending_.push_back(Pending { outClock_, bytes });
+}
+
+int Panel::flush(double now) {
+  while (!pending_.empty() && pending_.front().due <= now) {
+    const std::vector<uint8_t> &bytes = pending_.front().bytes;
+    if (write(master_, bytes.data(), bytes.size()) < 0 && errno != EIO) {
+      perror("nextion-emu: write");
+    }
+    pending_.pop_front();
+  }
+  if (pending_.empty()) return -1;
+  return int((pending_.front().due - now) / 1000) + 1;
+}
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  size_t i = std::min(v.size() - 1, size_t(p * v.size()));
+  std::nth_element(v.begin(), v.begin() + i, v.end());
+  return v[i];
+}
+
+void Panel::report(FILE *out) const {
+  double seconds = (nowUs() - start_) / 1e6;
+  unsigned long totalIn = 0, totalOut = 0;
+  fprintf(out, "%-12s %8s %6s %10s %10s %10s %10s %10s %10s\n",
+          "command", "count", "errors", "bytes in", "bytes out", "mean us", "p50 us", "p99 us", "max us");
+  for (auto &entry : stats_) {
+    const Stats &s = entry.second;
+    double sum = 0, max = 0;
+    for (double l : s.latency) {
+      sum += l;
+      max = std::max(max, l);
+    }
+    fprintf(out, "%-12s %8lu %6lu %10lu %10lu %10.0f %10.0f %10.0f %10.0f\n",
+            entry.first.c_str(), s.count, s.errors, s.bytesIn, s.bytesOut,
+            sum / s.count, percentile(s.latency, 0.5), percentile(s.latency, 0.99), max);
+    totalIn += s.bytesIn;
+    totalOut += s.bytesOut;
+  }
+  double capacity = opt_.baud / 10.0;
+  fprintf(out, "%.1f s: %.0f B/s in (%.1f%% of the link), %.0f B/s out (%.1f%%)\n", seconds,
+          totalIn / seconds, 100 * totalIn / seconds / capacity,
+          totalOut / seconds, 100 * totalOut / seconds / capacity);
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: nextion-emu [-b baud] [-l latency us] [-r redraw us] [-k bkcmd] [-L link] [-o csv] [-v] [-1]\n"
+          "  -b  simulated baud rate (115200)\n"
+          "  -l  processing time of every command (200 us)\n"
+          "  -r  extra time for commands that redraw: vis, ref, page (2000 us)\n"
+          "  -k  bkcmd level at power-up (2)\n"
+          "  -L  symlink to create to the pty\n"
+          "  -o  write one CSV line per command\n"
+          "  -v  print every command\n"
+          "  -1  exit when the host closes the pty\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  int c;
+  while ((c = getopt(argc, argv, "b:l:r:k:L:o:v1h")) != -1) {
+    switch (c) {
+      case 'b': opt.baud = strtoul(optarg, nullptr, 10); break;
+      case 'l': opt.latency = strtoul(optarg, nullptr, 10); break;
+      case 'r': opt.redraw = strtoul(optarg, nullptr, 10); break;
+      case 'k': opt.bkcmd = atoi(optarg); break;
+      case 'L': opt.link = optarg; break;
+      case 'o': opt.csv = optarg; break;
+      case 'v': opt.verbose = true; break;
+      case '1': opt.once = true; break;
+      default:  usage(); return 2;
+    }
+  }
+  if (opt.baud == 0 || opt.bkcmd < 0 || opt.bkcmd > 3) {
+    usage();
+    return 2;
+  }
+
+  Panel panel(opt);
+  if (!panel.open()) return 1;
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  bool connected = false;
+  uint8_t bytes[4096];
+  while (!stopping) {
+    int timeout = panel.flush(nowUs());
+    pollfd p = { panel.fd(), POLLIN, 0 };
+    int ready = poll(&p, 1, timeout < 0 ? 100 : std::min(timeout, 100));
+    if (ready < 0 && errno != EINTR) break;
+    if (ready <= 0) continue;
+
+    if (p.revents & POLLHUP) {
+      // nobody has the pty open (yet, or any more)
+      if (connected && opt.once) break;
+      usleep(10000);
+      continue;
+    }
+    ssize_t n = read(panel.fd(), bytes, sizeof(bytes));
+    if (n > 0) {
+      connected = true;
+      panel.receive(bytes, n, nowUs());
+    }
+  }
+
+  panel.report(stdout);
+  if (opt.link) unlink(opt.link);
+  return 0;
+}
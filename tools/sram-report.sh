@@ -0,0 +1,42 @@
+#!/bin/sh
+# Build-time SRAM report for the firmware: static use (.data + .bss) against
+# the ATmega2560's 8 KB, and the largest symbols in SRAM. String literals that
+# were not moved to flash show up here as .data.
+#
+#   tools/sram-report.sh [firmware.elf]
+#
+# Without an ELF the sketch is built with arduino-cli (the repository must be
+# checked out as a directory named circuit-control). Fails if static use is
+# over SRAM_BUDGET bytes, so the rest is left for the stack and heap.
+set -e
+
+MCU=atmega2560
+SRAM_BUDGET=${SRAM_BUDGET:-6144}
+TOP=${TOP:-25}
+
+if [ $# -ge 1 ]; then
+  elf=$1
+else
+  sketch=$(cd "$(dirname "$0")/.." && pwd)
+  out=$(mktemp -d)
+  arduino-cli compile --fqbn arduino:avr:mega --output-dir "$out" "$sketch" >/dev/null
+  elf="$out/circuit-control.ino.elf"
+fi
+
+avr-size -C --mcu=$MCU "$elf"
+
+echo "largest SRAM symbols (bytes, section, name):"
+avr-nm -C -S -t d --size-sort -r "$elf" | awk -v top="$TOP" '
+  $3 ~ /^[bBdD]$/ && shown < top {
+    size = $2 + 0; kind = ($3 ~ /[dD]/) ? "data" : "bss"
+    $1 = $2 = $3 = ""; sub(/^ +/, "")
+    printf "%6d  %-4s  %s\n", size, kind, $0
+    shown++
+  }'
+
+used=$(avr-size -A "$elf" | awk '$1 == ".data" || $1 == ".bss" || $1 == ".noinit" { sum += $2 } END { print sum + 0 }')
+echo "static SRAM: $used bytes (budget $SRAM_BUDGET)"
+if [ "$used" -gt "$SRAM_BUDGET" ]; then
+  echo "static SRAM over budget" >&2
+  exit 1
+fi